@@ -0,0 +1,44 @@
+#include "Async.h"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include "IoBackend.h"
+
+using namespace Dualys;
+
+
+Scheduler &Dualys::asyncScheduler() {
+    static Scheduler scheduler(SchedulerOptions{
+        .workers = std::max(1u, std::thread::hardware_concurrency()),
+        .reserved_interactive_workers = 0,
+    });
+    return scheduler;
+}
+
+AsyncOperation<std::shared_ptr<Plan> > Dualys::loadFromFileAsync(std::string file_path,
+                                                                 std::shared_ptr<const Plan> base,
+                                                                 Scheduler &scheduler) {
+    return {
+        scheduler, {}, [file_path = std::move(file_path), base = std::move(base)]() -> std::shared_ptr<Plan> {
+            auto content = readFile(file_path);
+            if (!content) {
+                return nullptr;
+            }
+            std::istringstream in(std::move(*content));
+            return Plan::loadFromStream(in, base);
+        }
+    };
+}
+
+AsyncOperation<FileSystemState> Dualys::materializeAsync(std::shared_ptr<const Plan> plan, Scheduler &scheduler) {
+    return {scheduler, {}, [plan = std::move(plan)] { return plan->getFileSystemState(); }};
+}
+
+AsyncOperation<std::unique_ptr<Plan> > Dualys::mergeAsync(std::string new_id, std::shared_ptr<const Plan> planA,
+                                                          std::shared_ptr<const Plan> planB, Scheduler &scheduler) {
+    return {
+        scheduler, {}, [new_id = std::move(new_id), planA = std::move(planA), planB = std::move(planB)] {
+            return Plan::merge(new_id, *planA, *planB);
+        }
+    };
+}
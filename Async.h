@@ -0,0 +1,116 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "Plan.h"
+#include "Scheduler.h"
+
+namespace Dualys {
+    /**
+     * @brief Returns the library's shared scheduler for asynchronous plan operations.
+     *
+     * Created on first use, with one worker per core and no reserved interactive worker.
+     */
+    Scheduler &asyncScheduler();
+
+    /**
+     * @class RejectedError
+     * @brief Raised by `co_await` on an AsyncOperation rejected by the scheduler's admission control.
+     */
+    class RejectedError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * @class AsyncOperation
+     * @brief Awaitable running a blocking operation on a Scheduler.
+     *
+     * `co_await` suspends the awaiting coroutine without holding a thread, queues the operation,
+     * and resumes the coroutine on the worker that completed it, with its result (or its
+     * exception). A coroutine that must go on on its own event loop re-posts itself there.
+     *
+     * If the scheduler rejects the operation, it never runs: `on_rejected` provides the result,
+     * or, without it, `co_await` raises RejectedError. The coroutine does not suspend then, and
+     * the caller decides whether to retry later; the work never runs on the awaiting thread,
+     * which may be an event loop.
+     */
+    template<typename T>
+    class AsyncOperation {
+    public:
+        AsyncOperation(Scheduler &scheduler, ScheduleOptions options, std::function<T()> work,
+                       std::function<T()> on_rejected = {})
+            : m_scheduler(scheduler), m_options(std::move(options)), m_work(std::move(work)),
+              m_on_rejected(std::move(on_rejected)) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(const std::coroutine_handle<> handle) {
+            // The awaiter lives in the suspended coroutine's frame: `this` stays valid until resumption.
+            if (m_scheduler.schedule(m_options, [this, handle] {
+                complete(m_work);
+                handle.resume();
+            })) {
+                return true;
+            }
+            if (m_on_rejected) {
+                complete(m_on_rejected);
+            } else {
+                m_error = std::make_exception_ptr(RejectedError("rejected by admission control"));
+            }
+            return false;
+        }
+
+        T await_resume() {
+            if (m_error) {
+                std::rethrow_exception(m_error);
+            }
+            return std::move(*m_result);
+        }
+
+    private:
+        Scheduler &m_scheduler;
+        ScheduleOptions m_options;
+        std::function<T()> m_work;
+        std::function<T()> m_on_rejected;
+        std::optional<T> m_result;
+        std::exception_ptr m_error;
+
+        void complete(const std::function<T()> &work) {
+            try {
+                m_result.emplace(work());
+            } catch (...) {
+                m_error = std::current_exception();
+            }
+        }
+    };
+
+    /**
+     * @brief Awaitable variant of Plan::loadFromFile(): the file is read, then parsed, on `scheduler`.
+     */
+    AsyncOperation<std::shared_ptr<Plan> > loadFromFileAsync(std::string file_path,
+                                                             std::shared_ptr<const Plan> base = nullptr,
+                                                             Scheduler &scheduler = asyncScheduler());
+
+    /**
+     * @brief Awaitable variant of Plan::getFileSystemState(), computed on `scheduler`.
+     */
+    AsyncOperation<FileSystemState> materializeAsync(std::shared_ptr<const Plan> plan,
+                                                     Scheduler &scheduler = asyncScheduler());
+
+    /**
+     * @brief Awaitable variant of Plan::merge(), computed on `scheduler`.
+     */
+    AsyncOperation<std::unique_ptr<Plan> > mergeAsync(std::string new_id, std::shared_ptr<const Plan> planA,
+                                                      std::shared_ptr<const Plan> planB,
+                                                      Scheduler &scheduler = asyncScheduler());
+}
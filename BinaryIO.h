@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace Dualys {
+    /**
+     * Minimal helpers shared by the binary file formats. Values are written in host byte order.
+     *
+     * Sizes read from a file are not trusted: columns and strings grow by at most kReadChunk bytes
+     * at a time, as their data actually arrives, so a corrupt size fails on the end of the stream
+     * instead of allocating it up front.
+     */
+
+    inline constexpr std::size_t kReadChunk = std::size_t{1} << 20;
+
+    template<typename T>
+    void writeValue(std::ostream &out, const T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    void writeColumn(std::ostream &out, const std::vector<T> &column) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.write(reinterpret_cast<const char *>(column.data()), static_cast<std::streamsize>(column.size() * sizeof(T)));
+    }
+
+    inline void writeString(std::ostream &out, std::string_view value) {
+        writeValue(out, static_cast<std::uint32_t>(value.size()));
+        out.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    template<typename T>
+    bool readValue(std::istream &in, T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+    }
+
+    template<typename T>
+    bool readColumn(std::istream &in, std::vector<T> &column, const std::size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        constexpr std::size_t chunk = std::max<std::size_t>(kReadChunk / sizeof(T), 1);
+        column.clear();
+        while (column.size() < count) {
+            const auto offset = column.size();
+            column.resize(offset + std::min(chunk, count - offset));
+            if (!in.read(reinterpret_cast<char *>(column.data() + offset),
+                         static_cast<std::streamsize>((column.size() - offset) * sizeof(T)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Appends the next `size` bytes of `in` to `value`.
+     */
+    inline bool readBytes(std::istream &in, std::string &value, const std::uint64_t size) {
+        for (std::uint64_t left = size; left > 0;) {
+            const auto offset = value.size();
+            const auto chunk = static_cast<std::size_t>(std::min<std::uint64_t>(kReadChunk, left));
+            value.resize(offset + chunk);
+            if (!in.read(value.data() + offset, static_cast<std::streamsize>(chunk))) {
+                return false;
+            }
+            left -= chunk;
+        }
+        return true;
+    }
+
+    inline bool readString(std::istream &in, std::string &value) {
+        std::uint32_t size = 0;
+        value.clear();
+        return readValue(in, size) && readBytes(in, value, size);
+    }
+}
@@ -0,0 +1,207 @@
+#include "ChangeFeed.h"
+#include "LayerBuilder.h"
+#include <algorithm>
+#include <bit>
+
+using namespace Dualys;
+
+
+bool ChangeBatch::empty() const {
+    return events.empty() && !resync;
+}
+
+std::map<std::string, std::shared_ptr<const Layer> > ChangeBatch::coalesce() const {
+    struct Folded {
+        std::string last_id;
+        std::vector<FileChange> changes;
+    };
+    std::map<std::string, Folded> folded;
+    for (const auto &event: events) {
+        auto &plan = folded[event.plan_id];
+        plan.last_id = event.layer->id;
+        plan.changes.insert(plan.changes.end(), event.layer->changes.begin(), event.layer->changes.end());
+    }
+    std::map<std::string, std::shared_ptr<const Layer> > deltas;
+    for (auto &[plan_id, plan]: folded) {
+        LayerBuilder builder(std::move(plan.last_id));
+        builder.append(std::move(plan.changes));
+        deltas.emplace(plan_id, builder.finish());
+    }
+    return deltas;
+}
+
+Subscription::Subscription(const SubscriptionOptions options)
+    : m_options(options),
+      m_mask(std::bit_ceil(std::max<std::size_t>(options.capacity, 2)) - 1),
+      m_cells(std::make_unique<Cell[]>(m_mask + 1)) {
+    for (std::size_t i = 0; i <= m_mask; ++i) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+Subscription::~Subscription() = default;
+
+ChangeBatch Subscription::poll(const std::size_t max_events) {
+    ChangeBatch batch;
+    batch.resync = m_overflowed.exchange(false, std::memory_order_acquire);
+    LayerEvent event;
+    while (batch.events.size() < max_events && tryPop(event)) {
+        batch.events.push_back(std::move(event));
+    }
+    if (!batch.events.empty()) {
+        m_released.fetch_add(1, std::memory_order_release);
+        m_released.notify_all();
+    }
+    return batch;
+}
+
+ChangeBatch Subscription::wait(const std::chrono::milliseconds timeout, const std::size_t max_events) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+        auto batch = poll(max_events);
+        if (!batch.empty() || isCancelled()) {
+            return batch;
+        }
+        std::unique_lock lock(m_sleep_mutex);
+        // Both this and wakeConsumers() read-modify-write the counter, so one comes first: either
+        // the producer sees a sleeper, or this synchronizes with it and sees its event.
+        m_sleepers.fetch_add(1, std::memory_order_acq_rel);
+        const bool ready = m_ready.wait_until(lock, deadline, [this] {
+            return pending() > 0 || m_overflowed.load(std::memory_order_relaxed) || isCancelled();
+        });
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        if (!ready) {
+            lock.unlock();
+            return poll(max_events);
+        }
+    }
+}
+
+void Subscription::cancel() {
+    m_cancelled.store(true, std::memory_order_release);
+    m_released.fetch_add(1, std::memory_order_release);
+    m_released.notify_all();
+    std::lock_guard lock(m_sleep_mutex);
+    m_ready.notify_all();
+}
+
+bool Subscription::isCancelled() const {
+    return m_cancelled.load(std::memory_order_acquire);
+}
+
+std::size_t Subscription::pending() const {
+    const auto dequeued = m_dequeue.load(std::memory_order_acquire);
+    const auto enqueued = m_enqueue.load(std::memory_order_acquire);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+std::size_t Subscription::capacity() const {
+    return m_mask + 1;
+}
+
+std::uint64_t Subscription::dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+bool Subscription::publish(const LayerEvent &event) {
+    while (!isCancelled()) {
+        const auto released = m_released.load(std::memory_order_acquire);
+        if (tryPush(event)) {
+            wakeConsumers();
+            return true;
+        }
+        if (m_options.backpressure == Backpressure::RESYNC) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            m_overflowed.store(true, std::memory_order_release);
+            wakeConsumers();
+            return false;
+        }
+        m_released.wait(released, std::memory_order_acquire);
+    }
+    return false;
+}
+
+bool Subscription::tryPush(const LayerEvent &event) {
+    // Bounded MPMC ring: a cell is free for position p when its sequence is p, and holds the event
+    // of position p once its sequence is p + 1.
+    auto position = m_enqueue.load(std::memory_order_relaxed);
+    while (true) {
+        auto &cell = m_cells[position & m_mask];
+        const auto sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto lag = static_cast<std::ptrdiff_t>(sequence - position);
+        if (lag == 0) {
+            if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.event = event;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (lag < 0) {
+            return false;
+        } else {
+            position = m_enqueue.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Subscription::tryPop(LayerEvent &event) {
+    auto position = m_dequeue.load(std::memory_order_relaxed);
+    while (true) {
+        auto &cell = m_cells[position & m_mask];
+        const auto sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto lag = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+        if (lag == 0) {
+            if (m_dequeue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                event = std::move(cell.event);
+                cell.event = {};
+                cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (lag < 0) {
+            return false;
+        } else {
+            position = m_dequeue.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Subscription::wakeConsumers() {
+    if (m_sleepers.fetch_add(0, std::memory_order_acq_rel) > 0) {
+        std::lock_guard lock(m_sleep_mutex);
+        m_ready.notify_all();
+    }
+}
+
+std::shared_ptr<Subscription> ChangeFeed::subscribe(const SubscriptionOptions options) {
+    auto subscription = std::make_shared<Subscription>(options);
+    attach(subscription);
+    return subscription;
+}
+
+void ChangeFeed::attach(const std::shared_ptr<Subscription> &subscription) {
+    m_subscriptions.push_back(subscription);
+}
+
+void ChangeFeed::detach(const Subscription &subscription) {
+    std::erase_if(m_subscriptions, [&subscription](const std::weak_ptr<Subscription> &attached) {
+        const auto live = attached.lock();
+        return !live || live.get() == &subscription;
+    });
+}
+
+bool ChangeFeed::empty() const {
+    return std::ranges::none_of(m_subscriptions, [](const std::weak_ptr<Subscription> &attached) {
+        const auto live = attached.lock();
+        return live && !live->isCancelled();
+    });
+}
+
+void ChangeFeed::publish(const LayerEvent &event) {
+    std::erase_if(m_subscriptions, [&event](const std::weak_ptr<Subscription> &attached) {
+        const auto live = attached.lock();
+        if (!live || live->isCancelled()) {
+            return true;
+        }
+        live->publish(event);
+        return false;
+    });
+}
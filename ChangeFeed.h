@@ -0,0 +1,212 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Layer.h"
+#include "StateDigest.h"
+
+namespace Dualys {
+    /**
+     * @struct LayerEvent
+     * @brief A layer applied to a plan, as delivered to its subscriptions.
+     */
+    struct LayerEvent {
+        std::string plan_id;
+
+        /**
+         * @brief Position of the layer among the plan's own layers.
+         */
+        std::uint32_t layer_index = 0;
+
+        std::shared_ptr<const Layer> layer;
+
+        /**
+         * @brief Digest of the plan's state once the layer is applied.
+         */
+        StateDigest digest;
+    };
+
+    /**
+     * @enum Backpressure
+     * @brief What a producer does when a subscription's queue is full.
+     */
+    enum class Backpressure {
+        BLOCK,  ///< Waits for the consumer to make room: applying the layer waits too.
+        RESYNC  ///< Drops the event and flags the next batch for a resynchronization.
+    };
+
+    /**
+     * @struct SubscriptionOptions
+     * @brief Queue bound and overflow policy of a Subscription.
+     */
+    struct SubscriptionOptions {
+        /**
+         * @brief Maximum number of undelivered events, rounded up to a power of two.
+         */
+        std::size_t capacity = 1024;
+
+        Backpressure backpressure = Backpressure::BLOCK;
+    };
+
+    /**
+     * @struct ChangeBatch
+     * @brief Events taken from a Subscription at once, in publication order for each plan.
+     */
+    struct ChangeBatch {
+        std::vector<LayerEvent> events;
+
+        /**
+         * @brief Set when events were dropped since the previous batch (Backpressure::RESYNC): the
+         *        consumer must read the state of the plans again instead of applying the events.
+         */
+        bool resync = false;
+
+        bool empty() const;
+
+        /**
+         * @brief Folds the layers of each plan into a single delta with the same effect, by plan id.
+         *
+         * The delta is built by LayerBuilder, which normalizes and sorts the changes and keeps the
+         * fewest changes per path; it is identified by the last layer it folds.
+         */
+        std::map<std::string, std::shared_ptr<const Layer> > coalesce() const;
+    };
+
+    /**
+     * @class Subscription
+     * @brief Bounded queue of the layers applied to the plans it is attached to.
+     *
+     * Producers (the plans applying layers) and consumers exchange events through a lock-free
+     * ring buffer: publishing an event costs a few atomic operations and never takes a lock while
+     * the queue has room and no consumer sleeps in wait(). When the queue is full, the options'
+     * Backpressure policy applies.
+     *
+     * Thread-safe. A consumer that also applies layers to the plans it watches must not use
+     * Backpressure::BLOCK: it would wait for itself.
+     */
+    class Subscription {
+    public:
+        static constexpr std::size_t kAllEvents = std::numeric_limits<std::size_t>::max();
+
+        explicit Subscription(SubscriptionOptions options = {});
+
+        ~Subscription();
+
+        Subscription(const Subscription &) = delete;
+
+        Subscription &operator=(const Subscription &) = delete;
+
+        /**
+         * @brief Takes up to `max_events` queued events, without waiting.
+         */
+        ChangeBatch poll(std::size_t max_events = kAllEvents);
+
+        /**
+         * @brief Takes up to `max_events` queued events, waiting up to `timeout` for the first one.
+         *
+         * @return An empty batch if none came in time, or if the subscription is cancelled.
+         */
+        ChangeBatch wait(std::chrono::milliseconds timeout, std::size_t max_events = kAllEvents);
+
+        /**
+         * @brief Stops the deliveries and wakes up the producers and consumers waiting on the queue.
+         *
+         * Events already queued can still be polled.
+         */
+        void cancel();
+
+        bool isCancelled() const;
+
+        /**
+         * @brief Returns the number of events queued and not yet taken.
+         */
+        std::size_t pending() const;
+
+        std::size_t capacity() const;
+
+        /**
+         * @brief Returns the number of events dropped under Backpressure::RESYNC.
+         */
+        std::uint64_t dropped() const;
+
+    private:
+        friend class ChangeFeed;
+
+        struct Cell {
+            std::atomic<std::size_t> sequence;
+            LayerEvent event;
+        };
+
+        SubscriptionOptions m_options;
+        std::size_t m_mask;
+        std::unique_ptr<Cell[]> m_cells;
+
+        // Separate cache lines: producers and consumers do not invalidate each other's position.
+        alignas(64) std::atomic<std::size_t> m_enqueue{0};
+        alignas(64) std::atomic<std::size_t> m_dequeue{0};
+
+        // Bumped when room is made or on cancellation; blocked producers wait on it.
+        alignas(64) std::atomic<std::uint64_t> m_released{0};
+        std::atomic<bool> m_cancelled{false};
+        std::atomic<bool> m_overflowed{false};
+        std::atomic<std::uint64_t> m_dropped{0};
+
+        // Consumers sleeping in wait(); producers only take the mutex to wake them up.
+        std::atomic<std::size_t> m_sleepers{0};
+        std::mutex m_sleep_mutex;
+        std::condition_variable m_ready;
+
+        /**
+         * @brief Queues `event`, applying the backpressure policy when full.
+         * @return false if the event was dropped or the subscription is cancelled.
+         */
+        bool publish(const LayerEvent &event);
+
+        bool tryPush(const LayerEvent &event);
+
+        bool tryPop(LayerEvent &event);
+
+        void wakeConsumers();
+    };
+
+    /**
+     * @class ChangeFeed
+     * @brief The subscriptions of a plan, to which it publishes each applied layer.
+     *
+     * Subscriptions are held weakly: dropping or cancelling one unsubscribes it. Like the plan,
+     * the feed is not thread-safe; the subscriptions are.
+     */
+    class ChangeFeed {
+    public:
+        /**
+         * @brief Creates a subscription to the events published from now on.
+         */
+        std::shared_ptr<Subscription> subscribe(SubscriptionOptions options = {});
+
+        /**
+         * @brief Delivers the events published from now on to `subscription` too.
+         */
+        void attach(const std::shared_ptr<Subscription> &subscription);
+
+        void detach(const Subscription &subscription);
+
+        /**
+         * @brief Tells whether no live subscription is attached.
+         */
+        bool empty() const;
+
+        void publish(const LayerEvent &event);
+
+    private:
+        std::vector<std::weak_ptr<Subscription> > m_subscriptions;
+    };
+}
@@ -0,0 +1,273 @@
+#include "ColumnarLayer.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr std::uint32_t kMagic = 0x4c434c50; // "PLCL"
+    constexpr std::uint32_t kVersion = 2;
+    // Version 1 stored the digest column as raw ContentDigest objects.
+    constexpr std::uint32_t kRawDigestsVersion = 1;
+
+    /**
+     * Layout of a digest in a version 1 file: its bytes, their count, then a hexadecimal flag.
+     */
+    struct RawDigest {
+        std::array<char, ContentDigest::kCapacity> bytes;
+        std::uint8_t size;
+        std::uint8_t hex;
+    };
+
+    bool validOffsets(const std::vector<std::uint32_t> &offsets, const std::size_t arena_size) {
+        return offsets.front() == 0 && offsets.back() == arena_size && std::ranges::is_sorted(offsets);
+    }
+
+    std::uint32_t arenaOffset(const std::size_t size) {
+        if (size > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("ColumnarLayer: path arena exceeds 4 GiB");
+        }
+        return static_cast<std::uint32_t>(size);
+    }
+
+    bool readDigests(std::istream &in, std::vector<ContentDigest> &digests, const std::uint32_t count,
+                     const std::uint32_t version) {
+        digests.clear();
+        if (version == kRawDigestsVersion) {
+            std::vector<RawDigest> raw;
+            if (!readColumn(in, raw, count)) {
+                return false;
+            }
+            for (const auto &[bytes, size, hex]: raw) {
+                const auto digest = hex <= 1 && size <= bytes.size()
+                                        ? ContentDigest::fromBytes({bytes.data(), size}, hex != 0)
+                                        : std::nullopt;
+                if (!digest) {
+                    return false;
+                }
+                digests.push_back(*digest);
+            }
+            return true;
+        }
+        for (std::uint32_t i = 0; i < count; ++i) {
+            const auto digest = ContentDigest::readFrom(in);
+            if (!digest) {
+                return false;
+            }
+            digests.push_back(*digest);
+        }
+        return true;
+    }
+}
+
+ChangeRow ChangeRow::of(const FileChange &change) {
+    return ChangeRow{change.path, change.type, ContentDigest(change.new_content_hash), change.metadata, change.target_path};
+}
+
+
+ColumnarLayerView::ColumnarLayerView(const ColumnarLayer &layer)
+    : m_layer(&layer) {
+}
+
+std::string_view ColumnarLayerView::id() const {
+    return m_layer->m_id;
+}
+
+std::size_t ColumnarLayerView::size() const {
+    return m_layer->m_types.size();
+}
+
+bool ColumnarLayerView::empty() const {
+    return size() == 0;
+}
+
+std::string_view ColumnarLayerView::path(const std::size_t index) const {
+    const auto begin = m_layer->m_path_offsets[index];
+    return std::string_view(m_layer->m_path_arena).substr(begin, m_layer->m_path_offsets[index + 1] - begin);
+}
+
+ChangeType ColumnarLayerView::type(const std::size_t index) const {
+    return static_cast<ChangeType>(m_layer->m_types[index]);
+}
+
+const ContentDigest &ColumnarLayerView::digest(const std::size_t index) const {
+    return m_layer->m_digests[index];
+}
+
+FileMetadata ColumnarLayerView::metadata(const std::size_t index) const {
+    return FileMetadata{
+        .size = m_layer->m_sizes[index],
+        .mode = m_layer->m_modes[index],
+        .uid = m_layer->m_uids[index],
+        .gid = m_layer->m_gids[index],
+        .type = m_layer->m_file_types[index]
+    };
+}
+
+std::string_view ColumnarLayerView::targetPath(const std::size_t index) const {
+    const auto begin = m_layer->m_target_offsets[index];
+    return std::string_view(m_layer->m_target_arena).substr(begin, m_layer->m_target_offsets[index + 1] - begin);
+}
+
+ChangeRow ColumnarLayerView::operator[](const std::size_t index) const {
+    return ChangeRow{path(index), type(index), digest(index), metadata(index), targetPath(index)};
+}
+
+std::span<const std::uint8_t> ColumnarLayerView::types() const {
+    return m_layer->m_types;
+}
+
+std::span<const ContentDigest> ColumnarLayerView::digests() const {
+    return m_layer->m_digests;
+}
+
+std::array<std::size_t, kChangeTypeCount> ColumnarLayerView::countByType() const {
+    std::array<std::size_t, kChangeTypeCount> counts{};
+    const auto column = types();
+    // One comparison-and-add per type instead of an indexed increment: the inner loop has no
+    // data-dependent store and vectorizes over the byte column.
+    for (std::size_t type = 0; type < kChangeTypeCount; ++type) {
+        const auto wanted = static_cast<std::uint8_t>(type);
+        std::size_t count = 0;
+        for (const auto value: column) {
+            count += value == wanted;
+        }
+        counts[type] = count;
+    }
+    return counts;
+}
+
+bool ColumnarLayerView::hasDirectoryChanges() const {
+    constexpr auto first_directory_type = static_cast<std::uint8_t>(ChangeType::DIRECTORY_REMOVED);
+    std::size_t count = 0;
+    for (const auto value: types()) {
+        count += value >= first_directory_type;
+    }
+    return count != 0;
+}
+
+
+ColumnarLayer ColumnarLayer::fromLayer(const Layer &layer) {
+    ColumnarLayerBuilder builder(layer.id);
+    std::size_t path_bytes = 0;
+    for (const auto &change: layer.changes) {
+        path_bytes += change.path.size();
+    }
+    builder.reserve(layer.changes.size(), path_bytes);
+    for (const auto &change: layer.changes) {
+        builder.append(change);
+    }
+    return builder.finish();
+}
+
+Layer ColumnarLayer::toLayer() const {
+    const auto columns = view();
+    Layer layer(m_id);
+    layer.changes.reserve(columns.size());
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+        layer.changes.push_back(FileChange{
+            .path = std::string(columns.path(i)),
+            .type = columns.type(i),
+            .new_content_hash = columns.digest(i).str(),
+            .metadata = columns.metadata(i),
+            .target_path = std::string(columns.targetPath(i))
+        });
+    }
+    return layer;
+}
+
+ColumnarLayerView ColumnarLayer::view() const {
+    return ColumnarLayerView(*this);
+}
+
+void ColumnarLayer::writeTo(std::ostream &out) const {
+    writeValue(out, kMagic);
+    writeValue(out, kVersion);
+    writeString(out, m_id);
+    writeValue(out, static_cast<std::uint32_t>(m_types.size()));
+    writeString(out, m_path_arena);
+    writeColumn(out, m_path_offsets);
+    writeString(out, m_target_arena);
+    writeColumn(out, m_target_offsets);
+    writeColumn(out, m_types);
+    for (const auto &digest: m_digests) {
+        digest.writeTo(out);
+    }
+    writeColumn(out, m_sizes);
+    writeColumn(out, m_modes);
+    writeColumn(out, m_uids);
+    writeColumn(out, m_gids);
+    writeColumn(out, m_file_types);
+}
+
+std::optional<ColumnarLayer> ColumnarLayer::readFrom(std::istream &in) {
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    std::uint32_t count = 0;
+    ColumnarLayer layer;
+    if (!readValue(in, magic) || magic != kMagic || !readValue(in, version) ||
+        (version != kVersion && version != kRawDigestsVersion) ||
+        !readString(in, layer.m_id) || !readValue(in, count) ||
+        !readString(in, layer.m_path_arena) || !readColumn(in, layer.m_path_offsets, std::size_t{count} + 1) ||
+        !readString(in, layer.m_target_arena) || !readColumn(in, layer.m_target_offsets, std::size_t{count} + 1) ||
+        !readColumn(in, layer.m_types, count) || !readDigests(in, layer.m_digests, count, version) ||
+        !readColumn(in, layer.m_sizes, count) || !readColumn(in, layer.m_modes, count) ||
+        !readColumn(in, layer.m_uids, count) || !readColumn(in, layer.m_gids, count) ||
+        !readColumn(in, layer.m_file_types, count)) {
+        return std::nullopt;
+    }
+    if (!validOffsets(layer.m_path_offsets, layer.m_path_arena.size()) ||
+        !validOffsets(layer.m_target_offsets, layer.m_target_arena.size()) ||
+        std::ranges::any_of(layer.m_types, [](const std::uint8_t type) { return type >= kChangeTypeCount; }) ||
+        std::ranges::any_of(layer.m_file_types, [](const FileType type) { return type > FileType::SYMLINK; })) {
+        return std::nullopt;
+    }
+    return layer;
+}
+
+
+ColumnarLayerBuilder::ColumnarLayerBuilder(std::string id) {
+    m_layer.m_id = std::move(id);
+}
+
+void ColumnarLayerBuilder::reserve(const std::size_t changes, const std::size_t path_bytes) {
+    m_layer.m_path_arena.reserve(path_bytes);
+    m_layer.m_path_offsets.reserve(changes + 1);
+    m_layer.m_target_offsets.reserve(changes + 1);
+    m_layer.m_types.reserve(changes);
+    m_layer.m_digests.reserve(changes);
+    m_layer.m_sizes.reserve(changes);
+    m_layer.m_modes.reserve(changes);
+    m_layer.m_uids.reserve(changes);
+    m_layer.m_gids.reserve(changes);
+    m_layer.m_file_types.reserve(changes);
+}
+
+void ColumnarLayerBuilder::append(const FileChange &change) {
+    append(ChangeRow::of(change));
+}
+
+void ColumnarLayerBuilder::append(const ChangeRow &row) {
+    m_layer.m_path_arena.append(row.path);
+    m_layer.m_path_offsets.push_back(arenaOffset(m_layer.m_path_arena.size()));
+    m_layer.m_target_arena.append(row.target_path);
+    m_layer.m_target_offsets.push_back(arenaOffset(m_layer.m_target_arena.size()));
+    m_layer.m_types.push_back(static_cast<std::uint8_t>(row.type));
+    m_layer.m_digests.push_back(row.digest);
+    m_layer.m_sizes.push_back(row.metadata.size);
+    m_layer.m_modes.push_back(row.metadata.mode);
+    m_layer.m_uids.push_back(row.metadata.uid);
+    m_layer.m_gids.push_back(row.metadata.gid);
+    m_layer.m_file_types.push_back(row.metadata.type);
+}
+
+ColumnarLayer ColumnarLayerBuilder::finish() {
+    auto layer = std::exchange(m_layer, ColumnarLayer{});
+    m_layer.m_id = layer.m_id;
+    return layer;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "FileEntry.h"
+#include "Layer.h"
+
+namespace Dualys {
+    /**
+     * @brief Number of values of the ChangeType enum.
+     */
+    inline constexpr std::size_t kChangeTypeCount = 6;
+
+    /**
+     * @struct ChangeRow
+     * @brief Non-owning view of a single change, independent of the layer encoding.
+     *
+     * Both Layer (array of structs) and ColumnarLayer (struct of arrays) can be consumed
+     * as a sequence of rows, which lets the materializer and the indexers share one code path.
+     */
+    struct ChangeRow {
+        std::string_view path;
+        ChangeType type;
+        ContentDigest digest;
+        FileMetadata metadata;
+        std::string_view target_path;
+
+        /**
+         * @brief Builds a row referring to the strings of `change`.
+         */
+        static ChangeRow of(const FileChange &change);
+    };
+
+    class ColumnarLayer;
+
+    /**
+     * @class ColumnarLayerView
+     * @brief Read-only, non-owning view over the columns of a ColumnarLayer.
+     *
+     * Each column is a contiguous array, so scans touching a single attribute (e.g. the change
+     * types) only pull that attribute through the cache and compile to vectorizable loops.
+     */
+    class ColumnarLayerView {
+    public:
+        explicit ColumnarLayerView(const ColumnarLayer &layer);
+
+        std::string_view id() const;
+
+        std::size_t size() const;
+
+        bool empty() const;
+
+        std::string_view path(std::size_t index) const;
+
+        ChangeType type(std::size_t index) const;
+
+        const ContentDigest &digest(std::size_t index) const;
+
+        FileMetadata metadata(std::size_t index) const;
+
+        std::string_view targetPath(std::size_t index) const;
+
+        /**
+         * @brief Returns the change at `index` as a row.
+         */
+        ChangeRow operator[](std::size_t index) const;
+
+        /**
+         * @brief The packed change type column, one byte per change.
+         */
+        std::span<const std::uint8_t> types() const;
+
+        /**
+         * @brief The contiguous digest column.
+         */
+        std::span<const ContentDigest> digests() const;
+
+        /**
+         * @brief Counts the changes of each type in a single branch-free pass over the type column.
+         */
+        std::array<std::size_t, kChangeTypeCount> countByType() const;
+
+        /**
+         * @brief Tells whether the layer holds at least one directory change.
+         */
+        bool hasDirectoryChanges() const;
+
+    private:
+        const ColumnarLayer *m_layer;
+    };
+
+    /**
+     * @class ColumnarLayer
+     * @brief Struct-of-arrays encoding of a Layer.
+     *
+     * Paths are stored back to back in a single arena and addressed through an offset column;
+     * move targets use a second, usually empty, arena. Change types are packed one byte per change,
+     * digests are stored in a contiguous fixed-width column, and each metadata field has its own column.
+     *
+     * Instances are built with ColumnarLayerBuilder or converted from a Layer, and are immutable
+     * afterwards.
+     */
+    class ColumnarLayer {
+    public:
+        ColumnarLayer() = default;
+
+        /**
+         * @brief Encodes `layer` in columnar form.
+         */
+        static ColumnarLayer fromLayer(const Layer &layer);
+
+        /**
+         * @brief Decodes the layer back to its array-of-structs form.
+         */
+        Layer toLayer() const;
+
+        ColumnarLayerView view() const;
+
+        /**
+         * @brief Writes the layer to `out` in the binary columnar format (host byte order).
+         *
+         * Digests are written by value, through ContentDigest::writeTo().
+         */
+        void writeTo(std::ostream &out) const;
+
+        /**
+         * @brief Reads a layer written by writeTo().
+         *
+         * @return The layer, or std::nullopt if the input is truncated or malformed.
+         */
+        static std::optional<ColumnarLayer> readFrom(std::istream &in);
+
+    private:
+        friend class ColumnarLayerView;
+        friend class ColumnarLayerBuilder;
+
+        std::string m_id;
+        std::string m_path_arena;
+        std::vector<std::uint32_t> m_path_offsets{0};
+        std::string m_target_arena;
+        std::vector<std::uint32_t> m_target_offsets{0};
+        std::vector<std::uint8_t> m_types;
+        std::vector<ContentDigest> m_digests;
+        std::vector<std::uint64_t> m_sizes;
+        std::vector<std::uint32_t> m_modes;
+        std::vector<std::uint32_t> m_uids;
+        std::vector<std::uint32_t> m_gids;
+        std::vector<FileType> m_file_types;
+    };
+
+    /**
+     * @class ColumnarLayerBuilder
+     * @brief Accumulates changes column by column and produces a ColumnarLayer.
+     */
+    class ColumnarLayerBuilder {
+    public:
+        explicit ColumnarLayerBuilder(std::string id);
+
+        /**
+         * @brief Reserves room for `changes` changes whose paths total `path_bytes` bytes.
+         */
+        void reserve(std::size_t changes, std::size_t path_bytes = 0);
+
+        /**
+         * @brief Appends a change.
+         */
+        void append(const FileChange &change);
+
+        /**
+         * @brief Appends a change given as a row.
+         */
+        void append(const ChangeRow &row);
+
+        /**
+         * @brief Returns the layer built so far and leaves the builder empty.
+         */
+        ColumnarLayer finish();
+
+    private:
+        ColumnarLayer m_layer;
+    };
+}
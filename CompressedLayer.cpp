@@ -0,0 +1,439 @@
+#include "CompressedLayer.h"
+#include "BinaryIO.h"
+#include "ColumnarLayer.h"
+#include "FileEntry.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr std::uint32_t kMagic = 0x5a434c50; // "PLCZ"
+    constexpr std::uint32_t kVersion = 1;
+    constexpr unsigned kTypeBits = 3;
+    constexpr unsigned kFileTypeBits = 2;
+    constexpr std::uint8_t kDirectoryChanges = 1;
+    constexpr std::uint8_t kHexDigest = 0x80;
+    // Digest header of an interned hash: a varint length and the hash follow.
+    constexpr std::uint8_t kLongDigest = 0x7f;
+
+    void putBytes(std::string &out, const std::string_view bytes) {
+        out.append(bytes);
+    }
+
+    template<typename T>
+    void put(std::string &out, const T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void putVarint(std::string &out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    void putBits(std::string &out, const std::vector<std::uint8_t> &values, const unsigned bits) {
+        std::string packed((values.size() * bits + 7) / 8, '\0');
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            const auto bit = i * bits;
+            // A value spans at most two bytes.
+            const unsigned shifted = static_cast<unsigned>(values[i]) << (bit % 8);
+            packed[bit / 8] = static_cast<char>(packed[bit / 8] | (shifted & 0xff));
+            if (shifted > 0xff) {
+                packed[bit / 8 + 1] = static_cast<char>(packed[bit / 8 + 1] | (shifted >> 8));
+            }
+        }
+        out += packed;
+    }
+
+    std::uint32_t offset32(const std::size_t value) {
+        if (value > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("CompressedLayer: encoding exceeds 4 GiB");
+        }
+        return static_cast<std::uint32_t>(value);
+    }
+
+    /**
+     * Bounds-checked cursor over an encoding; any read past the end fails the whole cursor.
+     */
+    class Reader {
+    public:
+        explicit Reader(const std::span<const char> bytes) : m_bytes(bytes) {
+        }
+
+        template<typename T>
+        T get() {
+            T value{};
+            if (!take(sizeof(T))) {
+                return value;
+            }
+            std::memcpy(&value, m_bytes.data() + m_position - sizeof(T), sizeof(T));
+            return value;
+        }
+
+        std::uint64_t varint() {
+            std::uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64 && take(1); shift += 7) {
+                const auto byte = static_cast<std::uint8_t>(m_bytes[m_position - 1]);
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return value;
+                }
+            }
+            m_failed = true;
+            return 0;
+        }
+
+        std::string_view bytes(const std::uint64_t size) {
+            if (size > m_bytes.size() || !take(static_cast<std::size_t>(size))) {
+                return {};
+            }
+            return {m_bytes.data() + m_position - size, static_cast<std::size_t>(size)};
+        }
+
+        std::string_view string() {
+            return bytes(get<std::uint32_t>());
+        }
+
+        std::uint8_t bits(const std::string_view packed, const std::size_t index, const unsigned width) {
+            const auto bit = index * width;
+            if (bit / 8 >= packed.size()) {
+                m_failed = true;
+                return 0;
+            }
+            unsigned value = static_cast<std::uint8_t>(packed[bit / 8]);
+            if (bit / 8 + 1 < packed.size()) {
+                value |= static_cast<unsigned>(static_cast<std::uint8_t>(packed[bit / 8 + 1])) << 8;
+            }
+            return static_cast<std::uint8_t>((value >> (bit % 8)) & ((1u << width) - 1));
+        }
+
+        std::size_t position() const {
+            return m_position;
+        }
+
+        bool ok() const {
+            return !m_failed;
+        }
+
+    private:
+        std::span<const char> m_bytes;
+        std::size_t m_position = 0;
+        bool m_failed = false;
+
+        bool take(const std::size_t size) {
+            if (m_failed || size > m_bytes.size() - m_position) {
+                m_failed = true;
+                return false;
+            }
+            m_position += size;
+            return true;
+        }
+    };
+
+    std::string hexEncode(const std::string_view bytes) {
+        constexpr char kDigits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(2 * bytes.size());
+        for (const char c: bytes) {
+            const auto byte = static_cast<std::uint8_t>(c);
+            hex.push_back(kDigits[byte >> 4]);
+            hex.push_back(kDigits[byte & 0x0f]);
+        }
+        return hex;
+    }
+
+    /**
+     * Encodes the changes `order[first, last)` of `layer` as one block.
+     */
+    std::string encodeBlock(const Layer &layer, const std::vector<std::uint32_t> &order, const std::size_t first,
+                            const std::size_t last) {
+        std::string block;
+        std::vector<std::uint8_t> types;
+        std::vector<std::uint8_t> file_types;
+        for (auto i = first; i < last; ++i) {
+            const auto &change = layer.changes[order[i]];
+            types.push_back(static_cast<std::uint8_t>(change.type));
+            file_types.push_back(static_cast<std::uint8_t>(change.metadata.type));
+        }
+        putBits(block, types, kTypeBits);
+        putBits(block, file_types, kFileTypeBits);
+
+        std::string_view previous;
+        for (auto i = first; i < last; ++i) {
+            const auto &change = layer.changes[order[i]];
+            const std::string_view path = change.path;
+            const auto shared = static_cast<std::size_t>(
+                std::ranges::mismatch(previous, path).in2 - path.begin());
+            putVarint(block, shared);
+            putVarint(block, path.size() - shared);
+            putBytes(block, path.substr(shared));
+            previous = path;
+
+            putVarint(block, order[i]);
+            const ContentDigest digest(change.new_content_hash);
+            const auto digest_bytes = digest.bytes();
+            if (digest.isInterned()) {
+                put(block, kLongDigest);
+                putVarint(block, digest_bytes.size());
+            } else {
+                // Hex hashes are stored in binary: the flag tells to print them back in hex.
+                put(block, static_cast<std::uint8_t>(digest_bytes.size() | (digest.isHex() ? kHexDigest : 0)));
+            }
+            putBytes(block, digest_bytes);
+            putVarint(block, change.metadata.size);
+            putVarint(block, change.metadata.mode);
+            putVarint(block, change.metadata.uid);
+            putVarint(block, change.metadata.gid);
+            putVarint(block, change.target_path.size());
+            putBytes(block, change.target_path);
+        }
+        return block;
+    }
+}
+
+CompressedLayer CompressedLayer::fromLayer(const Layer &layer) {
+    const auto count = offset32(layer.changes.size());
+    std::vector<std::uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0u);
+    // Stable: the changes of a path stay in application order.
+    std::ranges::stable_sort(order, {}, [&](const std::uint32_t i) -> std::string_view {
+        return layer.changes[i].path;
+    });
+
+    // Blocks close after kBlockSize changes, but never between two changes of the same path.
+    std::vector<std::string> blocks;
+    std::vector<std::pair<std::size_t, std::size_t> > ranges;
+    for (std::size_t first = 0; first < order.size();) {
+        auto last = std::min(first + kBlockSize, order.size());
+        while (last < order.size() && layer.changes[order[last]].path == layer.changes[order[last - 1]].path) {
+            ++last;
+        }
+        blocks.push_back(encodeBlock(layer, order, first, last));
+        ranges.emplace_back(first, last);
+        first = last;
+    }
+
+    const bool directory_changes = std::ranges::any_of(layer.changes, [](const FileChange &change) {
+        return isDirectoryChange(change.type);
+    });
+    std::size_t header_size = 2 * sizeof(std::uint32_t) + sizeof(std::uint64_t) + sizeof(std::uint32_t) +
+                              layer.id.size() + sizeof(std::uint32_t) + sizeof(std::uint8_t) +
+                              sizeof(std::uint32_t);
+    for (const auto &[first, last]: ranges) {
+        header_size += 4 * sizeof(std::uint32_t) + layer.changes[order[first]].path.size();
+    }
+    std::size_t total = header_size;
+    for (const auto &block: blocks) {
+        total += block.size();
+    }
+
+    auto encoded = std::make_shared<std::string>();
+    auto &out = *encoded;
+    out.reserve(total);
+    put(out, kMagic);
+    put(out, kVersion);
+    put(out, static_cast<std::uint64_t>(total));
+    put(out, offset32(layer.id.size()));
+    putBytes(out, layer.id);
+    put(out, count);
+    put(out, directory_changes ? kDirectoryChanges : std::uint8_t{0});
+    put(out, offset32(blocks.size()));
+    std::size_t offset = header_size;
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        const auto &first_path = layer.changes[order[ranges[i].first]].path;
+        put(out, offset32(offset));
+        put(out, offset32(blocks[i].size()));
+        put(out, offset32(ranges[i].second - ranges[i].first));
+        put(out, offset32(first_path.size()));
+        putBytes(out, first_path);
+        offset += blocks[i].size();
+    }
+    for (const auto &block: blocks) {
+        out += block;
+    }
+
+    const std::span<const char> bytes(encoded->data(), encoded->size());
+    return *open(bytes, std::move(encoded));
+}
+
+std::optional<CompressedLayer> CompressedLayer::open(std::span<const char> bytes, std::shared_ptr<const void> owner) {
+    if (!owner) {
+        auto copy = std::make_shared<std::string>(bytes.begin(), bytes.end());
+        bytes = std::span<const char>(copy->data(), copy->size());
+        owner = std::move(copy);
+    }
+    Reader in(bytes);
+    CompressedLayer layer;
+    const auto magic = in.get<std::uint32_t>();
+    const auto version = in.get<std::uint32_t>();
+    const auto total = in.get<std::uint64_t>();
+    if (!in.ok() || magic != kMagic || version != kVersion || total > bytes.size()) {
+        return std::nullopt;
+    }
+    layer.m_owner = std::move(owner);
+    layer.m_bytes = bytes.first(static_cast<std::size_t>(total));
+    layer.m_id = in.string();
+    layer.m_size = in.get<std::uint32_t>();
+    layer.m_directory_changes = (in.get<std::uint8_t>() & kDirectoryChanges) != 0;
+    const auto block_count = in.get<std::uint32_t>();
+    std::uint64_t changes = 0;
+    std::uint64_t block_bytes = 0;
+    for (std::uint32_t i = 0; i < block_count && in.ok(); ++i) {
+        Block block{};
+        block.offset = in.get<std::uint32_t>();
+        block.size = in.get<std::uint32_t>();
+        block.count = in.get<std::uint32_t>();
+        block.first_path = in.string();
+        // Every change takes several bytes, and blocks do not overlap: counts beyond the sizes
+        // are corrupt, and would have toLayer() allocate from them.
+        block_bytes += block.size;
+        if (block.offset > total || block.size > total - block.offset || block.count > block.size ||
+            block_bytes > total ||
+            (!layer.m_blocks.empty() && block.first_path <= layer.m_blocks.back().first_path)) {
+            return std::nullopt;
+        }
+        changes += block.count;
+        layer.m_blocks.push_back(block);
+    }
+    if (!in.ok() || changes != layer.m_size) {
+        return std::nullopt;
+    }
+    return layer;
+}
+
+std::optional<CompressedLayer> CompressedLayer::readFrom(std::istream &in) {
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    std::uint64_t total = 0;
+    if (!readValue(in, magic) || !readValue(in, version) || !readValue(in, total) || magic != kMagic ||
+        version != kVersion || total < sizeof(magic) + sizeof(version) + sizeof(total)) {
+        return std::nullopt;
+    }
+    // The encoding is read whole, then used in place. `total` is untrusted: readBytes() only
+    // allocates what the stream actually holds.
+    auto bytes = std::make_shared<std::string>();
+    put(*bytes, magic);
+    put(*bytes, version);
+    put(*bytes, total);
+    if (!readBytes(in, *bytes, total - bytes->size())) {
+        return std::nullopt;
+    }
+    const std::span<const char> span(bytes->data(), bytes->size());
+    return open(span, std::move(bytes));
+}
+
+void CompressedLayer::writeTo(std::ostream &out) const {
+    out.write(m_bytes.data(), static_cast<std::streamsize>(m_bytes.size()));
+}
+
+template<typename Visit>
+bool CompressedLayer::decodeBlock(const Block &block, const Visit &visit) const {
+    Reader in(m_bytes.subspan(block.offset, block.size));
+    const std::size_t count = block.count;
+    const auto types = in.bytes((count * kTypeBits + 7) / 8);
+    const auto file_types = in.bytes((count * kFileTypeBits + 7) / 8);
+    std::string path;
+    for (std::uint32_t i = 0; i < block.count && in.ok(); ++i) {
+        IndexedChange entry{};
+        const auto type = in.bits(types, i, kTypeBits);
+        const auto file_type = in.bits(file_types, i, kFileTypeBits);
+        const auto shared = in.varint();
+        const auto suffix = in.bytes(in.varint());
+        if (!in.ok() || shared > path.size() || type >= kChangeTypeCount ||
+            file_type > static_cast<std::uint8_t>(FileType::SYMLINK)) {
+            return false;
+        }
+        path.resize(static_cast<std::size_t>(shared));
+        path += suffix;
+
+        const auto index = in.varint();
+        const auto digest_header = in.get<std::uint8_t>();
+        const auto digest = in.bytes(digest_header == kLongDigest ? in.varint() : digest_header & ~kHexDigest);
+        auto &change = entry.change;
+        change.metadata.size = in.varint();
+        change.metadata.mode = static_cast<std::uint32_t>(in.varint());
+        change.metadata.uid = static_cast<std::uint32_t>(in.varint());
+        change.metadata.gid = static_cast<std::uint32_t>(in.varint());
+        const auto target = in.bytes(in.varint());
+        if (!in.ok() || index >= m_size) {
+            return false;
+        }
+        entry.index = static_cast<std::uint32_t>(index);
+        change.path = path;
+        change.type = static_cast<ChangeType>(type);
+        change.metadata.type = static_cast<FileType>(file_type);
+        change.new_content_hash = (digest_header & kHexDigest) != 0 ? hexEncode(digest) : std::string(digest);
+        change.target_path = target;
+        if (!visit(std::move(entry))) {
+            break;
+        }
+    }
+    return in.ok();
+}
+
+std::optional<Layer> CompressedLayer::toLayer() const {
+    Layer layer{std::string(m_id)};
+    layer.changes.resize(m_size);
+    std::vector<bool> seen(m_size, false);
+    bool duplicate = false;
+    for (const auto &block: m_blocks) {
+        if (!decodeBlock(block, [&](IndexedChange &&entry) {
+            duplicate = duplicate || seen[entry.index];
+            seen[entry.index] = true;
+            layer.changes[entry.index] = std::move(entry.change);
+            return true;
+        }) || duplicate) {
+            return std::nullopt;
+        }
+    }
+    return layer;
+}
+
+std::optional<std::vector<IndexedChange> > CompressedLayer::find(const std::string_view path) const {
+    // The last block starting at or before `path` is the only one that can hold it.
+    const auto next = std::ranges::upper_bound(m_blocks, path, {}, &Block::first_path);
+    if (next == m_blocks.begin()) {
+        return std::vector<IndexedChange>();
+    }
+    std::vector<IndexedChange> changes;
+    if (!decodeBlock(*std::prev(next), [&](IndexedChange &&entry) {
+        // Sorted by path: past `path`, nothing more to find.
+        if (entry.change.path != path) {
+            return entry.change.path < path;
+        }
+        changes.push_back(std::move(entry));
+        return true;
+    })) {
+        return std::nullopt;
+    }
+    return changes;
+}
+
+std::string_view CompressedLayer::id() const {
+    return m_id;
+}
+
+std::size_t CompressedLayer::size() const {
+    return m_size;
+}
+
+std::size_t CompressedLayer::blockCount() const {
+    return m_blocks.size();
+}
+
+bool CompressedLayer::hasDirectoryChanges() const {
+    return m_directory_changes;
+}
+
+std::span<const char> CompressedLayer::bytes() const {
+    return m_bytes;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Layer.h"
+
+namespace Dualys {
+    /**
+     * @struct IndexedChange
+     * @brief A change of a layer, with its position in the layer.
+     */
+    struct IndexedChange {
+        std::uint32_t index;
+        FileChange change;
+    };
+
+    /**
+     * @class CompressedLayer
+     * @brief Compact, immutable encoding of a Layer with block-level random access by path.
+     *
+     * The changes are sorted by path (then by position, which is kept to restore the application
+     * order) and cut into blocks of about kBlockSize changes; the changes of a path never straddle
+     * two blocks. Within a block, each path is front-coded against the previous one, change types
+     * and file types are bit-packed (3 and 2 bits), digests are stored in binary, and integers as
+     * variable-length integers. Each block decodes on its own.
+     *
+     * A block index holding the first path of each block sits in front of the blocks, so find()
+     * binary-searches it and decompresses a single block. The encoding can be used in place,
+     * e.g. from a mapped file (see open()), without decoding anything up front.
+     */
+    class CompressedLayer {
+    public:
+        /**
+         * @brief Target number of changes per block.
+         */
+        static constexpr std::size_t kBlockSize = 64;
+
+        /**
+         * @brief Encodes `layer`.
+         */
+        static CompressedLayer fromLayer(const Layer &layer);
+
+        /**
+         * @brief Uses the encoding held in `bytes` in place, reading only its header and block index.
+         *
+         * @param owner Keeps `bytes` alive as long as the layer (or its copies) lives; if null, the
+         *        bytes are copied.
+         * @return The layer, or std::nullopt if `bytes` does not start with a valid encoding.
+         */
+        static std::optional<CompressedLayer> open(std::span<const char> bytes,
+                                                   std::shared_ptr<const void> owner = nullptr);
+
+        /**
+         * @brief Reads an encoding written by writeTo().
+         * @return The layer, or std::nullopt if the input is truncated or malformed.
+         */
+        static std::optional<CompressedLayer> readFrom(std::istream &in);
+
+        void writeTo(std::ostream &out) const;
+
+        /**
+         * @brief Decodes every block back to the layer, in application order.
+         * @return std::nullopt if a block is malformed.
+         */
+        std::optional<Layer> toLayer() const;
+
+        /**
+         * @brief Returns the changes addressing `path` itself, in application order.
+         *
+         * Decompresses at most one block. Subtree changes are found under their own path only.
+         *
+         * @return The changes, or std::nullopt if the block holding `path` is malformed.
+         */
+        std::optional<std::vector<IndexedChange> > find(std::string_view path) const;
+
+        std::string_view id() const;
+
+        /**
+         * @brief Returns the number of changes.
+         */
+        std::size_t size() const;
+
+        std::size_t blockCount() const;
+
+        /**
+         * @brief Tells whether the layer holds DIRECTORY_REMOVED or DIRECTORY_MOVED changes.
+         */
+        bool hasDirectoryChanges() const;
+
+        /**
+         * @brief Returns the whole encoding, as written by writeTo().
+         */
+        std::span<const char> bytes() const;
+
+    private:
+        struct Block {
+            std::string_view first_path;
+            std::size_t offset;
+            std::size_t size;
+            std::uint32_t count;
+        };
+
+        std::shared_ptr<const void> m_owner;
+        std::span<const char> m_bytes;
+        std::string_view m_id;
+        std::uint32_t m_size = 0;
+        bool m_directory_changes = false;
+        std::vector<Block> m_blocks;
+
+        template<typename Visit>
+        bool decodeBlock(const Block &block, const Visit &visit) const;
+    };
+}
@@ -0,0 +1,298 @@
+#include "ContentIndex.h"
+#include "PathUtils.h"
+#include "Plan.h"
+#include <algorithm>
+#include <set>
+#include <utility>
+
+using namespace Dualys;
+
+
+StringInterner::Id StringInterner::intern(std::string_view value) {
+    if (const auto it = m_ids.find(value); it != m_ids.end()) {
+        return it->second;
+    }
+    const auto id = static_cast<Id>(m_values.size());
+    const auto &stored = m_values.emplace_back(value);
+    m_ids.emplace(stored, id);
+    return id;
+}
+
+std::optional<StringInterner::Id> StringInterner::find(std::string_view value) const {
+    if (const auto it = m_ids.find(value); it != m_ids.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+const std::string &StringInterner::get(Id id) const {
+    return m_values[id];
+}
+
+std::size_t StringInterner::size() const {
+    return m_values.size();
+}
+
+
+void ContentIndex::indexLayer(const Plan &plan, const Layer &layer) {
+    auto &plan_record = recordOf(plan);
+    for (const auto &change: layer.changes) {
+        record(plan, plan_record, ChangeRow::of(change));
+    }
+}
+
+void ContentIndex::indexLayer(const Plan &plan, const ColumnarLayerView &layer) {
+    auto &plan_record = recordOf(plan);
+    for (std::size_t i = 0; i < layer.size(); ++i) {
+        record(plan, plan_record, layer[i]);
+    }
+}
+
+void ContentIndex::indexPlan(const Plan &plan) {
+    // Amortized: the records are scanned once for every as many records created.
+    if (m_records.size() >= 2 * m_records_after_collection + 64) {
+        collectGarbage();
+    }
+    for (const Plan *current = &plan; current; current = current->getBasePlan().get()) {
+        if (findRecord(current)) {
+            break;
+        }
+        // Plans without layers still get a record so they are not rescanned.
+        recordOf(*current);
+        for (const auto &layer: current->getLayers()) {
+            indexLayer(*current, *layer);
+        }
+    }
+}
+
+void ContentIndex::dropPlan(const Plan &plan) {
+    if (const auto it = m_records.find(&plan); it != m_records.end()) {
+        dropRecord(it);
+    }
+}
+
+std::size_t ContentIndex::collectGarbage() {
+    std::size_t dropped = 0;
+    for (auto it = m_records.begin(); it != m_records.end();) {
+        const auto next = std::next(it);
+        if (isStale(it->second)) {
+            dropRecord(it);
+            ++dropped;
+        }
+        it = next;
+    }
+    m_records_after_collection = m_records.size();
+    return dropped;
+}
+
+std::vector<std::string> ContentIndex::findPaths(const std::string &hash,
+                                                 const std::vector<const Plan *> &plans) const {
+    std::set<PathId> ids;
+    resolve(hash, plans, [&](const Plan *, PathId path) { ids.insert(path); });
+
+    std::vector<std::string> paths;
+    paths.reserve(ids.size());
+    for (const auto id: ids) {
+        paths.push_back(m_paths.get(id));
+    }
+    std::ranges::sort(paths);
+    return paths;
+}
+
+std::vector<const Plan *> ContentIndex::findPlans(const std::string &hash,
+                                                  const std::vector<const Plan *> &plans) const {
+    std::vector<const Plan *> found;
+    resolve(hash, plans, [&](const Plan *plan, PathId) {
+        if (found.empty() || found.back() != plan) {
+            found.push_back(plan);
+        }
+    });
+    std::ranges::sort(found);
+    found.erase(std::ranges::unique(found).begin(), found.end());
+    return found;
+}
+
+std::size_t ContentIndex::pathCount() const {
+    return m_paths.size();
+}
+
+ContentIndex::PlanRecord &ContentIndex::recordOf(const Plan &plan) {
+    auto it = m_records.find(&plan);
+    if (it != m_records.end()) {
+        if (!isStale(it->second)) {
+            return it->second;
+        }
+        dropRecord(it);
+    }
+    it = m_records.try_emplace(&plan).first;
+    it->second.plan = plan.weak_from_this();
+    it->second.tracked = !it->second.plan.expired();
+    return it->second;
+}
+
+const ContentIndex::PlanRecord *ContentIndex::findRecord(const Plan *plan) const {
+    const auto it = m_records.find(plan);
+    return it == m_records.end() || isStale(it->second) ? nullptr : &it->second;
+}
+
+bool ContentIndex::isStale(const PlanRecord &plan_record) {
+    return plan_record.tracked && plan_record.plan.expired();
+}
+
+void ContentIndex::dropRecord(const std::unordered_map<const Plan *, PlanRecord>::iterator record) {
+    const auto *owner = record->first;
+    for (const auto hash: record->second.posted) {
+        const auto postings = m_postings.find(hash);
+        std::erase_if(postings->second, [owner](const Posting &posting) { return posting.owner == owner; });
+        if (postings->second.empty()) {
+            m_postings.erase(postings);
+        }
+    }
+    m_records.erase(record);
+}
+
+void ContentIndex::record(const Plan &plan, PlanRecord &plan_record, const ChangeRow &change) {
+    switch (change.type) {
+        case ChangeType::ADDED:
+        case ChangeType::MODIFIED:
+            write(plan, plan_record, internPath(change.path), m_hashes.intern(change.digest.str()));
+            break;
+
+        case ChangeType::REMOVED:
+            plan_record.last_write[internPath(change.path)] = kRemoved;
+            break;
+
+        case ChangeType::PERMISSION_CHANGED:
+            break;
+
+        case ChangeType::DIRECTORY_REMOVED:
+            removeSubtree(plan_record, std::string(change.path));
+            break;
+
+        case ChangeType::DIRECTORY_MOVED: {
+            if (change.path == change.target_path || isInSubtree(change.target_path, change.path)) {
+                break;
+            }
+            std::vector<std::pair<std::string, HashId> > moved;
+            forEachInSubtree(std::string(change.path), [&](const PathId path) {
+                if (const auto hash = visibleHash(plan, path); hash != kRemoved) {
+                    moved.emplace_back(reparentPath(m_paths.get(path), change.path, change.target_path), hash);
+                }
+            });
+            removeSubtree(plan_record, std::string(change.target_path));
+            removeSubtree(plan_record, std::string(change.path));
+            for (const auto &[path, hash]: moved) {
+                write(plan, plan_record, internPath(path), hash);
+            }
+            break;
+        }
+    }
+}
+
+void ContentIndex::write(const Plan &plan, PlanRecord &plan_record, const PathId path, const HashId hash) {
+    auto [it, inserted] = plan_record.last_write.try_emplace(path, hash);
+    if (!inserted) {
+        if (it->second == hash) {
+            return;
+        }
+        it->second = hash;
+    }
+    m_postings[hash].push_back(Posting{&plan, path});
+    plan_record.posted.insert(hash);
+}
+
+void ContentIndex::removeSubtree(PlanRecord &plan_record, const std::string &directory) {
+    forEachInSubtree(directory, [&](const PathId path) {
+        if (const auto it = plan_record.last_write.find(path); it != plan_record.last_write.end()) {
+            it->second = kRemoved;
+        }
+    });
+    plan_record.removed_subtrees.push_back(directory);
+}
+
+void ContentIndex::forEachInSubtree(const std::string &directory, const std::function<void(PathId)> &visit) const {
+    if (const auto it = m_path_order.find(directory); it != m_path_order.end()) {
+        visit(it->second);
+    }
+    const auto prefix = subtreePrefix(directory);
+    const auto upper = subtreeUpperBound(prefix);
+    for (auto it = m_path_order.lower_bound(prefix); it != m_path_order.end() && it->first < upper; ++it) {
+        visit(it->second);
+    }
+}
+
+bool ContentIndex::shadows(const PlanRecord &plan_record, const PathId path) const {
+    if (plan_record.last_write.contains(path)) {
+        return true;
+    }
+    const auto &path_string = m_paths.get(path);
+    return std::ranges::any_of(plan_record.removed_subtrees, [&](const std::string &directory) {
+        return isInSubtree(path_string, directory);
+    });
+}
+
+ContentIndex::HashId ContentIndex::visibleHash(const Plan &plan, const PathId path) const {
+    for (const Plan *current = &plan; current; current = current->getBasePlan().get()) {
+        const auto *current_record = findRecord(current);
+        if (!current_record) {
+            continue;
+        }
+        if (const auto it = current_record->last_write.find(path); it != current_record->last_write.end()) {
+            return it->second;
+        }
+        if (shadows(*current_record, path)) {
+            return kRemoved;
+        }
+    }
+    return kRemoved;
+}
+
+ContentIndex::PathId ContentIndex::internPath(std::string_view path) {
+    const auto id = m_paths.intern(path);
+    m_path_order.try_emplace(m_paths.get(id), id);
+    return id;
+}
+
+void ContentIndex::resolve(const std::string &hash, const std::vector<const Plan *> &plans,
+                           const std::function<void(const Plan *, PathId)> &visit) const {
+    const auto hash_id = m_hashes.find(hash);
+    if (!hash_id) {
+        return;
+    }
+    const auto postings = m_postings.find(*hash_id);
+    if (postings == m_postings.end()) {
+        return;
+    }
+
+    // Keep only the postings that are still the latest write within their owner.
+    std::set<std::pair<const Plan *, PathId> > live;
+    for (const auto &[owner, path]: postings->second) {
+        const auto *owner_record = findRecord(owner);
+        if (!owner_record) {
+            continue;
+        }
+        const auto &last_write = owner_record->last_write;
+        if (const auto it = last_write.find(path); it != last_write.end() && it->second == *hash_id) {
+            live.emplace(owner, path);
+        }
+    }
+    if (live.empty()) {
+        return;
+    }
+
+    for (const Plan *plan: plans) {
+        for (const auto &[owner, path]: live) {
+            // Walk from the plan towards the owner; any closer write to the path shadows the posting.
+            for (const Plan *current = plan; current; current = current->getBasePlan().get()) {
+                if (current == owner) {
+                    visit(plan, path);
+                    break;
+                }
+                const auto *current_record = findRecord(current);
+                if (current_record && shadows(*current_record, path)) {
+                    break;
+                }
+            }
+        }
+    }
+}
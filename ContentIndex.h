@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ColumnarLayer.h"
+#include "Layer.h"
+
+namespace Dualys {
+    class Plan;
+
+    /**
+     * @class StringInterner
+     * @brief Assigns dense 32-bit identifiers to strings.
+     *
+     * Each distinct string is stored exactly once; callers then manipulate the
+     * compact identifier instead of the string itself. Identifiers are stable for
+     * the lifetime of the interner.
+     */
+    class StringInterner {
+    public:
+        using Id = std::uint32_t;
+
+        /**
+         * @brief Returns the identifier of `value`, interning it on first use.
+         */
+        Id intern(std::string_view value);
+
+        /**
+         * @brief Returns the identifier of `value` if it was interned before.
+         */
+        std::optional<Id> find(std::string_view value) const;
+
+        /**
+         * @brief Returns the string associated with an identifier.
+         */
+        const std::string &get(Id id) const;
+
+        /**
+         * @brief Returns the number of interned strings.
+         */
+        std::size_t size() const;
+
+    private:
+        /**
+         * @brief Owns the interned strings. A deque never relocates its elements,
+         * so the views stored in `m_ids` remain valid.
+         */
+        std::deque<std::string> m_values;
+
+        std::unordered_map<std::string_view, Id> m_ids;
+    };
+
+    /**
+     * @class ContentIndex
+     * @brief Reverse index from content hash to the paths and plans holding it.
+     *
+     * The index is fed incrementally with the layers applied to each plan. For every
+     * plan it records the last hash written to each path by the plan's own layers,
+     * and for every hash a posting list of (plan, interned path id) pairs. Queries
+     * resolve visibility by walking base chains and probing those per-plan records,
+     * so no plan is ever materialized.
+     *
+     * Postings are append-only: entries overwritten by a later layer stay in the list
+     * and are filtered out at query time.
+     *
+     * Directory changes are recorded as subtree barriers hiding the ancestors' entries;
+     * a moved subtree is re-posted under its destination from the interned paths of its source.
+     */
+    class ContentIndex {
+    public:
+        using PathId = StringInterner::Id;
+        using HashId = StringInterner::Id;
+
+        /**
+         * @brief Records the effects of `layer`, which was just appended to `plan`.
+         */
+        void indexLayer(const Plan &plan, const Layer &layer);
+
+        /**
+         * @brief Records the effects of a columnar layer, which was just appended to `plan`.
+         */
+        void indexLayer(const Plan &plan, const ColumnarLayerView &layer);
+
+        /**
+         * @brief Indexes every layer of `plan` and of its ancestors not yet known to the index.
+         */
+        void indexPlan(const Plan &plan);
+
+        /**
+         * @brief Forgets the records owned by `plan`.
+         *
+         * Must only be called once no indexed plan uses `plan` as an ancestor anymore.
+         */
+        void dropPlan(const Plan &plan);
+
+        /**
+         * @brief Forgets the records of the plans destroyed since they were indexed.
+         *
+         * Plans owned by a shared_ptr are tracked weakly: the records of a destroyed plan are
+         * ignored by queries at once, and reclaimed here. A plan later allocated at the same
+         * address starts from a clean record. indexPlan() also calls this once the number of
+         * records has doubled since the last collection, so that memory stays bounded.
+         *
+         * @return The number of plans forgotten.
+         */
+        std::size_t collectGarbage();
+
+        /**
+         * @brief Lists the paths holding `hash` in the effective state of at least one of `plans`.
+         *
+         * @return The paths, sorted and without duplicates.
+         */
+        std::vector<std::string> findPaths(const std::string &hash, const std::vector<const Plan *> &plans) const;
+
+        /**
+         * @brief Lists the plans among `plans` whose effective state holds `hash` at some path.
+         */
+        std::vector<const Plan *> findPlans(const std::string &hash, const std::vector<const Plan *> &plans) const;
+
+        /**
+         * @brief Returns the number of distinct interned paths.
+         */
+        std::size_t pathCount() const;
+
+    private:
+        static constexpr HashId kRemoved = static_cast<HashId>(-1);
+
+        struct Posting {
+            const Plan *owner;
+            PathId path;
+        };
+
+        struct PlanRecord {
+            /**
+             * @brief The plan, to tell a destroyed plan from a new one allocated at its address.
+             *        Empty, and the record never considered stale, if the plan is not owned by a shared_ptr.
+             */
+            std::weak_ptr<const Plan> plan;
+
+            bool tracked = false;
+
+            /**
+             * @brief Hashes whose posting lists hold postings of the plan, so that they are dropped with it.
+             */
+            std::unordered_set<HashId> posted;
+
+            /**
+             * @brief Last hash written to each path by the plan's own layers (`kRemoved` for a removal).
+             */
+            std::unordered_map<PathId, HashId> last_write;
+
+            /**
+             * @brief Directories removed (or moved away, or overwritten by a move) by the plan's own layers.
+             */
+            std::vector<std::string> removed_subtrees;
+        };
+
+        /**
+         * @brief Returns the record of `plan`, created or reset (if left by a destroyed plan) as needed.
+         */
+        PlanRecord &recordOf(const Plan &plan);
+
+        /**
+         * @brief Returns the record of `plan`, or nullptr if it has none or it was left by a destroyed plan.
+         */
+        const PlanRecord *findRecord(const Plan *plan) const;
+
+        static bool isStale(const PlanRecord &plan_record);
+
+        void dropRecord(std::unordered_map<const Plan *, PlanRecord>::iterator record);
+
+        void record(const Plan &plan, PlanRecord &plan_record, const ChangeRow &change);
+
+        void write(const Plan &plan, PlanRecord &plan_record, PathId path, HashId hash);
+
+        void removeSubtree(PlanRecord &plan_record, const std::string &directory);
+
+        /**
+         * @brief Calls `visit(id)` for the interned path `directory` and each interned path below it.
+         */
+        void forEachInSubtree(const std::string &directory, const std::function<void(PathId)> &visit) const;
+
+        /**
+         * @brief Tells whether `plan_record` decides the value of `path`, hiding any ancestor.
+         */
+        bool shadows(const PlanRecord &plan_record, PathId path) const;
+
+        /**
+         * @brief Returns the hash visible at `path` from `plan`, or `kRemoved` if the path is absent.
+         */
+        HashId visibleHash(const Plan &plan, PathId path) const;
+
+        PathId internPath(std::string_view path);
+
+        /**
+         * @brief Calls `visit(plan, path)` for every (plan, path) pair where `hash` is visible.
+         */
+        void resolve(const std::string &hash, const std::vector<const Plan *> &plans,
+                     const std::function<void(const Plan *, PathId)> &visit) const;
+
+        StringInterner m_paths;
+        StringInterner m_hashes;
+
+        /**
+         * @brief Interned paths in lexicographic order, used to enumerate subtrees.
+         */
+        std::map<std::string_view, PathId> m_path_order;
+        std::unordered_map<const Plan *, PlanRecord> m_records;
+        std::unordered_map<HashId, std::vector<Posting> > m_postings;
+
+        /**
+         * @brief Number of records left by the last collectGarbage().
+         */
+        std::size_t m_records_after_collection = 0;
+    };
+}
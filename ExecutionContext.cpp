@@ -0,0 +1,118 @@
+#include "ExecutionContext.h"
+#include <algorithm>
+#include <ctime>
+#include <utility>
+
+using namespace Dualys;
+
+
+namespace {
+    std::chrono::nanoseconds threadCpuTime() {
+        timespec now{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+    }
+
+    const char *describe(const ExecutionStatus status) {
+        switch (status) {
+            case ExecutionStatus::COMPLETED:
+                return "completed";
+            case ExecutionStatus::CANCELLED:
+                return "cancelled";
+            case ExecutionStatus::DEADLINE_EXCEEDED:
+                return "deadline exceeded";
+            case ExecutionStatus::CPU_LIMIT_EXCEEDED:
+                return "CPU time limit exceeded";
+            case ExecutionStatus::MEMORY_LIMIT_EXCEEDED:
+                return "memory limit exceeded";
+            case ExecutionStatus::FUEL_EXHAUSTED:
+                return "fuel exhausted";
+            case ExecutionStatus::REJECTED:
+                return "rejected by admission control";
+        }
+        return "unknown";
+    }
+}
+
+ExecutionLimits ExecutionLimits::within(const std::chrono::steady_clock::duration timeout) {
+    ExecutionLimits limits;
+    limits.deadline = std::chrono::steady_clock::now() + timeout;
+    return limits;
+}
+
+ExecutionContext::ExecutionContext(ExecutionLimits limits, std::stop_token stop_token)
+    : m_limits(std::move(limits)), m_stop_token(std::move(stop_token)), m_cpu_start(threadCpuTime()) {
+}
+
+std::optional<ExecutionStatus> ExecutionContext::checkpoint() {
+    if (m_status != ExecutionStatus::COMPLETED) {
+        return m_status;
+    }
+    if (m_stop_token.stop_requested()) {
+        return fail(ExecutionStatus::CANCELLED);
+    }
+    if (m_limits.deadline && std::chrono::steady_clock::now() >= *m_limits.deadline) {
+        return fail(ExecutionStatus::DEADLINE_EXCEEDED);
+    }
+    if (m_limits.cpu_time.count() > 0 && cpuTime() >= m_limits.cpu_time) {
+        return fail(ExecutionStatus::CPU_LIMIT_EXCEEDED);
+    }
+    return std::nullopt;
+}
+
+bool ExecutionContext::consumeFuel(const std::uint64_t units) {
+    m_fuel_used += units;
+    if (m_limits.fuel > 0 && m_fuel_used > m_limits.fuel) {
+        fail(ExecutionStatus::FUEL_EXHAUSTED);
+        return false;
+    }
+    return true;
+}
+
+bool ExecutionContext::reserveMemory(const std::size_t bytes) {
+    if (m_limits.memory_bytes > 0 && m_memory_used + bytes > m_limits.memory_bytes) {
+        fail(ExecutionStatus::MEMORY_LIMIT_EXCEEDED);
+        return false;
+    }
+    m_memory_used += bytes;
+    return true;
+}
+
+void ExecutionContext::releaseMemory(const std::size_t bytes) {
+    m_memory_used -= std::min(bytes, m_memory_used);
+}
+
+ExecutionStatus ExecutionContext::status() const {
+    return m_status;
+}
+
+ExecutionResult ExecutionContext::interrupted() const {
+    return ExecutionResult{-1, describe(m_status), m_status, nullptr};
+}
+
+const ExecutionLimits &ExecutionContext::limits() const {
+    return m_limits;
+}
+
+const std::stop_token &ExecutionContext::stopToken() const {
+    return m_stop_token;
+}
+
+std::chrono::nanoseconds ExecutionContext::cpuTime() const {
+    return threadCpuTime() - m_cpu_start;
+}
+
+std::uint64_t ExecutionContext::fuelUsed() const {
+    return m_fuel_used;
+}
+
+std::size_t ExecutionContext::memoryUsed() const {
+    return m_memory_used;
+}
+
+std::optional<ExecutionStatus> ExecutionContext::fail(const ExecutionStatus status) {
+    if (m_status == ExecutionStatus::COMPLETED) {
+        m_status = status;
+    }
+    return m_status;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stop_token>
+#include "ExecutionResult.h"
+
+namespace Dualys {
+    /**
+     * @struct ExecutionLimits
+     * @brief Bounds of a single run. A zero or unset limit is unbounded.
+     */
+    struct ExecutionLimits {
+        /**
+         * @brief Point in time after which the run is abandoned, including the time spent queued.
+         */
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+
+        /**
+         * @brief CPU time the run may consume on its thread.
+         */
+        std::chrono::milliseconds cpu_time{0};
+
+        /**
+         * @brief Memory the strategy may reserve for the run (e.g. WASM linear memory).
+         */
+        std::size_t memory_bytes = 0;
+
+        /**
+         * @brief Abstract work units the strategy may consume (e.g. WASM instructions).
+         */
+        std::uint64_t fuel = 0;
+
+        /**
+         * @brief Returns limits whose deadline is `timeout` from now.
+         */
+        static ExecutionLimits within(std::chrono::steady_clock::duration timeout);
+    };
+
+    /**
+     * @class ExecutionContext
+     * @brief Cancellation and resource accounting of a run, handed to the strategy.
+     *
+     * Limits are enforced cooperatively: the strategy calls checkpoint() between units of work,
+     * charges the work it performs with consumeFuel() and the memory it allocates with
+     * reserveMemory(), and stops with the returned status as soon as one of them reports a
+     * violation. The first violation is remembered in status().
+     *
+     * A context belongs to a single run, executed on a single thread.
+     */
+    class ExecutionContext {
+    public:
+        explicit ExecutionContext(ExecutionLimits limits = {}, std::stop_token stop_token = {});
+
+        /**
+         * @brief Checks cancellation, the deadline and the CPU time budget.
+         * @return The reason to stop, or std::nullopt to go on.
+         */
+        std::optional<ExecutionStatus> checkpoint();
+
+        /**
+         * @brief Charges `units` of fuel.
+         * @return false once the fuel budget is exhausted.
+         */
+        bool consumeFuel(std::uint64_t units);
+
+        /**
+         * @brief Charges `bytes` of memory.
+         * @return false, without charging them, if they would exceed the memory budget.
+         */
+        bool reserveMemory(std::size_t bytes);
+
+        /**
+         * @brief Returns memory previously charged with reserveMemory().
+         */
+        void releaseMemory(std::size_t bytes);
+
+        /**
+         * @brief Returns the first violation reported, or COMPLETED.
+         */
+        ExecutionStatus status() const;
+
+        /**
+         * @brief Returns a result carrying the first violation reported, for the strategy to return.
+         */
+        ExecutionResult interrupted() const;
+
+        const ExecutionLimits &limits() const;
+
+        const std::stop_token &stopToken() const;
+
+        /**
+         * @brief Returns the CPU time consumed by the calling thread since the context was created.
+         */
+        std::chrono::nanoseconds cpuTime() const;
+
+        std::uint64_t fuelUsed() const;
+
+        std::size_t memoryUsed() const;
+
+    private:
+        ExecutionLimits m_limits;
+        std::stop_token m_stop_token;
+        std::chrono::nanoseconds m_cpu_start;
+        std::uint64_t m_fuel_used = 0;
+        std::size_t m_memory_used = 0;
+        ExecutionStatus m_status = ExecutionStatus::COMPLETED;
+
+        std::optional<ExecutionStatus> fail(ExecutionStatus status);
+    };
+}
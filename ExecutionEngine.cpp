@@ -1,59 +1,330 @@
 #include "ExecutionEngine.h"
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
 
 namespace Dualys {
 
+    // --- Implémentation de IExecutionStrategy ---
+
+    std::optional<std::string> IExecutionStrategy::cacheKey(const Plan& plan) const {
+        return id() + ":" + plan.getStateDigest().str();
+    }
+
+    std::optional<std::string> IExecutionStrategy::entryPoint(const Plan&) const {
+        return std::nullopt;
+    }
+
+
     // --- Implémentation de WasmStrategy ---
 
+    WasmStrategy::WasmStrategy(std::shared_ptr<SandboxPool> pool)
+        : m_pool(std::move(pool)) {
+    }
+
     /**
      * C'est ici que la logique d'exécution de WebAssembly prendrait place.
      * Pour l'instant, nous mettons un placeholder qui simule l'action.
      */
-    void WasmStrategy::execute(const Plan& plan) const {
+    ExecutionResult WasmStrategy::execute(VirtualFileSystem& filesystem, ExecutionContext& context) const {
+        const auto& plan = *filesystem.getPlan();
         std::cout << "--- [WasmStrategy] Début de l'exécution du Plan: " << plan.getId() << " ---" << std::endl;
 
-        // 1. Obtenir l'état du système de fichiers du Plan.
-        std::cout << "[WasmStrategy] Matérialisation du système de fichiers virtuel..." << std::endl;
-        auto const fs_state = plan.getFileSystemState();
-
-        // 2. Rechercher le fichier .wasm principal à exécuter dans le FS.
+        // 1. Rechercher le fichier .wasm principal à exécuter dans le FS.
         // (Exemple : on cherche un fichier nommé "main.wasm" à la racine).
-        std::string wasm_entry_point = "/main.wasm";
-        if (fs_state.count(wasm_entry_point)) {
+        // La recherche est ponctuelle : l'état du Plan n'est jamais matérialisé ni copié.
+        std::string wasm_entry_point = kEntryPoint;
+        ExecutionResult result;
+        if (const auto entry = filesystem.stat(wasm_entry_point)) {
             std::cout << "[WasmStrategy] Fichier d'entrée '" << wasm_entry_point << "' trouvé." << std::endl;
-            std::cout << "[WasmStrategy] Hash du contenu: " << fs_state.at(wasm_entry_point) << std::endl;
+            std::cout << "[WasmStrategy] Hash du contenu: " << entry->digest.str() << std::endl;
 
-            // 3. Initialiser un runtime WASM (ex: Wasmtime, WAVM).
-            std::cout << "[WasmStrategy] Initialisation du bac à sable (sandbox) WASM..." << std::endl;
+            // 2. Emprunter un sandbox WASM (ex: instance Wasmtime, WAVM) pour ce module.
+            //    Le module chargé occupe sa taille en mémoire : elle est décomptée du budget.
+            if (context.checkpoint() || !context.reserveMemory(entry->metadata.size)) {
+                std::cerr << "[WasmStrategy] Exécution interrompue avant le démarrage." << std::endl;
+                return context.interrupted();
+            }
+            // Démarrage à chaud si une instance du même module est libre, sinon instanciation.
+            // Le bail réinitialise le sandbox et le rend au pool en fin de portée.
+            const auto sandbox = m_pool->acquire(entry->digest, entry->metadata.size);
+            std::cout << "[WasmStrategy] Sandbox WASM " << (sandbox.warm() ? "réutilisé (à chaud)." : "initialisé (à froid).")
+                      << std::endl;
 
-            // 4. Charger le code WASM et l'exécuter dans le sandbox.
-            //    Le sandbox aurait accès à une version en lecture seule du fs_state.
+            // 3. Charger le code WASM et l'exécuter dans le sandbox.
+            //    Le sandbox accède au FS à travers `filesystem` : lectures résolues à la demande,
+            //    écritures enregistrées dans une couche privée, dont le moteur fait la couche du
+            //    résultat.
+            //    Un vrai runtime consommerait du carburant par instruction (ex: fuel de Wasmtime)
+            //    et vérifierait le contexte à chaque appel d'hôte ; ici, une seule étape simulée.
             std::cout << "[WasmStrategy] Exécution du code..." << std::endl;
             // ... ici irait le vrai code d'exécution ...
+            sandbox->touch(entry->metadata.size);
+            if (!context.consumeFuel(kFuelPerStep) || context.checkpoint()) {
+                std::cerr << "[WasmStrategy] Exécution interrompue." << std::endl;
+                context.releaseMemory(entry->metadata.size);
+                return context.interrupted();
+            }
+            context.releaseMemory(entry->metadata.size);
             std::cout << "[WasmStrategy] Exécution terminée avec succès." << std::endl;
+            result.output = "executed " + wasm_entry_point + " (" + entry->digest.str() + ")";
 
         } else {
             std::cerr << "[WasmStrategy] ERREUR: Point d'entrée '" << wasm_entry_point << "' non trouvé dans le Plan." << std::endl;
+            result.exit_code = 1;
+            result.output = "entry point " + wasm_entry_point + " not found";
         }
 
         std::cout << "--- [WasmStrategy] Fin de l'exécution du Plan: " << plan.getId() << " ---" << std::endl;
+        return result;
+    }
+
+    std::string WasmStrategy::id() const {
+        return "wasm";
+    }
+
+    std::optional<std::string> WasmStrategy::entryPoint(const Plan& plan) const {
+        if (const auto entry = plan.lookup(kEntryPoint); entry && entry->metadata.type == FileType::REGULAR) {
+            return kEntryPoint;
+        }
+        return std::nullopt;
+    }
+
+    std::size_t WasmStrategy::prewarm(const Plan& plan, const std::size_t count) const {
+        const auto entry = plan.lookup(kEntryPoint);
+        if (!entry) {
+            return 0;
+        }
+        return m_pool->prewarm(entry->digest, entry->metadata.size, count);
+    }
+
+    SandboxPool& WasmStrategy::getSandboxPool() const {
+        return *m_pool;
+    }
+
+
+    // --- Implémentation de ScriptStrategy ---
+
+    ExecutionResult ScriptStrategy::execute(VirtualFileSystem& filesystem, ExecutionContext& context) const {
+        const auto& plan = *filesystem.getPlan();
+        std::cout << "--- [ScriptStrategy] Début de l'exécution du Plan: " << plan.getId() << " ---" << std::endl;
+        ExecutionResult result;
+        const auto script = entryPoint(plan);
+        if (!script) {
+            std::cerr << "[ScriptStrategy] ERREUR: Aucun script d'entrée dans le Plan." << std::endl;
+            result.exit_code = 1;
+            result.output = "no script entry point found";
+            return result;
+        }
+        const auto entry = filesystem.stat(*script);
+        const auto interpreter = std::find_if(std::begin(kEntryPoints), std::end(kEntryPoints),
+                                              [&](const auto& known) { return *script == known.first; })->second;
+        std::cout << "[ScriptStrategy] Script '" << *script << "' interprété par " << interpreter << "." << std::endl;
+
+        // Un vrai interpréteur lirait le script et ses entrées à travers `filesystem`, y écrirait
+        // ses sorties, et vérifierait le contexte entre deux instructions ; ici, une seule étape
+        // simulée.
+        if (context.checkpoint() || !context.consumeFuel(kFuelPerStep) || context.checkpoint()) {
+            std::cerr << "[ScriptStrategy] Exécution interrompue." << std::endl;
+            return context.interrupted();
+        }
+        result.output = "executed " + *script + " with " + interpreter + " (" + entry->digest.str() + ")";
+        std::cout << "--- [ScriptStrategy] Fin de l'exécution du Plan: " << plan.getId() << " ---" << std::endl;
+        return result;
+    }
+
+    std::string ScriptStrategy::id() const {
+        return "script";
+    }
+
+    std::optional<std::string> ScriptStrategy::entryPoint(const Plan& plan) const {
+        for (const auto& [path, interpreter] : kEntryPoints) {
+            if (const auto entry = plan.lookup(path); entry && entry->metadata.type == FileType::REGULAR) {
+                return path;
+            }
+        }
+        return std::nullopt;
+    }
+
+
+    // --- Implémentation de StrategyRegistry ---
+
+    bool StrategyRegistry::add(std::shared_ptr<const IExecutionStrategy> strategy) {
+        if (!strategy || find(strategy->id())) {
+            return false;
+        }
+        m_strategies.push_back(std::move(strategy));
+        return true;
+    }
+
+    bool StrategyRegistry::remove(const std::string& id) {
+        return std::erase_if(m_strategies, [&](const auto& strategy) { return strategy->id() == id; }) > 0;
+    }
+
+    std::shared_ptr<const IExecutionStrategy> StrategyRegistry::find(const std::string& id) const {
+        const auto it = std::find_if(m_strategies.begin(), m_strategies.end(),
+                                     [&](const auto& strategy) { return strategy->id() == id; });
+        return it == m_strategies.end() ? nullptr : *it;
+    }
+
+    std::shared_ptr<const IExecutionStrategy> StrategyRegistry::select(const Plan& plan) const {
+        // Chaque test est une recherche ponctuelle du point d'entrée : le Plan n'est pas matérialisé.
+        for (const auto& strategy : m_strategies) {
+            if (strategy->entryPoint(plan)) {
+                return strategy;
+            }
+        }
+        return nullptr;
+    }
+
+    std::size_t StrategyRegistry::size() const {
+        return m_strategies.size();
+    }
+
+    bool StrategyRegistry::empty() const {
+        return m_strategies.empty();
     }
 
 
     // --- Implémentation de ExecutionEngine ---
 
+    ExecutionEngine::ExecutionEngine()
+        : ExecutionEngine(std::max(1u, std::thread::hardware_concurrency())) {
+    }
+
+    ExecutionEngine::ExecutionEngine(const std::size_t workers)
+        : ExecutionEngine(SchedulerOptions{.workers = workers}) {
+    }
+
+    ExecutionEngine::ExecutionEngine(SchedulerOptions options)
+        : m_scheduler_options(std::move(options)) {
+    }
+
     void ExecutionEngine::setStrategy(std::unique_ptr<IExecutionStrategy> strategy) {
-        m_strategy = std::move(strategy);
+        std::shared_ptr<const IExecutionStrategy> replaced;
+        std::unique_lock lock(m_strategies_mutex);
+        // L'ancienne stratégie est libérée hors du verrou, si aucune exécution ne la garde.
+        replaced = std::exchange(m_strategy, std::move(strategy));
     }
 
-    void ExecutionEngine::run(const Plan& plan) const {
+    bool ExecutionEngine::registerStrategy(std::shared_ptr<const IExecutionStrategy> strategy) {
+        std::unique_lock lock(m_strategies_mutex);
+        return m_registry.add(std::move(strategy));
+    }
+
+    bool ExecutionEngine::unregisterStrategy(const std::string& id) {
+        std::unique_lock lock(m_strategies_mutex);
+        return m_registry.remove(id);
+    }
+
+    StrategyRegistry ExecutionEngine::getStrategyRegistry() const {
+        std::shared_lock lock(m_strategies_mutex);
+        return m_registry;
+    }
+
+    std::shared_ptr<const IExecutionStrategy> ExecutionEngine::selectStrategy(const Plan& plan) const {
+        std::shared_lock lock(m_strategies_mutex);
+        if (auto strategy = m_registry.select(plan)) {
+            return strategy;
+        }
         // On vérifie d'abord si une stratégie a été définie.
         if (!m_strategy) {
             throw std::runtime_error("ExecutionEngine: Aucune stratégie d'exécution n'a été définie.");
         }
-        // On délègue l'exécution à l'objet stratégie.
-        m_strategy->execute(plan);
+        return m_strategy;
+    }
+
+    void ExecutionEngine::enableResultCache(ResultCacheOptions options) {
+        m_result_cache.store(std::make_shared<ResultCache>(std::move(options)));
+    }
+
+    void ExecutionEngine::disableResultCache() {
+        m_result_cache.store(nullptr);
+    }
+
+    std::shared_ptr<ResultCache> ExecutionEngine::getResultCache() const {
+        return m_result_cache.load();
+    }
+
+    Scheduler& ExecutionEngine::getScheduler() const {
+        std::call_once(m_scheduler_created, [this] { m_scheduler = std::make_unique<Scheduler>(m_scheduler_options); });
+        return *m_scheduler;
+    }
+
+    ExecutionResult ExecutionEngine::run(const Plan& plan, const ExecutionLimits& limits, std::stop_token stop_token) const {
+        const auto strategy = selectStrategy(plan);
+        // Le cache courant est gardé en vie jusqu'à la fin de l'exécution, même s'il est désactivé entre-temps.
+        const auto cache = m_result_cache.load();
+        ExecutionContext context(limits, std::move(stop_token));
+        // Le Plan est emprunté le temps de l'exécution : un pointeur sans propriétaire suffit.
+        return execute(*strategy, cache.get(), std::shared_ptr<const Plan>(std::shared_ptr<const Plan>(), &plan),
+                       context);
+    }
+
+    std::future<ExecutionResult> ExecutionEngine::submit(std::shared_ptr<const Plan> plan, ExecutionLimits limits,
+                                                         std::stop_token stop_token, ScheduleOptions schedule) const {
+        auto job = prepare(std::move(plan), std::move(limits), std::move(stop_token));
+        // std::function exige une tâche copiable : la promesse est partagée.
+        auto promise = std::make_shared<std::promise<ExecutionResult>>();
+        auto future = promise->get_future();
+        const bool admitted = getScheduler().schedule(schedule, [promise, job] {
+            try {
+                promise->set_value(job());
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        if (!admitted) {
+            promise->set_value(ExecutionResult{-1, "rejected by admission control", ExecutionStatus::REJECTED, nullptr});
+        }
+        return future;
+    }
+
+    AsyncOperation<ExecutionResult> ExecutionEngine::runAsync(std::shared_ptr<const Plan> plan, ExecutionLimits limits,
+                                                              std::stop_token stop_token, ScheduleOptions schedule) const {
+        return {getScheduler(), std::move(schedule), prepare(std::move(plan), std::move(limits), std::move(stop_token)),
+                [] { return ExecutionResult{-1, "rejected by admission control", ExecutionStatus::REJECTED, nullptr}; }};
+    }
+
+    std::function<ExecutionResult()> ExecutionEngine::prepare(std::shared_ptr<const Plan> plan, ExecutionLimits limits,
+                                                              std::stop_token stop_token) const {
+        // La stratégie est choisie à la soumission : un lot mixte répartit ses Plans entre stratégies.
+        auto strategy = selectStrategy(*plan);
+        // La tâche garde en vie le Plan, la stratégie et le cache courants, pas le moteur.
+        return [strategy = std::move(strategy), cache = m_result_cache.load(), plan = std::move(plan), limits = std::move(limits),
+                stop_token = std::move(stop_token)] {
+            // Le contexte est créé sur le thread qui exécute, pour y mesurer le temps CPU.
+            ExecutionContext context(limits, stop_token);
+            return execute(*strategy, cache.get(), plan, context);
+        };
+    }
+
+    ExecutionResult ExecutionEngine::execute(const IExecutionStrategy& strategy, ResultCache* cache,
+                                             std::shared_ptr<const Plan> plan, ExecutionContext& context) {
+        // Une exécution annulée ou dont l'échéance est passée (ex: en file d'attente) n'est pas lancée.
+        if (context.checkpoint()) {
+            return context.interrupted();
+        }
+        // Sans cache, ou pour une stratégie non mémoïsable, on délègue directement.
+        const auto key = cache ? strategy.cacheKey(*plan) : std::nullopt;
+        // Un Plan équivalent a déjà été exécuté : on renvoie son résultat sans ré-exécuter.
+        if (key) {
+            if (auto cached = cache->find(*key)) {
+                return *std::move(cached);
+            }
+        }
+        // Chaque exécution a sa propre vue : ses écritures ne sont visibles que d'elle.
+        VirtualFileSystem filesystem(plan);
+        auto result = strategy.execute(filesystem, context);
+        if (!result.layer && result.completed() && filesystem.isDirty()) {
+            result.layer = filesystem.commit(plan->getId() + "-output");
+        }
+        // Un résultat interrompu dépend des limites de cette exécution : il n'est pas mémorisé.
+        if (key && result.completed()) {
+            cache->store(*key, result);
+        }
+        return result;
     }
 
 }
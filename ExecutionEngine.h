@@ -1,8 +1,24 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+#include <stop_token>
 #include <string>
+#include <utility>
+#include <vector>
+#include "Async.h"
+#include "ExecutionContext.h"
+#include "ExecutionResult.h"
 #include "Plan.h" // On a besoin de connaître la classe Plan
+#include "ResultCache.h"
+#include "SandboxPool.h"
+#include "Scheduler.h"
+#include "VirtualFileSystem.h"
 
 namespace Dualys {
     /**
@@ -11,6 +27,9 @@ namespace Dualys {
      *
      * C'est le contrat que chaque "méthode d'exécution" (WASM, JIT, etc.)
      * doit respecter. Elle définit une seule action : exécuter un Plan.
+     *
+     * Une stratégie est sans état propre à une exécution : une même instance est partagée par
+     * toutes les exécutions du moteur, et execute() peut être appelée en parallèle.
      */
     class IExecutionStrategy {
     public:
@@ -18,9 +37,45 @@ namespace Dualys {
 
         /**
          * @brief Méthode virtuelle pure pour exécuter un Plan.
-         * @param plan Le Plan à exécuter (passé par référence constante).
+         *
+         * La stratégie lit l'état du Plan à travers `filesystem`, un chemin à la fois, sans jamais
+         * le matérialiser, et y écrit les fichiers que l'exécution produit : le moteur en fait la
+         * couche du résultat (ExecutionResult::layer) si l'exécution se termine sans en fournir.
+         * Le Plan lui-même reste accessible par filesystem.getPlan().
+         *
+         * La stratégie fait respecter les limites du contexte : elle appelle context.checkpoint()
+         * entre deux unités de travail, décompte son travail (context.consumeFuel()) et sa mémoire
+         * (context.reserveMemory()), et renvoie context.interrupted() dès qu'une limite est atteinte.
+         *
+         * @param filesystem La vue copie-sur-écriture du Plan, propre à cette exécution.
+         * @param context L'annulation, l'échéance et les budgets de l'exécution.
+         * @return Le résultat de l'exécution.
+         */
+        virtual ExecutionResult execute(VirtualFileSystem &filesystem, ExecutionContext &context) const = 0;
+
+        /**
+         * @brief Identifiant stable de la stratégie (ex: "wasm"), utilisé dans les clés de cache.
+         */
+        virtual std::string id() const = 0;
+
+        /**
+         * @brief Renvoie le chemin du point d'entrée que cette stratégie exécuterait dans `plan`.
+         *
+         * Sert à choisir la stratégie d'un Plan (voir StrategyRegistry) : std::nullopt signifie
+         * que le Plan ne contient rien que cette stratégie sache exécuter. Par défaut, std::nullopt :
+         * la stratégie n'est jamais choisie d'après le Plan, seulement comme stratégie par défaut.
          */
-        virtual void execute(const Plan &plan) const = 0;
+        virtual std::optional<std::string> entryPoint(const Plan &plan) const;
+
+        /**
+         * @brief Clé identifiant tout ce dont dépend le résultat de l'exécution de `plan`.
+         *
+         * Par défaut : l'identifiant de la stratégie et le digest de l'état du Plan, ce qui suppose
+         * une exécution déterministe. Une stratégie qui ne lit qu'une partie de l'état (ex: le hash
+         * du point d'entrée et ses entrées) peut restreindre la clé ; une stratégie non déterministe
+         * renvoie std::nullopt pour ne jamais être mise en cache.
+         */
+        virtual std::optional<std::string> cacheKey(const Plan &plan) const;
     };
 
     /**
@@ -29,10 +84,73 @@ namespace Dualys {
      *
      * Cette classe sait comment prendre un Plan qui contient du code WASM
      * et le faire tourner dans un runtime sécurisé.
+     *
+     * Les sandboxes sont empruntés à un pool, indexé par le hash du module : un module déjà
+     * exécuté (ou préchauffé) démarre à chaud, sur une instance réinitialisée plutôt que recréée.
      */
     class WasmStrategy : public IExecutionStrategy {
     public:
-        void execute(const Plan &plan) const override;
+        /**
+         * @brief Coût en carburant de chaque étape de l'exécution simulée.
+         */
+        static constexpr std::uint64_t kFuelPerStep = 1;
+
+        /**
+         * @brief Chemin du module exécuté dans le Plan.
+         */
+        static constexpr const char *kEntryPoint = "/main.wasm";
+
+        /**
+         * @brief Crée une stratégie dont les sandboxes viennent de `pool` (un pool neuf par défaut).
+         */
+        explicit WasmStrategy(std::shared_ptr<SandboxPool> pool = std::make_shared<SandboxPool>());
+
+        ExecutionResult execute(VirtualFileSystem &filesystem, ExecutionContext &context) const override;
+
+        std::string id() const override;
+
+        std::optional<std::string> entryPoint(const Plan &plan) const override;
+
+        /**
+         * @brief Instancie à l'avance `count` sandboxes du point d'entrée de `plan`, pour que ses
+         *        prochaines exécutions démarrent à chaud (ex: Plans les plus sollicités au démarrage).
+         * @return Le nombre de sandboxes créés ; 0 si le Plan n'a pas de point d'entrée.
+         */
+        std::size_t prewarm(const Plan &plan, std::size_t count = 1) const;
+
+        SandboxPool &getSandboxPool() const;
+
+    private:
+        std::shared_ptr<SandboxPool> m_pool;
+    };
+
+    /**
+     * @class ScriptStrategy
+     * @brief Une stratégie qui exécute un script du Plan avec l'interpréteur de son extension.
+     *
+     * Le point d'entrée est le premier de kEntryPoints présent dans le Plan.
+     */
+    class ScriptStrategy : public IExecutionStrategy {
+    public:
+        /**
+         * @brief Coût en carburant de chaque étape de l'exécution simulée.
+         */
+        static constexpr std::uint64_t kFuelPerStep = 1;
+
+        /**
+         * @brief Points d'entrée reconnus, par ordre de préférence, et leur interpréteur.
+         */
+        static constexpr std::pair<const char *, const char *> kEntryPoints[] = {
+            {"/main.sh", "sh"},
+            {"/main.py", "python3"},
+            {"/main.js", "node"},
+        };
+
+        ExecutionResult execute(VirtualFileSystem &filesystem, ExecutionContext &context) const override;
+
+        std::string id() const override;
+
+        std::optional<std::string> entryPoint(const Plan &plan) const override;
     };
 
     // On pourrait ajouter d'autres stratégies ici à l'avenir :
@@ -40,31 +158,211 @@ namespace Dualys {
     // class JitSourceStrategy : public IExecutionStrategy { ... };
 
 
+    /**
+     * @class StrategyRegistry
+     * @brief Les stratégies connues d'un moteur, et le choix de celle qui exécute un Plan.
+     *
+     * Les stratégies sont partagées : un même moteur garde toutes ses stratégies (et leurs pools
+     * de sandboxes) chaudes, et exécute un lot mixte de Plans en parallèle.
+     */
+    class StrategyRegistry {
+    public:
+        /**
+         * @brief Enregistre `strategy`, consultée après celles déjà enregistrées.
+         * @return false si une stratégie de même identifiant est déjà enregistrée.
+         */
+        bool add(std::shared_ptr<const IExecutionStrategy> strategy);
+
+        /**
+         * @brief Retire la stratégie d'identifiant `id`.
+         * @return false si elle n'est pas enregistrée.
+         */
+        bool remove(const std::string &id);
+
+        /**
+         * @brief Renvoie la stratégie d'identifiant `id`, ou nullptr.
+         */
+        std::shared_ptr<const IExecutionStrategy> find(const std::string &id) const;
+
+        /**
+         * @brief Renvoie la première stratégie, dans l'ordre d'enregistrement, qui trouve un point
+         *        d'entrée dans `plan`, ou nullptr.
+         */
+        std::shared_ptr<const IExecutionStrategy> select(const Plan &plan) const;
+
+        std::size_t size() const;
+
+        bool empty() const;
+
+    private:
+        std::vector<std::shared_ptr<const IExecutionStrategy> > m_strategies;
+    };
+
+
     /**
      * @class ExecutionEngine
      * @brief Le moteur principal qui orchestre l'exécution d'un Plan.
      *
      * Il ne sait pas *comment* exécuter un Plan, mais il sait *qui* appeler
      * pour le faire (la stratégie courante).
+     *
+     * Les stratégies peuvent être définies, enregistrées et retirées pendant que d'autres threads
+     * exécutent des Plans : chaque exécution choisit sa stratégie sous un verrou partagé, puis la
+     * garde en vie jusqu'à sa fin.
      */
     class ExecutionEngine {
     private:
-        // Un pointeur unique vers la stratégie d'exécution actuellement sélectionnée.
-        std::unique_ptr<IExecutionStrategy> m_strategy;
+        // La stratégie par défaut, utilisée quand aucune stratégie enregistrée ne reconnaît le
+        // Plan. Elle est partagée avec les exécutions asynchrones en cours, qui la gardent en vie
+        // si elle est remplacée.
+        std::shared_ptr<const IExecutionStrategy> m_strategy;
+
+        // Les stratégies choisies selon le point d'entrée du Plan.
+        StrategyRegistry m_registry;
+
+        // Protège m_strategy et m_registry : les exécutions les lisent (selectStrategy()) pendant
+        // que d'autres threads enregistrent ou retirent des stratégies.
+        mutable std::shared_mutex m_strategies_mutex;
+
+        // Le cache optionnel des résultats, nul tant que enableResultCache() n'a pas été appelé.
+        // Atomique : les exécutions en prennent une copie pendant que d'autres threads le
+        // remplacent ; chacune garde ainsi en vie le cache qu'elle utilise.
+        std::atomic<std::shared_ptr<ResultCache> > m_result_cache;
+
+        // La capacité et les limites d'admission de l'ordonnanceur utilisé par submit().
+        SchedulerOptions m_scheduler_options;
+
+        // L'ordonnanceur, créé à la première utilisation. Déclaré en dernier : il est détruit en
+        // premier, après avoir terminé les exécutions admises.
+        mutable std::once_flag m_scheduler_created;
+        mutable std::unique_ptr<Scheduler> m_scheduler;
+
+        static ExecutionResult execute(const IExecutionStrategy &strategy, ResultCache *cache,
+                                       std::shared_ptr<const Plan> plan, ExecutionContext &context);
+
+        // Prépare l'exécution différée de `plan` : la stratégie est choisie maintenant, le reste
+        // s'exécute sur le thread qui appelle la fonction renvoyée.
+        std::function<ExecutionResult()> prepare(std::shared_ptr<const Plan> plan, ExecutionLimits limits,
+                                                 std::stop_token stop_token) const;
 
     public:
-        ExecutionEngine() = default;
+        /**
+         * @brief Crée un moteur dont l'ordonnanceur compte un thread par cœur.
+         */
+        ExecutionEngine();
+
+        /**
+         * @brief Crée un moteur dont l'ordonnanceur compte `workers` threads.
+         */
+        explicit ExecutionEngine(std::size_t workers);
+
+        /**
+         * @brief Crée un moteur dont l'ordonnanceur a la capacité et les limites d'admission données.
+         */
+        explicit ExecutionEngine(SchedulerOptions options);
 
         /**
-         * @brief Définit la stratégie d'exécution à utiliser.
+         * @brief Définit la stratégie d'exécution à utiliser par défaut.
          * @param strategy Un pointeur unique vers l'objet stratégie.
          */
         void setStrategy(std::unique_ptr<IExecutionStrategy> strategy);
 
         /**
-         * @brief Exécute un Plan en utilisant la stratégie actuellement définie.
+         * @brief Enregistre une stratégie, choisie pour les Plans dont elle reconnaît le point d'entrée.
+         * @return false si une stratégie de même identifiant est déjà enregistrée.
+         */
+        bool registerStrategy(std::shared_ptr<const IExecutionStrategy> strategy);
+
+        /**
+         * @brief Retire la stratégie enregistrée d'identifiant `id`. Les exécutions en cours la
+         *        gardent en vie jusqu'à leur fin.
+         * @return false si elle n'est pas enregistrée.
+         */
+        bool unregisterStrategy(const std::string &id);
+
+        /**
+         * @brief Renvoie une copie des stratégies enregistrées, cohérente même si d'autres threads
+         *        en enregistrent ou en retirent.
+         */
+        StrategyRegistry getStrategyRegistry() const;
+
+        /**
+         * @brief Renvoie la stratégie qui exécuterait `plan` : la première stratégie enregistrée
+         *        qui reconnaît son point d'entrée, sinon la stratégie par défaut.
+         * @throws std::runtime_error si aucune ne convient.
+         */
+        std::shared_ptr<const IExecutionStrategy> selectStrategy(const Plan &plan) const;
+
+        /**
+         * @brief Active la mémoïsation des résultats d'exécution.
+         *
+         * Les appels suivants à run() sur des Plans équivalents (même clé de cache pour la
+         * stratégie courante) renvoient le résultat mémorisé sans exécuter à nouveau.
+         *
+         * @param options Le budget mémoire, la durée de vie et le répertoire de débordement du cache.
+         */
+        void enableResultCache(ResultCacheOptions options = {});
+
+        /**
+         * @brief Désactive et vide le cache des résultats.
+         */
+        void disableResultCache();
+
+        /**
+         * @brief Renvoie le cache des résultats, ou nullptr s'il est désactivé.
+         *
+         * Le cache renvoyé reste valide après disableResultCache() ou enableResultCache().
+         */
+        std::shared_ptr<ResultCache> getResultCache() const;
+
+        /**
+         * @brief Renvoie l'ordonnanceur de submit(), pour régler les poids des locataires et lire
+         *        ses métriques (profondeur des files, temps d'attente).
+         */
+        Scheduler &getScheduler() const;
+
+        /**
+         * @brief Exécute un Plan avec la stratégie choisie par selectStrategy().
+         *
+         * Une exécution interrompue (annulation, échéance ou budget dépassé) renvoie un résultat
+         * dont le statut indique la cause ; elle n'est jamais mise en cache.
+         *
          * @param plan Le Plan à exécuter.
+         * @param limits L'échéance et les budgets CPU, mémoire et carburant de l'exécution.
+         * @param stop_token Le jeton d'annulation coopérative de l'exécution.
+         * @return Le résultat de l'exécution, éventuellement issu du cache.
+         */
+        ExecutionResult run(const Plan &plan, const ExecutionLimits &limits = {}, std::stop_token stop_token = {}) const;
+
+        /**
+         * @brief Exécute un Plan de manière asynchrone, via l'ordonnanceur du moteur.
+         *
+         * Les exécutions INTERACTIVE passent avant les autres et disposent de threads réservés ;
+         * au sein d'une classe, les locataires se partagent les threads selon leurs poids. Une
+         * exécution refusée par le contrôle d'admission (files pleines) se termine aussitôt avec
+         * le statut REJECTED.
+         *
+         * Le temps passé en file d'attente compte dans l'échéance : une exécution dont l'échéance
+         * est dépassée avant son démarrage n'est pas lancée. La stratégie et le cache en place lors
+         * de l'appel sont utilisés, même s'ils sont remplacés entre-temps.
+         *
+         * @param plan Le Plan à exécuter, gardé en vie jusqu'à la fin de l'exécution.
+         * @param limits L'échéance et les budgets de l'exécution.
+         * @param stop_token Le jeton d'annulation coopérative de l'exécution.
+         * @param schedule Le locataire, la classe de priorité et le coût estimé de l'exécution.
+         * @return Le futur résultat de l'exécution.
+         */
+        std::future<ExecutionResult> submit(std::shared_ptr<const Plan> plan, ExecutionLimits limits = {},
+                                            std::stop_token stop_token = {}, ScheduleOptions schedule = {}) const;
+
+        /**
+         * @brief Variante de submit() à attendre avec `co_await` depuis une coroutine.
+         *
+         * La coroutine est suspendue sans bloquer de thread, puis reprise sur le thread de
+         * l'ordonnanceur qui a terminé l'exécution. Mêmes règles d'ordonnancement et d'admission
+         * que submit().
          */
-        void run(const Plan &plan) const;
+        AsyncOperation<ExecutionResult> runAsync(std::shared_ptr<const Plan> plan, ExecutionLimits limits = {},
+                                                 std::stop_token stop_token = {}, ScheduleOptions schedule = {}) const;
     };
 }
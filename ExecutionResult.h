@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "Layer.h"
+
+namespace Dualys {
+    /**
+     * @enum ExecutionStatus
+     * @brief Tells whether a run went to completion or was interrupted, and why.
+     */
+    enum class ExecutionStatus {
+        COMPLETED,
+        CANCELLED,
+        DEADLINE_EXCEEDED,
+        CPU_LIMIT_EXCEEDED,
+        MEMORY_LIMIT_EXCEEDED,
+        FUEL_EXHAUSTED,
+        REJECTED
+    };
+
+    /**
+     * @struct ExecutionResult
+     * @brief Outcome of the execution of a plan by a strategy.
+     *
+     * Only the outcome is recorded, not the side effects of the run, so that a result can be
+     * cached and returned again for any plan with the same relevant inputs. Files produced by
+     * the run are part of the outcome: they are returned as a layer, for the caller to apply.
+     * Interrupted runs are never cached.
+     */
+    struct ExecutionResult {
+        int exit_code = 0;
+        std::string output;
+        ExecutionStatus status = ExecutionStatus::COMPLETED;
+
+        /**
+         * @brief Files written by the run, relative to the plan it ran against; nullptr if none.
+         */
+        std::shared_ptr<const Layer> layer;
+
+        bool completed() const {
+            return status == ExecutionStatus::COMPLETED;
+        }
+
+        bool succeeded() const {
+            return completed() && exit_code == 0;
+        }
+
+        bool operator==(const ExecutionResult &other) const {
+            const bool same_layer = layer == other.layer ||
+                                    (layer && other.layer && layer->id == other.layer->id &&
+                                     layer->changes == other.layer->changes);
+            return exit_code == other.exit_code && output == other.output && status == other.status && same_layer;
+        }
+    };
+}
@@ -0,0 +1,131 @@
+#include "FileEntry.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr char kHexDigits[] = "0123456789abcdef";
+
+    int hexValue(const char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        return -1;
+    }
+
+    bool isLowerHex(std::string_view value) {
+        return std::ranges::all_of(value, [](const char c) { return hexValue(c) >= 0; });
+    }
+
+    /**
+     * Hashes that do not fit in a ContentDigest, stored once for the lifetime of the process.
+     */
+    const std::string *intern(const std::string_view hash) {
+        static std::mutex mutex;
+        static std::unordered_set<std::string> hashes;
+        std::lock_guard lock(mutex);
+        return &*hashes.emplace(hash).first;
+    }
+}
+
+ContentDigest::ContentDigest(std::string_view hash) {
+    if (hash.size() <= kCapacity) {
+        std::ranges::copy(hash, m_bytes.begin());
+        m_size = static_cast<std::uint8_t>(hash.size());
+        return;
+    }
+    if (hash.size() > 2 * kCapacity || hash.size() % 2 != 0 || !isLowerHex(hash)) {
+        const auto *stored = intern(hash);
+        std::memcpy(m_bytes.data(), &stored, sizeof(stored));
+        m_encoding = Encoding::INTERNED;
+        return;
+    }
+    m_size = static_cast<std::uint8_t>(hash.size() / 2);
+    m_encoding = Encoding::HEX;
+    for (std::size_t i = 0; i < m_size; ++i) {
+        m_bytes[i] = static_cast<char>(hexValue(hash[2 * i]) << 4 | hexValue(hash[2 * i + 1]));
+    }
+}
+
+std::string ContentDigest::str() const {
+    if (m_encoding != Encoding::HEX) {
+        return std::string(bytes());
+    }
+    std::string hash;
+    hash.reserve(2 * m_size);
+    for (std::size_t i = 0; i < m_size; ++i) {
+        const auto byte = static_cast<unsigned char>(m_bytes[i]);
+        hash.push_back(kHexDigits[byte >> 4]);
+        hash.push_back(kHexDigits[byte & 0x0f]);
+    }
+    return hash;
+}
+
+std::string_view ContentDigest::bytes() const {
+    if (m_encoding == Encoding::INTERNED) {
+        return *interned();
+    }
+    return {m_bytes.data(), m_size};
+}
+
+bool ContentDigest::isHex() const {
+    return m_encoding == Encoding::HEX;
+}
+
+bool ContentDigest::isInterned() const {
+    return m_encoding == Encoding::INTERNED;
+}
+
+bool ContentDigest::empty() const {
+    return m_encoding != Encoding::INTERNED && m_size == 0;
+}
+
+void ContentDigest::writeTo(std::ostream &out) const {
+    writeValue(out, m_encoding);
+    writeString(out, bytes());
+}
+
+std::optional<ContentDigest> ContentDigest::readFrom(std::istream &in) {
+    Encoding encoding{};
+    std::string bytes;
+    if (!readValue(in, encoding) || !readString(in, bytes)) {
+        return std::nullopt;
+    }
+    switch (encoding) {
+        case Encoding::RAW:
+        case Encoding::HEX:
+            return fromBytes(bytes, encoding == Encoding::HEX);
+        case Encoding::INTERNED:
+            // Only hashes that cannot be stored in place are interned.
+            if (ContentDigest(bytes).m_encoding != Encoding::INTERNED) {
+                return std::nullopt;
+            }
+            return ContentDigest(bytes);
+    }
+    return std::nullopt;
+}
+
+std::optional<ContentDigest> ContentDigest::fromBytes(const std::string_view bytes, const bool hex) {
+    if (bytes.size() > kCapacity) {
+        return std::nullopt;
+    }
+    ContentDigest digest;
+    std::ranges::copy(bytes, digest.m_bytes.begin());
+    digest.m_size = static_cast<std::uint8_t>(bytes.size());
+    digest.m_encoding = hex ? Encoding::HEX : Encoding::RAW;
+    return digest;
+}
+
+const std::string *ContentDigest::interned() const {
+    const std::string *stored = nullptr;
+    std::memcpy(&stored, m_bytes.data(), sizeof(stored));
+    return stored;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include "Layer.h"
+
+namespace Dualys {
+    /**
+     * @class ContentDigest
+     * @brief Fixed-size, allocation-free storage for a content hash.
+     *
+     * Content hashes are opaque strings. Up to 32 bytes are stored verbatim; longer
+     * lowercase hexadecimal strings of up to 64 characters (e.g. a SHA-256 hex digest)
+     * are stored decoded and re-encoded on demand. Any other hash (e.g. "sha256:<hex>")
+     * is interned once, process-wide, and referenced: equal hashes still compare equal.
+     */
+    class ContentDigest {
+    public:
+        static constexpr std::size_t kCapacity = 32;
+
+        ContentDigest() = default;
+
+        /**
+         * @brief Stores `hash`.
+         */
+        explicit ContentDigest(std::string_view hash);
+
+        /**
+         * @brief Returns the hash in the form it was provided.
+         */
+        std::string str() const;
+
+        /**
+         * @brief Returns the stored bytes: decoded when the hash was hexadecimal, the whole hash
+         *        when it is interned.
+         */
+        std::string_view bytes() const;
+
+        /**
+         * @brief Tells whether bytes() are the decoded form of a hexadecimal hash.
+         */
+        bool isHex() const;
+
+        /**
+         * @brief Tells whether the hash is too long to be stored in place, and interned.
+         */
+        bool isInterned() const;
+
+        bool empty() const;
+
+        /**
+         * @brief Writes the hash in a form independent of the process (interned hashes by value).
+         */
+        void writeTo(std::ostream &out) const;
+
+        /**
+         * @brief Reads a hash written by writeTo().
+         * @return std::nullopt if the stream is truncated or the encoding is invalid.
+         */
+        static std::optional<ContentDigest> readFrom(std::istream &in);
+
+        /**
+         * @brief Rebuilds a digest from the result of bytes() and isHex() of an inline digest.
+         * @return std::nullopt if `bytes` exceeds kCapacity.
+         */
+        static std::optional<ContentDigest> fromBytes(std::string_view bytes, bool hex);
+
+        bool operator==(const ContentDigest &) const = default;
+
+        std::strong_ordering operator<=>(const ContentDigest &) const = default;
+
+    private:
+        enum class Encoding : std::uint8_t {
+            RAW,
+            HEX,
+            INTERNED ///< `m_bytes` holds a pointer to the interned string, unique per hash.
+        };
+
+        std::array<char, kCapacity> m_bytes{};
+        std::uint8_t m_size = 0;
+        Encoding m_encoding = Encoding::RAW;
+
+        const std::string *interned() const;
+    };
+
+    /**
+     * @struct FileEntry
+     * @brief Value of a path in a materialized filesystem state.
+     *
+     * Packs the metadata and the content digest in a single cache line, with no
+     * heap allocation per entry.
+     */
+    struct FileEntry {
+        FileMetadata metadata;
+        ContentDigest digest;
+
+        bool operator==(const FileEntry &) const = default;
+    };
+
+    static_assert(sizeof(FileEntry) == 64, "FileEntry must fit in a single cache line");
+}
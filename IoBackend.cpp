@@ -0,0 +1,425 @@
+#include "IoBackend.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <stop_token>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace Dualys;
+
+
+namespace {
+    /**
+     * Opens `path` and sizes a buffer for it; the file descriptor is returned in `fd`.
+     */
+    std::optional<std::string> openForRead(const std::filesystem::path &path, int &fd) {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+        struct stat status{};
+        if (fstat(fd, &status) != 0) {
+            close(fd);
+            fd = -1;
+            return std::nullopt;
+        }
+        return std::string(static_cast<std::size_t>(std::max<off_t>(status.st_size, 0)), '\0');
+    }
+
+    template<typename T>
+    T *at(void *base, const std::uint32_t offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+}
+
+std::optional<std::string> Dualys::readFile(const std::filesystem::path &path) {
+    int fd = -1;
+    auto content = openForRead(path, fd);
+    if (!content) {
+        return std::nullopt;
+    }
+    std::size_t offset = 0;
+    while (true) {
+        if (offset == content->size()) {
+            // The size is only a hint: keep reading until EOF in case the file grew.
+            content->resize(std::max<std::size_t>(2 * content->size(), 4096));
+        }
+        const auto count = pread(fd, content->data() + offset, content->size() - offset, static_cast<off_t>(offset));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            close(fd);
+            return std::nullopt;
+        }
+        if (count == 0) {
+            break;
+        }
+        offset += static_cast<std::size_t>(count);
+    }
+    close(fd);
+    content->resize(offset);
+    return content;
+}
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::filesystem::path &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat status{};
+    if (fstat(fd, &status) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    const auto size = static_cast<std::size_t>(std::max<off_t>(status.st_size, 0));
+    void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+    // The mapping keeps the file alive on its own.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::shared_ptr<const MappedFile>(new MappedFile(static_cast<const char *>(data), size));
+}
+
+MappedFile::MappedFile(const char *data, const std::size_t size) : m_data(data), m_size(size) {
+}
+
+MappedFile::~MappedFile() {
+    if (m_data) {
+        munmap(const_cast<char *>(m_data), m_size);
+    }
+}
+
+std::span<const char> MappedFile::bytes() const {
+    return {m_data, m_size};
+}
+
+std::unique_ptr<IoBackend> IoBackend::create(const IoOptions options) {
+    if (options.backend != IoOptions::Backend::PREAD) {
+        if (auto uring = UringIoBackend::create(options.queue_depth)) {
+            return uring;
+        }
+        if (options.backend == IoOptions::Backend::IO_URING) {
+            return nullptr;
+        }
+    }
+    return std::make_unique<PreadIoBackend>(options.queue_depth);
+}
+
+/**
+ * Workers shared by the batches of a backend, started on the first batch of several files.
+ */
+struct PreadIoBackend::Workers {
+    /**
+     * Files of one readFiles() call, claimed one at a time by the workers and the caller.
+     */
+    struct Batch {
+        const std::vector<std::filesystem::path> *paths;
+        std::vector<std::optional<std::string> > *contents;
+
+        // Kept by value: a worker may look at a batch after its caller returned, never at its files.
+        std::size_t size;
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> remaining;
+
+        Batch(const std::vector<std::filesystem::path> &batch_paths,
+              std::vector<std::optional<std::string> > &batch_contents)
+            : paths(&batch_paths), contents(&batch_contents), size(batch_paths.size()), remaining(size) {
+        }
+
+        void work() {
+            for (auto i = next++; i < size; i = next++) {
+                (*contents)[i] = readFile((*paths)[i]);
+                if (--remaining == 0) {
+                    remaining.notify_all();
+                }
+            }
+        }
+    };
+
+    std::once_flag started;
+    std::mutex mutex;
+    std::condition_variable_any ready;
+    std::deque<std::shared_ptr<Batch> > batches;
+
+    // Last: joined before the queue they wait on is destroyed.
+    std::vector<std::jthread> threads;
+
+    void run(const std::stop_token &stop_token) {
+        while (true) {
+            std::shared_ptr<Batch> batch;
+            {
+                std::unique_lock lock(mutex);
+                if (!ready.wait(lock, stop_token, [this] { return !batches.empty(); })) {
+                    return;
+                }
+                batch = batches.front();
+                if (batch->next.load() >= batch->size) {
+                    // Every file is claimed: the batch needs no more workers.
+                    batches.pop_front();
+                    continue;
+                }
+            }
+            batch->work();
+        }
+    }
+};
+
+PreadIoBackend::PreadIoBackend(const unsigned queue_depth)
+    : m_queue_depth(std::max(queue_depth, 1u)), m_workers(std::make_unique<Workers>()) {
+}
+
+PreadIoBackend::~PreadIoBackend() = default;
+
+std::vector<std::optional<std::string> > PreadIoBackend::readFiles(const std::vector<std::filesystem::path> &paths) {
+    std::vector<std::optional<std::string> > contents(paths.size());
+    if (paths.size() == 1 || m_queue_depth == 1) {
+        std::ranges::transform(paths, contents.begin(), [](const auto &path) { return readFile(path); });
+        return contents;
+    }
+    std::call_once(m_workers->started, [this] {
+        // The caller reads too: queue_depth - 1 workers keep queue_depth reads in flight.
+        for (unsigned i = 1; i < m_queue_depth; ++i) {
+            m_workers->threads.emplace_back([this](const std::stop_token &stop_token) { m_workers->run(stop_token); });
+        }
+    });
+    const auto batch = std::make_shared<Workers::Batch>(paths, contents);
+    {
+        std::lock_guard lock(m_workers->mutex);
+        m_workers->batches.push_back(batch);
+    }
+    m_workers->ready.notify_all();
+    batch->work();
+    for (auto left = batch->remaining.load(); left != 0; left = batch->remaining.load()) {
+        batch->remaining.wait(left);
+    }
+    return contents;
+}
+
+const char *PreadIoBackend::name() const {
+    return "pread";
+}
+
+/**
+ * The three shared mappings of an io_uring, accessed with raw system calls (no liburing).
+ */
+struct UringIoBackend::Ring {
+    int fd = -1;
+    io_uring_params params{};
+    void *sq = MAP_FAILED;
+    std::size_t sq_size = 0;
+    void *cq = MAP_FAILED;
+    std::size_t cq_size = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    std::size_t sqes_size = 0;
+    std::mutex mutex;
+
+    // Set once io_uring_enter() fails: the ring is not used again.
+    bool broken = false;
+
+    // Buffers of reads that were in flight when the ring broke: the kernel may still fill them.
+    std::vector<std::vector<std::optional<std::string> > > abandoned;
+
+    // Serves the batches once the ring is broken.
+    std::unique_ptr<PreadIoBackend> fallback;
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq != MAP_FAILED && cq != sq) {
+            munmap(cq, cq_size);
+        }
+        if (sq != MAP_FAILED) {
+            munmap(sq, sq_size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    /**
+     * Queues a read of `length` bytes at `offset` of `file` into `buffer`; the caller never
+     * queues more than the ring holds.
+     */
+    void push(const int file, char *buffer, const std::size_t length, const std::size_t offset,
+              const std::uint64_t user_data) {
+        auto &tail = *at<unsigned>(sq, params.sq_off.tail);
+        const unsigned mask = *at<unsigned>(sq, params.sq_off.ring_mask);
+        const unsigned index = tail & mask;
+        io_uring_sqe &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<std::uint64_t>(buffer);
+        sqe.len = static_cast<std::uint32_t>(std::min<std::size_t>(length, 1u << 30));
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        at<unsigned>(sq, params.sq_off.array)[index] = index;
+        // Publishes the entry to the kernel.
+        std::atomic_ref(tail).store(tail + 1, std::memory_order_release);
+    }
+
+    /**
+     * Submits `count` queued entries and waits for at least `wait` completions.
+     */
+    bool enter(const unsigned count, const unsigned wait) const {
+        while (syscall(__NR_io_uring_enter, fd, count, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) < 0) {
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename F>
+    void reap(F &&handle) {
+        auto &head = *at<unsigned>(cq, params.cq_off.head);
+        const unsigned tail = std::atomic_ref(*at<unsigned>(cq, params.cq_off.tail)).load(std::memory_order_acquire);
+        const unsigned mask = *at<unsigned>(cq, params.cq_off.ring_mask);
+        const auto *cqes = at<io_uring_cqe>(cq, params.cq_off.cqes);
+        unsigned current = head;
+        for (; current != tail; ++current) {
+            handle(cqes[current & mask]);
+        }
+        std::atomic_ref(head).store(current, std::memory_order_release);
+    }
+};
+
+std::unique_ptr<UringIoBackend> UringIoBackend::create(const unsigned queue_depth) {
+    auto ring = std::make_unique<Ring>();
+    ring->fd = static_cast<int>(syscall(__NR_io_uring_setup, std::max(queue_depth, 1u), &ring->params));
+    if (ring->fd < 0) {
+        return nullptr;
+    }
+    const auto &params = ring->params;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+    }
+    ring->sq = mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                    IORING_OFF_SQ_RING);
+    if (ring->sq == MAP_FAILED) {
+        return nullptr;
+    }
+    ring->cq = single_mmap
+                   ? ring->sq
+                   : mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                          IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = static_cast<io_uring_sqe *>(mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+    if (ring->cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::unique_ptr<UringIoBackend>(new UringIoBackend(std::move(ring)));
+}
+
+UringIoBackend::UringIoBackend(std::unique_ptr<Ring> ring) : m_ring(std::move(ring)) {
+}
+
+UringIoBackend::~UringIoBackend() = default;
+
+std::vector<std::optional<std::string> > UringIoBackend::readFiles(const std::vector<std::filesystem::path> &paths) {
+    std::lock_guard lock(m_ring->mutex);
+    if (m_ring->broken) {
+        return m_ring->fallback->readFiles(paths);
+    }
+    std::vector<std::optional<std::string> > contents(paths.size());
+    std::vector<int> fds(paths.size(), -1);
+    std::vector<std::size_t> offsets(paths.size(), 0);
+    std::deque<std::size_t> pending;
+
+    // One read in flight per open file, and at most sq_entries open files: the completion ring,
+    // twice the submission ring, never overflows, and the batch never runs out of descriptors.
+    const unsigned capacity = m_ring->params.sq_entries;
+    std::size_t next = 0;
+    unsigned open_files = 0;
+    const auto finish = [&](const std::size_t i) {
+        close(fds[i]);
+        fds[i] = -1;
+        --open_files;
+    };
+    unsigned in_flight = 0;
+    bool failed = false;
+    while (!failed) {
+        while (next < paths.size() && open_files < capacity) {
+            const auto i = next++;
+            contents[i] = openForRead(paths[i], fds[i]);
+            if (contents[i] && contents[i]->empty()) {
+                // An empty (or special) file: read it the portable way, up to EOF.
+                close(fds[i]);
+                fds[i] = -1;
+                contents[i] = readFile(paths[i]);
+            } else if (contents[i]) {
+                ++open_files;
+                pending.push_back(i);
+            }
+        }
+        if (pending.empty() && in_flight == 0) {
+            break;
+        }
+        unsigned queued = 0;
+        while (!pending.empty() && in_flight + queued < capacity) {
+            const auto i = pending.front();
+            pending.pop_front();
+            auto &content = *contents[i];
+            m_ring->push(fds[i], content.data() + offsets[i], content.size() - offsets[i], offsets[i], i);
+            ++queued;
+        }
+        in_flight += queued;
+        if (!m_ring->enter(queued, 1)) {
+            failed = true;
+            break;
+        }
+        m_ring->reap([&](const io_uring_cqe &cqe) {
+            --in_flight;
+            const auto i = static_cast<std::size_t>(cqe.user_data);
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                pending.push_back(i);
+            } else if (cqe.res < 0) {
+                contents[i].reset();
+                finish(i);
+            } else if (cqe.res == 0) {
+                // The file shrank since it was sized.
+                contents[i]->resize(offsets[i]);
+                finish(i);
+            } else if ((offsets[i] += static_cast<std::size_t>(cqe.res)) < contents[i]->size()) {
+                pending.push_back(i);
+            } else {
+                finish(i);
+            }
+        });
+    }
+    if (failed) {
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        // In-flight reads may still target the buffers, short strings included: the ring keeps
+        // them where they are, and the batch is served by positioned reads.
+        m_ring->broken = true;
+        m_ring->abandoned.push_back(std::move(contents));
+        m_ring->fallback = std::make_unique<PreadIoBackend>(capacity);
+        return m_ring->fallback->readFiles(paths);
+    }
+    return contents;
+}
+
+const char *UringIoBackend::name() const {
+    return "io_uring";
+}
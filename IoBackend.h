@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Dualys {
+    /**
+     * @brief Reads a whole file with positioned reads.
+     * @return The content, or std::nullopt if the file cannot be opened or read.
+     */
+    std::optional<std::string> readFile(const std::filesystem::path &path);
+
+    /**
+     * @class MappedFile
+     * @brief Read-only, shared memory mapping of a whole file.
+     *
+     * Pages are read on first access and can be reclaimed by the kernel under memory pressure, so
+     * the resident memory follows the parts actually read. The file must not be truncated while
+     * mapped: replace it by renaming a new file over it instead.
+     */
+    class MappedFile {
+    public:
+        /**
+         * @return The mapping, or nullptr if the file cannot be opened or mapped.
+         */
+        static std::shared_ptr<const MappedFile> open(const std::filesystem::path &path);
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        std::span<const char> bytes() const;
+
+    private:
+        MappedFile(const char *data, std::size_t size);
+
+        const char *m_data;
+        std::size_t m_size;
+    };
+
+    /**
+     * @struct IoOptions
+     * @brief Choice and sizing of an IoBackend.
+     */
+    struct IoOptions {
+        enum class Backend {
+            /**
+             * io_uring when the kernel allows it, pread workers otherwise.
+             */
+            AUTO,
+            IO_URING,
+            PREAD
+        };
+
+        Backend backend = Backend::AUTO;
+
+        /**
+         * @brief Reads kept in flight at once: the ring size of io_uring, the workers of pread.
+         */
+        unsigned queue_depth = 64;
+    };
+
+    /**
+     * @class IoBackend
+     * @brief Reads batches of whole files, for the loaders of plans and blobs.
+     *
+     * Issuing a batch at once lets the device serve many reads concurrently instead of paying
+     * the latency of each small read in turn.
+     */
+    class IoBackend {
+    public:
+        virtual ~IoBackend() = default;
+
+        /**
+         * @brief Reads every file of `paths`.
+         * @return The contents, in the order of `paths`; std::nullopt for a file that cannot be read.
+         */
+        virtual std::vector<std::optional<std::string> > readFiles(const std::vector<std::filesystem::path> &paths) = 0;
+
+        /**
+         * @brief Returns "io_uring" or "pread".
+         */
+        virtual const char *name() const = 0;
+
+        /**
+         * @brief Creates the backend selected by `options`.
+         * @return nullptr if IO_URING is required and the kernel does not allow it.
+         */
+        static std::unique_ptr<IoBackend> create(IoOptions options = {});
+    };
+
+    /**
+     * @class PreadIoBackend
+     * @brief Portable backend: queue_depth workers, each reading whole files with pread().
+     *
+     * The caller and queue_depth - 1 workers, started on the first batch of several files and
+     * kept for the lifetime of the backend, share the files of each batch. Thread-safe: the
+     * batches of concurrent calls share the workers.
+     */
+    class PreadIoBackend : public IoBackend {
+    public:
+        explicit PreadIoBackend(unsigned queue_depth);
+
+        ~PreadIoBackend() override;
+
+        PreadIoBackend(const PreadIoBackend &) = delete;
+
+        PreadIoBackend &operator=(const PreadIoBackend &) = delete;
+
+        std::vector<std::optional<std::string> > readFiles(const std::vector<std::filesystem::path> &paths) override;
+
+        const char *name() const override;
+
+    private:
+        struct Workers;
+
+        unsigned m_queue_depth;
+        std::unique_ptr<Workers> m_workers;
+    };
+
+    /**
+     * @class UringIoBackend
+     * @brief Linux backend submitting the reads of a batch through an io_uring.
+     *
+     * Up to queue_depth files are open at once: each is opened and sized when a slot frees up,
+     * and closed as soon as it is read, so a batch of any size holds at most queue_depth file
+     * descriptors. One read per open file is kept in flight, with a single system call per round
+     * of submissions and completions. Short reads are resubmitted for the remainder. Batches are
+     * serialized: the ring is not shared between threads.
+     */
+    class UringIoBackend : public IoBackend {
+    public:
+        /**
+         * @brief Sets up a ring of `queue_depth` entries.
+         * @return nullptr if io_uring is not available (old kernel, seccomp, sysctl).
+         */
+        static std::unique_ptr<UringIoBackend> create(unsigned queue_depth);
+
+        ~UringIoBackend() override;
+
+        UringIoBackend(const UringIoBackend &) = delete;
+
+        UringIoBackend &operator=(const UringIoBackend &) = delete;
+
+        std::vector<std::optional<std::string> > readFiles(const std::vector<std::filesystem::path> &paths) override;
+
+        const char *name() const override;
+
+    private:
+        struct Ring;
+
+        explicit UringIoBackend(std::unique_ptr<Ring> ring);
+
+        std::unique_ptr<Ring> m_ring;
+    };
+}
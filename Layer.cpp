@@ -1 +1,9 @@
-#include "Layer.h"
\ No newline at end of file
+#include "Layer.h"
+#include <utility>
+
+using namespace Dualys;
+
+
+Layer::Layer(std::string id)
+    : id(std::move(id)) {
+}
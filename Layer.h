@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -15,14 +16,62 @@ namespace Dualys {
      * - MODIFIED: The file was modified.
      * - REMOVED: The file was removed from the system.
      * - PERMISSION_CHANGED: The file's permissions were changed.
+     * - DIRECTORY_REMOVED: The directory and everything below it were removed.
+     * - DIRECTORY_MOVED: The directory and everything below it were moved to a new location,
+     *   replacing whatever was there.
      */
     enum class ChangeType {
         ADDED,
         MODIFIED,
         REMOVED,
-        PERMISSION_CHANGED
+        PERMISSION_CHANGED,
+        DIRECTORY_REMOVED,
+        DIRECTORY_MOVED
     };
 
+    /**
+     *
+     * @enum FileType
+     *
+     * Represents the kind of filesystem entry a path refers to.
+     *
+     * Stored on a single byte so that it packs next to the other metadata fields.
+     */
+    enum class FileType : std::uint8_t {
+        REGULAR,
+        DIRECTORY,
+        SYMLINK
+    };
+
+    /**
+     *
+     * @struct FileMetadata
+     *
+     * Represents the metadata attached to a filesystem entry.
+     *
+     * Attributes:
+     * - size: The size of the content, in bytes.
+     * - mode: The permission bits (e.g. 0644), without the file type bits.
+     * - uid: The owning user identifier.
+     * - gid: The owning group identifier.
+     * - type: The kind of entry, represented as a value of the FileType enum.
+     *
+     * The layout is fixed-size and allocation-free (24 bytes), so that it can be stored
+     * inline next to each entry of a materialized state.
+     *
+     */
+    struct FileMetadata {
+        std::uint64_t size = 0;
+        std::uint32_t mode = 0644;
+        std::uint32_t uid = 0;
+        std::uint32_t gid = 0;
+        FileType type = FileType::REGULAR;
+
+        bool operator==(const FileMetadata &) const = default;
+    };
+
+    static_assert(sizeof(FileMetadata) == 24, "FileMetadata must stay packed");
+
     /**
      *
      * @struct FileChange
@@ -33,14 +82,28 @@ namespace Dualys {
      * - path: The path of the file that has changed.
      * - type: The type of change affecting the file, represented as a value of the ChangeType enum.
      * - new_content_hash: The hash has been replaced with new content, if applicable.
+     * - metadata: The metadata of the entry. ADDED uses all of it, MODIFIED only the size,
+     *   PERMISSION_CHANGED only the mode, uid and gid. REMOVED ignores it.
+     * - target_path: The destination of a DIRECTORY_MOVED change; unused otherwise.
      *
      */
     struct FileChange {
         std::string path;
         ChangeType type;
         std::string new_content_hash;
+        FileMetadata metadata{};
+        std::string target_path{};
+
+        bool operator==(const FileChange &) const = default;
     };
 
+    /**
+     * @brief Tells whether a change type affects a whole subtree rather than a single path.
+     */
+    inline bool isDirectoryChange(const ChangeType type) {
+        return type == ChangeType::DIRECTORY_REMOVED || type == ChangeType::DIRECTORY_MOVED;
+    }
+
     /**
      *
      * @class Layer
@@ -83,5 +146,16 @@ namespace Dualys {
          *
          */
         std::string id;
+
+        /**
+         *
+         * @var sorted
+         *
+         * Indicates that `changes` is sorted by path, the changes of a same path being
+         * consecutive and already folded, as produced by LayerBuilder::finish(). Consumers
+         * may then rely on binary search and ordered merges instead of hashing.
+         *
+         */
+        bool sorted = false;
     };
 }
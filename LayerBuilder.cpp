@@ -0,0 +1,236 @@
+#include "LayerBuilder.h"
+#include "PathUtils.h"
+#include <algorithm>
+#include <iterator>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+using namespace Dualys;
+
+
+namespace {
+    bool byPath(const FileChange &lhs, const FileChange &rhs) {
+        return lhs.path < rhs.path;
+    }
+
+    /**
+     * Stable sort by path. Above the threshold, chunks are sorted concurrently and then merged
+     * pairwise, each round of merges also running concurrently.
+     */
+    void sortByPath(std::vector<FileChange> &changes) {
+        const auto workers = static_cast<std::size_t>(std::max(1u, std::thread::hardware_concurrency()));
+        if (changes.size() < LayerBuilder::kParallelSortThreshold || workers == 1) {
+            std::ranges::stable_sort(changes, byPath);
+            return;
+        }
+
+        using Iterator = std::vector<FileChange>::iterator;
+        const auto chunk = (changes.size() + workers - 1) / workers;
+        std::vector<Iterator> bounds;
+        for (std::size_t offset = 0; offset < changes.size(); offset += chunk) {
+            bounds.push_back(changes.begin() + static_cast<std::ptrdiff_t>(offset));
+        }
+        bounds.push_back(changes.end());
+
+        {
+            std::vector<std::jthread> threads;
+            for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+                threads.emplace_back([first = bounds[i], last = bounds[i + 1]] {
+                    std::stable_sort(first, last, byPath);
+                });
+            }
+        }
+
+        while (bounds.size() > 2) {
+            std::vector<Iterator> merged{bounds.front()};
+            {
+                std::vector<std::jthread> threads;
+                for (std::size_t i = 0; i + 1 < bounds.size(); i += 2) {
+                    if (i + 2 < bounds.size()) {
+                        threads.emplace_back([first = bounds[i], middle = bounds[i + 1], last = bounds[i + 2]] {
+                            std::inplace_merge(first, middle, last, byPath);
+                        });
+                    }
+                    merged.push_back(bounds[std::min(i + 2, bounds.size() - 1)]);
+                }
+            }
+            bounds = std::move(merged);
+        }
+    }
+
+    /**
+     * Tries to fold `next` into `previous`, two successive changes of the same path.
+     * Returns false when both changes must be kept.
+     */
+    bool fold(FileChange &previous, FileChange &next) {
+        if (previous.type == ChangeType::DIRECTORY_REMOVED) {
+            return next.type == ChangeType::REMOVED || next.type == ChangeType::PERMISSION_CHANGED ||
+                   next.type == ChangeType::DIRECTORY_REMOVED;
+        }
+        switch (next.type) {
+            case ChangeType::ADDED:
+            case ChangeType::REMOVED:
+                // REMOVED then ADDED replaces an existing entry, ADDED then REMOVED drops a new one:
+                // neither pair has a single-change equivalent that passes strict validation.
+                if ((previous.type == ChangeType::REMOVED) != (next.type == ChangeType::REMOVED) &&
+                    (previous.type == ChangeType::ADDED || previous.type == ChangeType::REMOVED)) {
+                    return false;
+                }
+                previous = std::move(next);
+                return true;
+
+            case ChangeType::MODIFIED:
+                // Keeping the previous metadata matters for MODIFIED: on a missing path, the first
+                // MODIFIED creates the entry with its own metadata.
+                if (previous.type == ChangeType::ADDED || previous.type == ChangeType::MODIFIED) {
+                    previous.new_content_hash = std::move(next.new_content_hash);
+                    previous.metadata.size = next.metadata.size;
+                    return true;
+                }
+                if (previous.type == ChangeType::REMOVED) {
+                    // MODIFIED on a missing path creates the entry with the change's metadata.
+                    previous = std::move(next);
+                    previous.type = ChangeType::ADDED;
+                    return true;
+                }
+                return false;
+
+            case ChangeType::PERMISSION_CHANGED:
+                if (previous.type == ChangeType::ADDED) {
+                    previous.metadata.mode = next.metadata.mode;
+                    previous.metadata.uid = next.metadata.uid;
+                    previous.metadata.gid = next.metadata.gid;
+                    return true;
+                }
+                if (previous.type == ChangeType::REMOVED) {
+                    return true;
+                }
+                if (previous.type == ChangeType::PERMISSION_CHANGED) {
+                    previous = std::move(next);
+                    return true;
+                }
+                return false;
+
+            case ChangeType::DIRECTORY_REMOVED:
+            case ChangeType::DIRECTORY_MOVED:
+                return false;
+        }
+        return false;
+    }
+
+    /**
+     * Tells whether one of the strict ancestors of `path` is in `removed_directories`.
+     * `path` must be normalized.
+     *
+     * Changes of the removed directory itself are kept: the stable sort preserves their order
+     * relative to the removal, and dropping them could turn a valid layer into an invalid one
+     * (e.g. the ADDED of a directory removed later in the same layer).
+     */
+    bool isSuperseded(const std::unordered_set<std::string_view> &removed_directories, std::string_view path) {
+        if (removed_directories.empty()) {
+            return false;
+        }
+        for (auto ancestor = path; ancestor.size() > 1;) {
+            const auto slash = ancestor.rfind('/');
+            ancestor = ancestor.substr(0, slash == 0 ? 1 : slash);
+            if (removed_directories.contains(ancestor)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Normalizes a run of changes containing no DIRECTORY_MOVED and appends the result to `out`.
+     */
+    void normalizeRun(std::vector<FileChange>::iterator first, std::vector<FileChange>::iterator last,
+                      std::vector<FileChange> &out) {
+        // Walk backwards to find the changes of descendants superseded by a later recursive removal.
+        std::vector<bool> superseded(static_cast<std::size_t>(last - first));
+        std::unordered_set<std::string_view> removed_directories;
+        for (auto it = last; it != first;) {
+            --it;
+            if (isSuperseded(removed_directories, it->path)) {
+                superseded[static_cast<std::size_t>(it - first)] = true;
+            } else if (it->type == ChangeType::DIRECTORY_REMOVED) {
+                removed_directories.insert(it->path);
+            }
+        }
+
+        std::vector<FileChange> kept;
+        kept.reserve(superseded.size());
+        for (auto it = first; it != last; ++it) {
+            if (!superseded[static_cast<std::size_t>(it - first)]) {
+                kept.push_back(std::move(*it));
+            }
+        }
+        sortByPath(kept);
+
+        const auto run_begin = out.size();
+        for (auto &change: kept) {
+            if (out.size() > run_begin && out.back().path == change.path && fold(out.back(), change)) {
+                continue;
+            }
+            out.push_back(std::move(change));
+        }
+    }
+}
+
+LayerBuilder::LayerBuilder(std::string id)
+    : m_id(std::move(id)) {
+}
+
+void LayerBuilder::reserve(const std::size_t changes) {
+    m_changes.reserve(m_changes.size() + changes);
+}
+
+void LayerBuilder::append(FileChange change) {
+    m_changes.push_back(std::move(change));
+}
+
+void LayerBuilder::append(std::span<const FileChange> changes) {
+    m_changes.insert(m_changes.end(), changes.begin(), changes.end());
+}
+
+void LayerBuilder::append(std::vector<FileChange> &&changes) {
+    if (m_changes.empty()) {
+        m_changes = std::move(changes);
+        return;
+    }
+    m_changes.insert(m_changes.end(), std::make_move_iterator(changes.begin()), std::make_move_iterator(changes.end()));
+}
+
+std::size_t LayerBuilder::size() const {
+    return m_changes.size();
+}
+
+std::shared_ptr<const Layer> LayerBuilder::finish() {
+    auto changes = std::exchange(m_changes, {});
+    for (auto &change: changes) {
+        change.path = normalizePath(change.path);
+        if (change.type == ChangeType::DIRECTORY_MOVED) {
+            change.target_path = normalizePath(change.target_path);
+        }
+    }
+
+    auto layer = std::make_shared<Layer>(m_id);
+    layer->changes.reserve(changes.size());
+    bool has_moves = false;
+    auto run_begin = changes.begin();
+    while (true) {
+        const auto move = std::find_if(run_begin, changes.end(), [](const FileChange &change) {
+            return change.type == ChangeType::DIRECTORY_MOVED;
+        });
+        normalizeRun(run_begin, move, layer->changes);
+        if (move == changes.end()) {
+            break;
+        }
+        has_moves = true;
+        layer->changes.push_back(std::move(*move));
+        run_begin = std::next(move);
+    }
+    layer->sorted = !has_moves;
+    return layer;
+}
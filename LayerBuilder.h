@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include "Layer.h"
+
+namespace Dualys {
+    /**
+     * @class LayerBuilder
+     * @brief Collects file changes in bulk and produces a normalized, immutable Layer.
+     *
+     * Changes are appended without any processing. finish() then normalizes every path,
+     * sorts the changes by path and folds the successive changes of a same path into the
+     * fewest changes with the same effect, in a single O(n log n) pass. Large layers are
+     * sorted in parallel.
+     *
+     * Folding rules, for two successive changes of the same path:
+     * - ADDED or REMOVED replaces any previous change, except that REMOVED then ADDED and ADDED
+     *   then REMOVED are kept, so that a valid sequence stays valid for Plan::validateLayer(), and
+     *   except after a DIRECTORY_REMOVED, whose effect on descendants must be kept.
+     * - MODIFIED after ADDED or MODIFIED updates its digest and size; after REMOVED it becomes an ADDED.
+     * - PERMISSION_CHANGED after ADDED updates the ADDED metadata; after REMOVED it is dropped.
+     * - Any other pair is kept as is, in order.
+     *
+     * A DIRECTORY_REMOVED drops the earlier changes of its descendants, which makes the result
+     * independent of the order of the changes and therefore safely sortable. A DIRECTORY_MOVED
+     * is not order-independent: the changes before and after each move are normalized separately
+     * and the resulting layer is not flagged as sorted.
+     */
+    class LayerBuilder {
+    public:
+        /**
+         * @brief Number of changes from which finish() sorts in parallel.
+         */
+        static constexpr std::size_t kParallelSortThreshold = 1 << 16;
+
+        explicit LayerBuilder(std::string id);
+
+        /**
+         * @brief Reserves room for `changes` additional changes.
+         */
+        void reserve(std::size_t changes);
+
+        /**
+         * @brief Appends a single change.
+         */
+        void append(FileChange change);
+
+        /**
+         * @brief Appends a batch of changes, copying them.
+         */
+        void append(std::span<const FileChange> changes);
+
+        /**
+         * @brief Appends a batch of changes, taking ownership of their storage.
+         */
+        void append(std::vector<FileChange> &&changes);
+
+        /**
+         * @brief Returns the number of changes appended so far.
+         */
+        std::size_t size() const;
+
+        /**
+         * @brief Produces the normalized, sorted and deduplicated layer and leaves the builder empty.
+         */
+        std::shared_ptr<const Layer> finish();
+
+    private:
+        std::string m_id;
+        std::vector<FileChange> m_changes;
+    };
+}
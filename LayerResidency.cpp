@@ -0,0 +1,97 @@
+#include "LayerResidency.h"
+
+using namespace Dualys;
+
+
+LayerResidency::LayerResidency(const std::size_t max_bytes) : m_max_bytes(max_bytes) {
+}
+
+void LayerResidency::admit(Resident &resident, const std::size_t bytes) {
+    std::lock_guard lock(m_mutex);
+    unlist(resident);
+    m_recency.push_front(&resident);
+    resident.m_position = m_recency.begin();
+    resident.m_listed = true;
+    resident.m_bytes = bytes;
+    m_bytes += bytes;
+    ++m_faults;
+    evictBeyondBudget(&resident);
+}
+
+void LayerResidency::touch(Resident &resident) {
+    std::lock_guard lock(m_mutex);
+    if (resident.m_listed) {
+        m_recency.splice(m_recency.begin(), m_recency, resident.m_position);
+    }
+}
+
+void LayerResidency::trim() {
+    std::lock_guard lock(m_mutex);
+    evictBeyondBudget(nullptr);
+}
+
+void LayerResidency::forget(Resident &resident) {
+    std::lock_guard lock(m_mutex);
+    unlist(resident);
+}
+
+void LayerResidency::setMaxBytes(const std::size_t max_bytes) {
+    std::lock_guard lock(m_mutex);
+    m_max_bytes = max_bytes;
+    evictBeyondBudget(nullptr);
+}
+
+std::size_t LayerResidency::maxBytes() const {
+    std::lock_guard lock(m_mutex);
+    return m_max_bytes;
+}
+
+std::size_t LayerResidency::residentBytes() const {
+    std::lock_guard lock(m_mutex);
+    return m_bytes;
+}
+
+std::size_t LayerResidency::residents() const {
+    std::lock_guard lock(m_mutex);
+    return m_recency.size();
+}
+
+std::uint64_t LayerResidency::faults() const {
+    std::lock_guard lock(m_mutex);
+    return m_faults;
+}
+
+std::uint64_t LayerResidency::evictions() const {
+    std::lock_guard lock(m_mutex);
+    return m_evictions;
+}
+
+void LayerResidency::unlist(Resident &resident) {
+    if (!resident.m_listed) {
+        return;
+    }
+    m_recency.erase(resident.m_position);
+    m_bytes -= resident.m_bytes;
+    resident.m_listed = false;
+    resident.m_bytes = 0;
+}
+
+void LayerResidency::evictBeyondBudget(const Resident *keep) {
+    // From the coldest end; residents in use are skipped, and stay over budget until released.
+    for (auto it = m_recency.end(); m_bytes > m_max_bytes && it != m_recency.begin();) {
+        --it;
+        Resident &resident = **it;
+        if (&resident == keep || !resident.tryEvict()) {
+            continue;
+        }
+        auto next = std::next(it);
+        unlist(resident);
+        it = next;
+        ++m_evictions;
+    }
+}
+
+LayerResidency &Dualys::layerResidency() {
+    static LayerResidency residency;
+    return residency;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+
+namespace Dualys {
+    /**
+     * @class LayerResidency
+     * @brief Bounds the memory held by layers loaded on demand, evicting the least recently used.
+     *
+     * Lazily loaded plans (see Plan::loadLazily()) register here once their layers are faulted
+     * in, and are touched on every access. When the resident bytes exceed the budget, the coldest
+     * residents not in use drop their layers, to be faulted in again on their next access. Residents
+     * in use when the budget is exceeded are evicted once released (see trim()).
+     *
+     * Thread-safe.
+     */
+    class LayerResidency {
+    public:
+        /**
+         * @class Resident
+         * @brief Data that can be dropped and loaded again, tracked by a LayerResidency.
+         */
+        class Resident {
+        public:
+            virtual ~Resident() = default;
+
+        protected:
+            /**
+             * @brief Drops the resident data, unless it is in use.
+             *
+             * Called with the residency locked: must not call back into it, nor block on a lock
+             * that is held while calling into it.
+             *
+             * @return false if the data is in use and was kept.
+             */
+            virtual bool tryEvict() = 0;
+
+        private:
+            friend class LayerResidency;
+
+            std::list<Resident *>::iterator m_position;
+            bool m_listed = false;
+            std::size_t m_bytes = 0;
+        };
+
+        explicit LayerResidency(std::size_t max_bytes = std::size_t{256} << 20);
+
+        /**
+         * @brief Registers `resident`, just loaded and holding `bytes`, as the most recently used.
+         *
+         * Colder residents are evicted until the budget holds again, if they can be; `resident`
+         * itself is never evicted by its own admission.
+         */
+        void admit(Resident &resident, std::size_t bytes);
+
+        /**
+         * @brief Marks `resident` as the most recently used.
+         */
+        void touch(Resident &resident);
+
+        /**
+         * @brief Evicts the coldest residents until the budget holds, e.g. once residents in use
+         *        at admission time are released.
+         */
+        void trim();
+
+        /**
+         * @brief Stops tracking `resident`, after it dropped its data or before it is destroyed.
+         */
+        void forget(Resident &resident);
+
+        /**
+         * @brief Changes the budget, evicting what no longer fits.
+         */
+        void setMaxBytes(std::size_t max_bytes);
+
+        std::size_t maxBytes() const;
+
+        /**
+         * @brief Returns the bytes held by the residents.
+         */
+        std::size_t residentBytes() const;
+
+        /**
+         * @brief Returns the number of residents.
+         */
+        std::size_t residents() const;
+
+        /**
+         * @brief Returns the number of admissions, i.e. of loads on demand.
+         */
+        std::uint64_t faults() const;
+
+        std::uint64_t evictions() const;
+
+    private:
+        mutable std::mutex m_mutex;
+        std::size_t m_max_bytes;
+        std::size_t m_bytes = 0;
+
+        // Most recently used first.
+        std::list<Resident *> m_recency;
+        std::uint64_t m_faults = 0;
+        std::uint64_t m_evictions = 0;
+
+        void unlist(Resident &resident);
+
+        void evictBeyondBudget(const Resident *keep);
+    };
+
+    /**
+     * @brief Returns the residency shared by default by the lazily loaded plans (256 MiB).
+     */
+    LayerResidency &layerResidency();
+}
@@ -0,0 +1,516 @@
+#include "NativeProcessStrategy.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "PathUtils.h"
+
+extern char **environ;
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr auto kPollInterval = std::chrono::milliseconds(10);
+
+    /**
+     * SHA-256 (FIPS 180-4), for the content addresses of the files produced by runs.
+     */
+    class Sha256 {
+    public:
+        void update(const char *data, std::size_t size) {
+            m_size += size;
+            while (size > 0) {
+                const auto count = std::min(size, m_block.size() - m_used);
+                std::memcpy(m_block.data() + m_used, data, count);
+                m_used += count;
+                data += count;
+                size -= count;
+                if (m_used == m_block.size()) {
+                    compress();
+                    m_used = 0;
+                }
+            }
+        }
+
+        /**
+         * Returns the digest as 64 hexadecimal characters; the hash is not usable afterwards.
+         */
+        std::string hexDigest() {
+            const std::uint64_t bits = m_size * 8;
+            m_block[m_used++] = 0x80;
+            if (m_used > 56) {
+                std::fill(m_block.begin() + static_cast<std::ptrdiff_t>(m_used), m_block.end(), 0);
+                compress();
+                m_used = 0;
+            }
+            std::fill(m_block.begin() + static_cast<std::ptrdiff_t>(m_used), m_block.begin() + 56, 0);
+            for (int i = 0; i < 8; ++i) {
+                m_block[56 + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+            }
+            compress();
+            std::string hex;
+            for (const auto word: m_state) {
+                char digits[9];
+                std::snprintf(digits, sizeof(digits), "%08x", word);
+                hex += digits;
+            }
+            return hex;
+        }
+
+    private:
+        static constexpr std::array<std::uint32_t, 64> kRounds{
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        std::array<std::uint32_t, 8> m_state{
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        std::array<unsigned char, 64> m_block{};
+        std::size_t m_used = 0;
+        std::uint64_t m_size = 0;
+
+        void compress() {
+            std::array<std::uint32_t, 64> schedule{};
+            for (int i = 0; i < 16; ++i) {
+                schedule[i] = static_cast<std::uint32_t>(m_block[4 * i]) << 24 |
+                              static_cast<std::uint32_t>(m_block[4 * i + 1]) << 16 |
+                              static_cast<std::uint32_t>(m_block[4 * i + 2]) << 8 |
+                              static_cast<std::uint32_t>(m_block[4 * i + 3]);
+            }
+            for (int i = 16; i < 64; ++i) {
+                const auto s0 = std::rotr(schedule[i - 15], 7) ^ std::rotr(schedule[i - 15], 18) ^ schedule[i - 15] >> 3;
+                const auto s1 = std::rotr(schedule[i - 2], 17) ^ std::rotr(schedule[i - 2], 19) ^ schedule[i - 2] >> 10;
+                schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+            }
+            auto [a, b, c, d, e, f, g, h] = m_state;
+            for (int i = 0; i < 64; ++i) {
+                const auto t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                                kRounds[i] + schedule[i];
+                const auto t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            const std::array<std::uint32_t, 8> rounds{a, b, c, d, e, f, g, h};
+            for (int i = 0; i < 8; ++i) {
+                m_state[i] += rounds[i];
+            }
+        }
+    };
+
+    /**
+     * SHA-256 of a file, as 64 hexadecimal characters (the widest ContentDigest stored in place).
+     */
+    std::optional<std::string> hashFile(const std::filesystem::path &path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return std::nullopt;
+        }
+        Sha256 hash;
+        std::array<char, 1 << 16> buffer{};
+        while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+            hash.update(buffer.data(), static_cast<std::size_t>(in.gcount()));
+        }
+        if (in.bad()) {
+            return std::nullopt;
+        }
+        return hash.hexDigest();
+    }
+
+    constexpr auto kWritePermissions =
+            std::filesystem::perms::owner_write | std::filesystem::perms::group_write |
+            std::filesystem::perms::others_write;
+
+    /**
+     * Adds or removes the write permissions of `root` and of the directories under it.
+     */
+    void setDirectoriesWritable(const std::filesystem::path &root, const bool writable) {
+        const auto options = writable ? std::filesystem::perm_options::add : std::filesystem::perm_options::remove;
+        std::error_code error;
+        std::filesystem::permissions(root, kWritePermissions, options, error);
+        for (auto it = std::filesystem::recursive_directory_iterator(root, error);
+             !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+            // Links are not followed: the target of a link to a directory is not the root's.
+            std::error_code ignored;
+            if (std::filesystem::is_directory(it->symlink_status(ignored))) {
+                std::filesystem::permissions(it->path(), kWritePermissions, options, ignored);
+            }
+        }
+    }
+
+    /**
+     * Removes a root under construction, including the directories already made read-only.
+     */
+    void removeRoot(const std::filesystem::path &root) {
+        std::error_code error;
+        setDirectoriesWritable(root, true);
+        std::filesystem::remove_all(root, error);
+    }
+
+    /**
+     * Tells whether `path` can be joined under a root: absolute and normalized, so that no ".."
+     * or empty segment leads out of it. Plan::applyLayer() stores the paths as given.
+     */
+    bool isRootPath(const std::string &path) {
+        return path.starts_with('/') && normalizePath(path) == path;
+    }
+
+    /**
+     * Tells whether `name` designates a file of the blob store rather than a path leading out of it.
+     */
+    bool isBlobName(const std::string &name) {
+        return !name.empty() && name != "." && name != ".." &&
+               name.find_first_of(std::string_view("/\0", 2)) == std::string::npos;
+    }
+
+    std::optional<std::string> readBlob(const std::filesystem::path &path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return std::nullopt;
+        }
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    ExecutionResult failure(const int exit_code, std::string output,
+                            const ExecutionStatus status = ExecutionStatus::COMPLETED) {
+        return ExecutionResult{exit_code, std::move(output), status, nullptr};
+    }
+
+    /**
+     * Kills the child's process group and reaps the child, so that no process outlives an
+     * interrupted run, including the ones it started and that may still hold its output.
+     */
+    void killChild(const pid_t pid) {
+        kill(-pid, SIGKILL);
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+NativeProcessStrategy::NativeProcessStrategy(NativeProcessOptions options) : m_options(std::move(options)) {
+    std::error_code error;
+    m_options.blob_directory = std::filesystem::absolute(m_options.blob_directory, error);
+    m_options.cache_directory = std::filesystem::absolute(m_options.cache_directory, error);
+    std::filesystem::create_directories(m_options.blob_directory, error);
+    std::filesystem::create_directories(m_options.cache_directory / "roots", error);
+    std::filesystem::create_directories(m_options.cache_directory / "runs", error);
+}
+
+ExecutionResult NativeProcessStrategy::execute(VirtualFileSystem &filesystem, ExecutionContext &context) const {
+    const auto &plan = *filesystem.getPlan();
+    if (!entryPoint(plan)) {
+        return failure(1, std::string("entry point ") + kEntryPoint + " not found");
+    }
+    const auto root = checkout(plan);
+    if (!root) {
+        return failure(1, "missing content in the blob store");
+    }
+    if (context.checkpoint()) {
+        return context.interrupted();
+    }
+
+    const auto scratch = scratchDirectory();
+    const auto output = scratch / "out";
+    std::error_code error;
+    std::filesystem::create_directories(output, error);
+
+    // Everything the child needs is prepared before fork(): after it, only async-signal-safe calls.
+    const std::string program = (*root / std::string(kEntryPoint).substr(1)).string();
+    const std::string root_directory = root->string();
+    std::vector<std::string> variables{"PLAN_ROOT=" + root_directory, "PLAN_OUTPUT=" + output.string()};
+    std::vector<char *> envp;
+    for (auto &variable: variables) {
+        envp.push_back(variable.data());
+    }
+    for (char **variable = environ; *variable; ++variable) {
+        if (std::string_view(*variable).starts_with("PLAN_ROOT=") || std::string_view(*variable).starts_with("PLAN_OUTPUT=")) {
+            continue;
+        }
+        envp.push_back(*variable);
+    }
+    envp.push_back(nullptr);
+    std::string name = "main";
+    char *argv[] = {name.data(), nullptr};
+
+    const auto &limits = context.limits();
+    std::optional<rlimit> cpu_limit;
+    if (limits.cpu_time.count() > 0) {
+        const auto seconds = static_cast<rlim_t>((limits.cpu_time.count() + 999) / 1000);
+        cpu_limit = rlimit{seconds, seconds + 1};
+    }
+    std::optional<rlimit> memory_limit;
+    if (limits.memory_bytes > 0) {
+        memory_limit = rlimit{limits.memory_bytes, limits.memory_bytes};
+    }
+
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        std::filesystem::remove_all(scratch, error);
+        return failure(127, "cannot create the output pipe");
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        dup2(pipe_fds[1], STDERR_FILENO);
+        if (chdir(root_directory.c_str()) != 0 ||
+            (cpu_limit && setrlimit(RLIMIT_CPU, &*cpu_limit) != 0) ||
+            (memory_limit && setrlimit(RLIMIT_AS, &*memory_limit) != 0)) {
+            _exit(127);
+        }
+        execve(program.c_str(), argv, envp.data());
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    if (pid > 0) {
+        // Also set by the parent, so that the group exists before killChild() may need it.
+        setpgid(pid, pid);
+    }
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        std::filesystem::remove_all(scratch, error);
+        return failure(127, "cannot start " + std::string(kEntryPoint));
+    }
+
+    ExecutionResult result;
+    std::array<char, 4096> buffer{};
+    bool open = true;
+    int status = 0;
+    rusage usage{};
+    while (true) {
+        if (context.checkpoint()) {
+            killChild(pid);
+            close(pipe_fds[0]);
+            std::filesystem::remove_all(scratch, error);
+            return context.interrupted();
+        }
+        if (open) {
+            pollfd descriptor{pipe_fds[0], POLLIN, 0};
+            if (poll(&descriptor, 1, static_cast<int>(kPollInterval.count())) > 0) {
+                const auto count = read(pipe_fds[0], buffer.data(), buffer.size());
+                if (count > 0) {
+                    const auto kept = std::min(static_cast<std::size_t>(count),
+                                               m_options.max_output_bytes - std::min(m_options.max_output_bytes,
+                                                   result.output.size()));
+                    result.output.append(buffer.data(), kept);
+                } else if (count == 0 || errno != EINTR) {
+                    open = false;
+                }
+            }
+            continue;
+        }
+        // The output is closed, but the process may still run: keep watching the limits.
+        if (const auto waited = wait4(pid, &status, WNOHANG, &usage); waited == pid) {
+            break;
+        } else if (waited < 0 && errno != EINTR) {
+            close(pipe_fds[0]);
+            std::filesystem::remove_all(scratch, error);
+            return failure(127, "cannot wait for " + std::string(kEntryPoint));
+        }
+        std::this_thread::sleep_for(kPollInterval);
+    }
+    close(pipe_fds[0]);
+
+    if (WIFSIGNALED(status)) {
+        const int signal = WTERMSIG(status);
+        std::filesystem::remove_all(scratch, error);
+        // The kernel sends SIGXCPU at the soft limit, then SIGKILL at the hard one, a second
+        // later: a SIGKILL is the limit's only if the process got past the soft one.
+        const auto cpu_microseconds = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1'000'000LL +
+                                      usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+        if (cpu_limit && (signal == SIGXCPU ||
+                          (signal == SIGKILL && static_cast<rlim_t>(cpu_microseconds) >= cpu_limit->rlim_cur * 1'000'000))) {
+            return failure(-1, "CPU time limit exceeded", ExecutionStatus::CPU_LIMIT_EXCEEDED);
+        }
+        result.exit_code = 128 + signal;
+        return result;
+    }
+    result.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    collectOutputs(filesystem, output);
+    std::filesystem::remove_all(scratch, error);
+    return result;
+}
+
+std::string NativeProcessStrategy::id() const {
+    return "native";
+}
+
+std::optional<std::string> NativeProcessStrategy::entryPoint(const Plan &plan) const {
+    if (const auto entry = plan.lookup(kEntryPoint);
+        entry && entry->metadata.type == FileType::REGULAR && (entry->metadata.mode & 0111) != 0) {
+        return kEntryPoint;
+    }
+    return std::nullopt;
+}
+
+std::optional<std::filesystem::path> NativeProcessStrategy::checkout(const Plan &plan) const {
+    const auto root = m_options.cache_directory / "roots" / plan.getStateDigest().str();
+    std::error_code error;
+    if (std::filesystem::is_directory(root, error)) {
+        ++m_cached_checkouts;
+        return root;
+    }
+    // Built aside, then renamed into place: a root is either complete or absent.
+    const auto building = m_options.cache_directory / "roots" /
+                          (".building-" + std::to_string(getpid()) + "-" + std::to_string(m_next_scratch++));
+    std::filesystem::create_directories(building, error);
+    for (const auto &[path, entry]: plan.getFileSystemState()) {
+        if (error) {
+            break;
+        }
+        // Paths and hashes come from the plan: neither may designate a file outside the root or the store.
+        if (!isRootPath(path)) {
+            error = std::make_error_code(std::errc::invalid_argument);
+            break;
+        }
+        const auto target = building / std::string_view(path).substr(1);
+        if (entry.metadata.type == FileType::DIRECTORY) {
+            std::filesystem::create_directories(target, error);
+            continue;
+        }
+        const auto name = entry.digest.str();
+        if (!isBlobName(name)) {
+            error = std::make_error_code(std::errc::invalid_argument);
+            break;
+        }
+        const auto blob = m_options.blob_directory / name;
+        if (std::filesystem::create_directories(target.parent_path(), error); error) {
+            break;
+        }
+        if (entry.metadata.type == FileType::SYMLINK) {
+            // The blob of a symbolic link holds its target.
+            const auto link = readBlob(blob);
+            if (!link) {
+                error = std::make_error_code(std::errc::no_such_file_or_directory);
+                break;
+            }
+            std::filesystem::create_symlink(*link, target, error);
+        } else if ((entry.metadata.mode & 0111) != 0) {
+            // The blob is shared by every file with the same content, whatever its mode: an
+            // executable gets its own read-only copy, with its mode.
+            std::filesystem::copy_file(blob, target, error);
+            if (!error) {
+                std::filesystem::permissions(target, static_cast<std::filesystem::perms>(entry.metadata.mode & 0555),
+                                             error);
+            }
+        } else {
+            // Read-only, so that writing through the link into the store fails unless the process
+            // restores the permissions on purpose.
+            std::filesystem::permissions(blob, kWritePermissions, std::filesystem::perm_options::remove, error);
+            if (!error) {
+                std::filesystem::create_symlink(blob, target, error);
+            }
+        }
+    }
+    if (error) {
+        removeRoot(building);
+        return std::nullopt;
+    }
+    // Shared by concurrent runs: adding or removing files in it fails unless a process restores
+    // the permissions on purpose.
+    setDirectoriesWritable(building, false);
+    std::filesystem::rename(building, root, error);
+    if (error) {
+        // Another run created the same root first.
+        removeRoot(building);
+        if (!std::filesystem::is_directory(root, error)) {
+            return std::nullopt;
+        }
+    }
+    ++m_created_checkouts;
+    return root;
+}
+
+std::uint64_t NativeProcessStrategy::cachedCheckouts() const {
+    return m_cached_checkouts;
+}
+
+std::uint64_t NativeProcessStrategy::createdCheckouts() const {
+    return m_created_checkouts;
+}
+
+const NativeProcessOptions &NativeProcessStrategy::options() const {
+    return m_options;
+}
+
+std::filesystem::path NativeProcessStrategy::scratchDirectory() const {
+    return m_options.cache_directory / "runs" / (std::to_string(getpid()) + "-" + std::to_string(m_next_scratch++));
+}
+
+void NativeProcessStrategy::collectOutputs(VirtualFileSystem &filesystem, const std::filesystem::path &output) const {
+    std::error_code error;
+    std::vector<std::filesystem::path> produced;
+    for (auto it = std::filesystem::recursive_directory_iterator(output, error);
+         !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        produced.push_back(it->path());
+    }
+    // Sorted paths list every directory before its contents.
+    std::ranges::sort(produced);
+
+    for (const auto &file: produced) {
+        const auto path = "/" + file.lexically_relative(output).generic_string();
+        const auto existing = filesystem.stat(path);
+        const auto status = std::filesystem::symlink_status(file, error);
+        const auto mode = static_cast<std::uint32_t>(status.permissions() & std::filesystem::perms::mask);
+        if (std::filesystem::is_directory(status)) {
+            if (existing && existing->metadata.type == FileType::DIRECTORY) {
+                continue;
+            }
+            if (existing) {
+                filesystem.remove(path);
+            }
+            filesystem.makeDirectory(path, mode);
+            continue;
+        }
+        if (!std::filesystem::is_regular_file(status)) {
+            continue;
+        }
+        const auto hash = hashFile(file);
+        if (!hash) {
+            continue;
+        }
+        const auto size = std::filesystem::file_size(file, error);
+        const auto blob = m_options.blob_directory / *hash;
+        if (std::filesystem::exists(blob, error)) {
+            std::filesystem::remove(file, error);
+        } else {
+            // Blobs are shared by every root that holds their content: read-only once stored.
+            std::filesystem::permissions(file, kWritePermissions | std::filesystem::perms::owner_exec |
+                                               std::filesystem::perms::group_exec | std::filesystem::perms::others_exec,
+                                         std::filesystem::perm_options::remove, error);
+            std::filesystem::rename(file, blob, error);
+        }
+        // An existing regular file keeps its permissions through writeFile(): they are set apart.
+        filesystem.writeFile(path, *hash, size, mode);
+        if (existing && existing->metadata.type == FileType::REGULAR && existing->metadata.mode != mode) {
+            filesystem.setPermissions(path, mode, existing->metadata.uid, existing->metadata.gid);
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include "ExecutionEngine.h"
+
+namespace Dualys {
+    /**
+     * @struct NativeProcessOptions
+     * @brief Where a NativeProcessStrategy finds file contents and keeps its checkouts.
+     */
+    struct NativeProcessOptions {
+        /**
+         * @brief Content-addressed store: the content of hash `h` is the file `blob_directory / h`.
+         *        The files produced by runs are added to it, named by their SHA-256.
+         *
+         * Blobs are shared by every root holding their content: checkouts make them read-only,
+         * which guards against accidental writes, not against a process restoring the permissions.
+         */
+        std::filesystem::path blob_directory;
+
+        /**
+         * @brief Directory holding the cached roots (roots/) and the per-run scratch space (runs/).
+         */
+        std::filesystem::path cache_directory;
+
+        /**
+         * @brief Bytes of standard output and error kept in the result; the rest is discarded.
+         */
+        std::size_t max_output_bytes = 1 << 20;
+    };
+
+    /**
+     * @class NativeProcessStrategy
+     * @brief Runs the plan's `/main` executable as a child process (id "native").
+     *
+     * The process sees the plan's state as a root directory made of symbolic links into the blob
+     * store: checking a plan out creates one link per file and copies only the executables, whose
+     * mode the shared blob cannot carry. Roots are cached by state digest, so every plan with the
+     * same state (clones, repeated runs) reuses the same root, and their creation is atomic, so
+     * concurrent runs may share them. A root is not assembled from the roots of earlier states:
+     * checking out a new state, even one differing by a single small layer, costs O(files).
+     *
+     * Roots and blobs are made read-only, which stops accidental writes only: the process runs
+     * under the caller's uid, so it may make them writable again and alter what the other runs
+     * see. Untrusted programs need another uid or a mount namespace, which this strategy does not
+     * set up.
+     *
+     * The process runs in the root (its working directory, also in $PLAN_ROOT) and writes its
+     * outputs under $PLAN_OUTPUT. Once it exits, the outputs are moved into the blob store and
+     * written to the run's VirtualFileSystem, which the engine returns as the result's layer,
+     * ready to be applied on the plan. The root is not a chroot:
+     * the process must address the plan's files by relative paths or through $PLAN_ROOT.
+     *
+     * Limits are enforced by the parent: cancellation and the deadline kill the process group
+     * the child leads, with the processes it started; the CPU time and memory budgets become
+     * RLIMIT_CPU and RLIMIT_AS of the child. SIGXCPU, or a SIGKILL after the process used up its
+     * CPU time, reports CPU_LIMIT_EXCEEDED; other signals report 128 + signal. Going over
+     * RLIMIT_AS only makes the process's allocations fail, so it is reported as whatever the
+     * process does then, never as MEMORY_LIMIT_EXCEEDED.
+     */
+    class NativeProcessStrategy : public IExecutionStrategy {
+    public:
+        static constexpr const char *kEntryPoint = "/main";
+
+        explicit NativeProcessStrategy(NativeProcessOptions options);
+
+        ExecutionResult execute(VirtualFileSystem &filesystem, ExecutionContext &context) const override;
+
+        std::string id() const override;
+
+        /**
+         * @brief Returns kEntryPoint if the plan holds it as an executable regular file.
+         */
+        std::optional<std::string> entryPoint(const Plan &plan) const override;
+
+        /**
+         * @brief Returns the root directory of `plan`, creating it if it is not cached.
+         * @return std::nullopt if a path is not absolute and normalized, a hash is not a file name
+         *         of the blob store, a file's content is missing from it, or the root cannot be
+         *         created.
+         */
+        std::optional<std::filesystem::path> checkout(const Plan &plan) const;
+
+        /**
+         * @brief Returns the number of checkouts served by a cached root.
+         */
+        std::uint64_t cachedCheckouts() const;
+
+        /**
+         * @brief Returns the number of checkouts that had to create the root.
+         */
+        std::uint64_t createdCheckouts() const;
+
+        const NativeProcessOptions &options() const;
+
+    private:
+        NativeProcessOptions m_options;
+        mutable std::atomic<std::uint64_t> m_cached_checkouts{0};
+        mutable std::atomic<std::uint64_t> m_created_checkouts{0};
+        mutable std::atomic<std::uint64_t> m_next_scratch{0};
+
+        std::filesystem::path scratchDirectory() const;
+
+        /**
+         * @brief Moves the files under `output` into the blob store and writes them to `filesystem`.
+         */
+        void collectOutputs(VirtualFileSystem &filesystem, const std::filesystem::path &output) const;
+    };
+}
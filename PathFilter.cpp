@@ -0,0 +1,148 @@
+#include "PathFilter.h"
+#include "BinaryIO.h"
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr std::size_t kBitsPerPath = 10;
+    constexpr std::size_t kWordsPerBlock = 8;
+    constexpr std::size_t kBitsPerBlock = kWordsPerBlock * 64;
+    constexpr int kProbes = 7;
+    // Larger filters are not plausible for the changes of one plan: reading one is a corrupt file.
+    constexpr std::uint64_t kMaxCapacity = std::uint64_t{1} << 32;
+
+    std::uint64_t mix(std::uint64_t value) {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ULL;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebULL;
+        value ^= value >> 31;
+        return value;
+    }
+
+    std::size_t wordsFor(const std::uint64_t capacity) {
+        const auto bits = capacity * kBitsPerPath;
+        return static_cast<std::size_t>((bits + kBitsPerBlock - 1) / kBitsPerBlock) * kWordsPerBlock;
+    }
+
+    /**
+     * Key of a subtree: its directory without the trailing '/', so that it is a prefix of its
+     * descendants ending just before a '/' (the root "/" becomes "").
+     */
+    std::string_view subtreeKey(std::string_view directory) {
+        if (directory.ends_with('/')) {
+            directory.remove_suffix(1);
+        }
+        return directory;
+    }
+}
+
+PathFilter::PathFilter(const std::size_t capacity)
+    : m_capacity(capacity), m_words(wordsFor(capacity)) {
+}
+
+void PathFilter::add(const Layer &layer) {
+    for (const auto &change: layer.changes) {
+        if (change.type == ChangeType::DIRECTORY_REMOVED) {
+            insertSubtree(change.path);
+        } else if (change.type == ChangeType::DIRECTORY_MOVED) {
+            insertSubtree(change.path);
+            insertSubtree(change.target_path);
+        } else {
+            insert(change.path);
+        }
+    }
+}
+
+void PathFilter::insert(const std::string_view path) {
+    set(hash(path));
+}
+
+void PathFilter::insertSubtree(const std::string_view directory) {
+    m_subtrees = true;
+    set(hash(subtreeKey(directory)));
+}
+
+bool PathFilter::mayAffect(const std::string_view path, const std::uint64_t hash) const {
+    if (m_words.empty()) {
+        return false;
+    }
+    if (test(hash)) {
+        return true;
+    }
+    if (!m_subtrees) {
+        return false;
+    }
+    // Every directory whose subtree holds `path` is either `path` itself, tested above, or recorded
+    // as a prefix of it ending before a '/'.
+    for (auto slash = path.find('/'); slash != std::string_view::npos; slash = path.find('/', slash + 1)) {
+        if (test(PathFilter::hash(path.substr(0, slash)))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PathFilter::mayAffect(const std::string_view path) const {
+    return mayAffect(path, hash(path));
+}
+
+std::size_t PathFilter::capacity() const {
+    return static_cast<std::size_t>(m_capacity);
+}
+
+void PathFilter::writeTo(std::ostream &out) const {
+    writeValue(out, m_capacity);
+    writeValue(out, static_cast<std::uint8_t>(m_subtrees));
+    writeColumn(out, m_words);
+}
+
+std::optional<PathFilter> PathFilter::readFrom(std::istream &in) {
+    PathFilter filter;
+    std::uint8_t subtrees = 0;
+    if (!readValue(in, filter.m_capacity) || filter.m_capacity > kMaxCapacity || !readValue(in, subtrees) ||
+        !readColumn(in, filter.m_words, wordsFor(filter.m_capacity))) {
+        return std::nullopt;
+    }
+    filter.m_subtrees = subtrees != 0;
+    return filter;
+}
+
+std::uint64_t PathFilter::hash(const std::string_view path) {
+    std::uint64_t state = mix(path.size() + 0x9e3779b97f4a7c15ULL);
+    std::size_t offset = 0;
+    for (; offset + 8 <= path.size(); offset += 8) {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < 8; ++i) {
+            value |= static_cast<std::uint64_t>(static_cast<unsigned char>(path[offset + i])) << (8 * i);
+        }
+        state = mix(state ^ value) * 0xff51afd7ed558ccdULL;
+    }
+    std::uint64_t tail = 0;
+    for (std::size_t i = 0; offset + i < path.size(); ++i) {
+        tail |= static_cast<std::uint64_t>(static_cast<unsigned char>(path[offset + i])) << (8 * i);
+    }
+    return mix(state ^ tail);
+}
+
+void PathFilter::set(const std::uint64_t hash) {
+    const auto blocks = m_words.size() / kWordsPerBlock;
+    auto *block = m_words.data() + ((hash >> 32) * blocks >> 32) * kWordsPerBlock;
+    auto bits = mix(hash);
+    for (int i = 0; i < kProbes; ++i, bits >>= 9) {
+        block[(bits >> 6) & (kWordsPerBlock - 1)] |= std::uint64_t{1} << (bits & 63);
+    }
+}
+
+bool PathFilter::test(const std::uint64_t hash) const {
+    const auto blocks = m_words.size() / kWordsPerBlock;
+    const auto *block = m_words.data() + ((hash >> 32) * blocks >> 32) * kWordsPerBlock;
+    auto bits = mix(hash);
+    for (int i = 0; i < kProbes; ++i, bits >>= 9) {
+        if ((block[(bits >> 6) & (kWordsPerBlock - 1)] & std::uint64_t{1} << (bits & 63)) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+#include "Layer.h"
+
+namespace Dualys {
+    /**
+     * @class PathFilter
+     * @brief Approximate set of the paths changed by a sequence of layers: answers "certainly not
+     *        changed" in a single cache line.
+     *
+     * A blocked Bloom filter: each path hashes to one 512-bit block, in which it sets 7 bits. Sized
+     * at 10 bits per path, it reports about 1% of the absent paths as possibly present, and never
+     * misses a present one.
+     *
+     * Subtree changes (DIRECTORY_REMOVED, DIRECTORY_MOVED) are recorded under their directories;
+     * once there are some, mayAffect() also probes the parent directories of the path.
+     *
+     * The hash is stable across runs and platforms, so filters can be persisted.
+     */
+    class PathFilter {
+    public:
+        /**
+         * @brief Creates a filter that contains no path and cannot record any.
+         */
+        PathFilter() = default;
+
+        /**
+         * @brief Creates an empty filter sized for `capacity` paths.
+         */
+        explicit PathFilter(std::size_t capacity);
+
+        /**
+         * @brief Records the paths changed by `layer`. The filter must have a non-zero capacity.
+         */
+        void add(const Layer &layer);
+
+        /**
+         * @brief Records a change of `path` itself.
+         */
+        void insert(std::string_view path);
+
+        /**
+         * @brief Records a change of the whole subtree of `directory`.
+         */
+        void insertSubtree(std::string_view directory);
+
+        /**
+         * @brief Tells whether a recorded change may affect the entry at `path`.
+         *
+         * @param hash hash(path), computed once when probing several filters.
+         * @return false only if no recorded change affects `path`.
+         */
+        bool mayAffect(std::string_view path, std::uint64_t hash) const;
+
+        bool mayAffect(std::string_view path) const;
+
+        /**
+         * @brief Returns the number of distinct paths the filter was sized for.
+         */
+        std::size_t capacity() const;
+
+        void writeTo(std::ostream &out) const;
+
+        /**
+         * @brief Reads a filter written by writeTo().
+         * @return The filter, or std::nullopt if the input is truncated or malformed.
+         */
+        static std::optional<PathFilter> readFrom(std::istream &in);
+
+        static std::uint64_t hash(std::string_view path);
+
+    private:
+        std::uint64_t m_capacity = 0;
+        bool m_subtrees = false;
+
+        // Blocks of 8 words.
+        std::vector<std::uint64_t> m_words;
+
+        void set(std::uint64_t hash);
+
+        bool test(std::uint64_t hash) const;
+    };
+}
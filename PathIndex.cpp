@@ -0,0 +1,107 @@
+#include "PathIndex.h"
+#include <algorithm>
+
+using namespace Dualys;
+
+
+void PathIndex::add(const Layer &layer, const std::uint32_t layer_index) {
+    for (std::uint32_t i = 0; i < layer.changes.size(); ++i) {
+        add(layer.changes[i], {layer_index, i});
+    }
+}
+
+void PathIndex::add(const FileChange &change, const ChangeRef ref) {
+    if (isDirectoryChange(change.type)) {
+        m_directory_events.push_back(ref);
+    } else {
+        m_writes[change.path].push_back(ref);
+    }
+}
+
+void PathIndex::remove(const Layer &layer, const std::uint32_t layer_index) {
+    for (auto change = layer.changes.rbegin(); change != layer.changes.rend(); ++change) {
+        if (isDirectoryChange(change->type)) {
+            if (!m_directory_events.empty() && m_directory_events.back().layer == layer_index) {
+                m_directory_events.pop_back();
+            }
+            continue;
+        }
+        const auto it = m_writes.find(change->path);
+        if (it == m_writes.end()) {
+            continue;
+        }
+        if (!it->second.empty() && it->second.back().layer == layer_index) {
+            it->second.pop_back();
+        }
+        if (it->second.empty()) {
+            m_writes.erase(it);
+        }
+    }
+}
+
+std::optional<ChangeRef> PathIndex::lastWrite(const std::string_view path, const ChangeRef before) const {
+    const auto it = m_writes.find(path);
+    if (it == m_writes.end()) {
+        return std::nullopt;
+    }
+    const auto &refs = it->second;
+    const auto bound = std::ranges::lower_bound(refs, before);
+    if (bound == refs.begin()) {
+        return std::nullopt;
+    }
+    return *std::prev(bound);
+}
+
+std::span<const ChangeRef> PathIndex::directoryEvents() const {
+    return m_directory_events;
+}
+
+std::size_t PathIndex::size() const {
+    return m_writes.size();
+}
+
+bool PathIndex::empty() const {
+    return m_writes.empty() && m_directory_events.empty();
+}
+
+bool PathIndex::affects(const FileChange &change, const std::string_view path) {
+    if (change.type == ChangeType::DIRECTORY_REMOVED) {
+        return isInSubtree(path, change.path);
+    }
+    if (change.path == change.target_path || isInSubtree(change.target_path, change.path)) {
+        return false;
+    }
+    return isInSubtree(path, change.target_path) || isInSubtree(path, change.path);
+}
+
+void PathIndex::updateEntry(std::optional<FileEntry> &entry, const FileChange &change) {
+    switch (change.type) {
+        case ChangeType::ADDED:
+            entry = FileEntry{change.metadata, ContentDigest(change.new_content_hash)};
+            break;
+
+        case ChangeType::MODIFIED:
+            if (!entry) {
+                entry = FileEntry{change.metadata, {}};
+            }
+            entry->digest = ContentDigest(change.new_content_hash);
+            entry->metadata.size = change.metadata.size;
+            break;
+
+        case ChangeType::REMOVED:
+            entry.reset();
+            break;
+
+        case ChangeType::PERMISSION_CHANGED:
+            if (entry) {
+                entry->metadata.mode = change.metadata.mode;
+                entry->metadata.uid = change.metadata.uid;
+                entry->metadata.gid = change.metadata.gid;
+            }
+            break;
+
+        case ChangeType::DIRECTORY_REMOVED:
+        case ChangeType::DIRECTORY_MOVED:
+            break;
+    }
+}
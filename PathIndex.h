@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "FileEntry.h"
+#include "Layer.h"
+#include "PathUtils.h"
+
+namespace Dualys {
+    /**
+     * @struct ChangeRef
+     * @brief Position of a change in a plan: the index of its layer, then its index in that layer.
+     *
+     * References compare in application order.
+     */
+    struct ChangeRef {
+        std::uint32_t layer = 0;
+        std::uint32_t change = 0;
+
+        auto operator<=>(const ChangeRef &) const = default;
+    };
+
+    /**
+     * @class PathIndex
+     * @brief Index of the changes of a sequence of layers, by path.
+     *
+     * Changes addressing a single path (ADDED, MODIFIED, REMOVED, PERMISSION_CHANGED) are listed
+     * under their path. Changes addressing a subtree (DIRECTORY_REMOVED, DIRECTORY_MOVED) cannot be
+     * keyed by every path they affect; they are kept in a separate list of directory events.
+     *
+     * Keys are views on the paths of the indexed layers: the layers must outlive the index and
+     * must not be modified once indexed.
+     */
+    class PathIndex {
+    public:
+        /**
+         * @brief Indexes every change of `layer`, which is the layer number `layer_index`.
+         *
+         * Layers must be indexed in application order. O(k log n) for a layer of k changes.
+         */
+        void add(const Layer &layer, std::uint32_t layer_index);
+
+        /**
+         * @brief Indexes a single change, found at `ref`. Changes must be indexed in application order.
+         *
+         * The change must stay at the same address as long as it is indexed.
+         */
+        void add(const FileChange &change, ChangeRef ref);
+
+        /**
+         * @brief Removes the changes of `layer`, the layer number `layer_index` and the last one
+         *        indexed, including those of a partial add(). No-op for changes not indexed.
+         */
+        void remove(const Layer &layer, std::uint32_t layer_index);
+
+        /**
+         * @brief Returns the last change addressing `path` itself that precedes `before`. O(log n).
+         */
+        std::optional<ChangeRef> lastWrite(std::string_view path, ChangeRef before) const;
+
+        /**
+         * @brief Calls `visit` with each path addressed by single-path changes, in path order.
+         */
+        template<typename Visit>
+        void forEachPath(const Visit &visit) const;
+
+        /**
+         * @brief Calls `visit` with each path of the subtree of `directory`, the directory included,
+         *        addressed by single-path changes, in path order. O(log n + m) for m paths.
+         */
+        template<typename Visit>
+        void forEachPathInSubtree(std::string_view directory, const Visit &visit) const;
+
+        /**
+         * @brief Returns the DIRECTORY_REMOVED and DIRECTORY_MOVED changes, in application order.
+         */
+        std::span<const ChangeRef> directoryEvents() const;
+
+        /**
+         * @brief Returns the number of distinct paths addressed by single-path changes.
+         */
+        std::size_t size() const;
+
+        bool empty() const;
+
+        /**
+         * @brief Resolves the entry at `path` just before the change `before` of the indexed changes.
+         *
+         * `change_at` returns the change designated by a ChangeRef, and `fallback` resolves a path in
+         * the state the indexed changes apply to. The last write to the path is found in O(log n);
+         * subtree changes applied after it take precedence (a move redirects the resolution to the
+         * source path). Relative updates (MODIFIED, PERMISSION_CHANGED) are collected while walking
+         * back to the change that determines the entry, then replayed on it.
+         */
+        template<typename ChangeAt, typename Fallback>
+        std::optional<FileEntry> resolve(std::string path, ChangeRef before, const ChangeAt &change_at,
+                                         const Fallback &fallback) const;
+
+        /**
+         * @brief Tells whether a subtree change affects `path`. A move into its own subtree is ignored.
+         */
+        static bool affects(const FileChange &change, std::string_view path);
+
+        /**
+         * @brief Applies a single-path change to the entry of its path, as Plan::applyChange() does on a state.
+         */
+        static void updateEntry(std::optional<FileEntry> &entry, const FileChange &change);
+
+    private:
+        std::map<std::string_view, std::vector<ChangeRef>, std::less<> > m_writes;
+        std::vector<ChangeRef> m_directory_events;
+    };
+
+    template<typename Visit>
+    void PathIndex::forEachPath(const Visit &visit) const {
+        for (const auto &write: m_writes) {
+            visit(write.first);
+        }
+    }
+
+    template<typename Visit>
+    void PathIndex::forEachPathInSubtree(const std::string_view directory, const Visit &visit) const {
+        const auto prefix = subtreePrefix(directory);
+        // The prefix of the root is the root itself, listed with its descendants.
+        if (prefix != directory && m_writes.contains(directory)) {
+            visit(directory);
+        }
+        const auto end = m_writes.lower_bound(subtreeUpperBound(prefix));
+        for (auto write = m_writes.lower_bound(prefix); write != end; ++write) {
+            visit(write->first);
+        }
+    }
+
+    template<typename ChangeAt, typename Fallback>
+    std::optional<FileEntry> PathIndex::resolve(std::string path, ChangeRef before, const ChangeAt &change_at,
+                                                const Fallback &fallback) const {
+        std::vector<const FileChange *> updates;
+        std::optional<FileEntry> entry;
+        while (true) {
+            const auto write = lastWrite(path, before);
+
+            // A subtree change applied after the last write to the path overrides it.
+            const FileChange *directory_change = nullptr;
+            for (auto event = std::ranges::lower_bound(m_directory_events, before); event != m_directory_events.begin();) {
+                --event;
+                if (write && *event < *write) {
+                    break;
+                }
+                if (affects(change_at(*event), path)) {
+                    directory_change = &change_at(*event);
+                    before = *event;
+                    break;
+                }
+            }
+            if (directory_change) {
+                if (directory_change->type == ChangeType::DIRECTORY_REMOVED ||
+                    !isInSubtree(path, directory_change->target_path)) {
+                    break;
+                }
+                // The entry is the one the moved subtree held at its source before the move.
+                path = reparentPath(path, directory_change->target_path, directory_change->path);
+                continue;
+            }
+
+            if (!write) {
+                entry = fallback(path);
+                break;
+            }
+            const auto &change = change_at(*write);
+            if (change.type == ChangeType::ADDED || change.type == ChangeType::REMOVED) {
+                updateEntry(entry, change);
+                break;
+            }
+            updates.push_back(&change);
+            before = *write;
+        }
+        for (auto it = updates.rbegin(); it != updates.rend(); ++it) {
+            updateEntry(entry, **it);
+        }
+        return entry;
+    }
+}
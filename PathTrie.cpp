@@ -0,0 +1,331 @@
+#include "PathTrie.h"
+#include "PathUtils.h"
+#include <algorithm>
+#include <utility>
+
+using namespace Dualys;
+
+
+namespace {
+    unsigned char firstByte(std::string_view label) {
+        return static_cast<unsigned char>(label.front());
+    }
+
+    template<typename Children>
+    auto findChild(Children &children, const unsigned char byte) {
+        return std::ranges::lower_bound(children, byte, {}, [](const auto &child) { return firstByte(child->label); });
+    }
+
+    std::size_t commonPrefixLength(std::string_view lhs, std::string_view rhs) {
+        const auto [left, right] = std::ranges::mismatch(lhs, rhs);
+        return static_cast<std::size_t>(left - lhs.begin());
+    }
+}
+
+std::size_t PathTrie::size() const {
+    return m_root ? m_root->count : 0;
+}
+
+bool PathTrie::empty() const {
+    return size() == 0;
+}
+
+const FileEntry *PathTrie::find(std::string_view path) const {
+    const Node *node = m_root.get();
+    while (node) {
+        if (path.empty()) {
+            return node->value ? &*node->value : nullptr;
+        }
+        const auto it = findChild(node->children, firstByte(path));
+        if (it == node->children.end() || firstByte((*it)->label) != firstByte(path) || !path.starts_with((*it)->label)) {
+            return nullptr;
+        }
+        path.remove_prefix((*it)->label.size());
+        node = it->get();
+    }
+    return nullptr;
+}
+
+void PathTrie::assign(std::string_view path, const FileEntry &entry) {
+    m_root = insert(m_root ? m_root : makeNode({}, std::nullopt, {}), path, entry);
+}
+
+bool PathTrie::erase(std::string_view path) {
+    if (!m_root) {
+        return false;
+    }
+    bool removed = false;
+    m_root = remove(m_root, path, removed);
+    // Compaction may have merged the root with its only child; the root must keep an empty label.
+    if (m_root && !m_root->label.empty()) {
+        m_root = makeNode({}, std::nullopt, {m_root});
+    }
+    return removed;
+}
+
+std::size_t PathTrie::eraseSubtree(std::string_view directory) {
+    std::size_t removed = erase(directory) ? 1 : 0;
+    if (m_root) {
+        m_root = removePrefix(m_root, subtreePrefix(directory), removed);
+        if (m_root && !m_root->label.empty()) {
+            m_root = makeNode({}, std::nullopt, {m_root});
+        }
+    }
+    return removed;
+}
+
+void PathTrie::moveSubtree(std::string_view from, std::string_view to) {
+    if (from == to || isInSubtree(to, from)) {
+        return;
+    }
+    std::vector<std::pair<std::string, FileEntry> > moved;
+    if (const auto *entry = find(from)) {
+        moved.emplace_back(std::string(to), *entry);
+    }
+    forEachWithPrefix(subtreePrefix(from), [&](const std::string &path, const FileEntry &entry) {
+        moved.emplace_back(reparentPath(path, from, to), entry);
+    });
+    eraseSubtree(from);
+    eraseSubtree(to);
+    for (const auto &[path, entry]: moved) {
+        assign(path, entry);
+    }
+}
+
+std::size_t PathTrie::countWithPrefix(std::string_view prefix) const {
+    std::size_t count = 0;
+    const Node *node = m_root.get();
+    while (node) {
+        if (prefix.empty()) {
+            return node->count;
+        }
+        const auto it = findChild(node->children, firstByte(prefix));
+        if (it == node->children.end() || firstByte((*it)->label) != firstByte(prefix)) {
+            return count;
+        }
+        const auto common = commonPrefixLength((*it)->label, prefix);
+        if (common == prefix.size()) {
+            return (*it)->count;
+        }
+        if (common != (*it)->label.size()) {
+            return count;
+        }
+        prefix.remove_prefix(common);
+        node = it->get();
+    }
+    return count;
+}
+
+void PathTrie::forEachWithPrefix(std::string_view prefix, const Visitor &visitor) const {
+    std::string path;
+    const Node *node = m_root.get();
+    while (node && !prefix.empty()) {
+        const auto it = findChild(node->children, firstByte(prefix));
+        if (it == node->children.end() || firstByte((*it)->label) != firstByte(prefix)) {
+            return;
+        }
+        const auto common = commonPrefixLength((*it)->label, prefix);
+        if (common != prefix.size() && common != (*it)->label.size()) {
+            return;
+        }
+        path.append((*it)->label);
+        prefix.remove_prefix(common);
+        node = it->get();
+    }
+    if (node) {
+        visit(*node, path, visitor);
+    }
+}
+
+void PathTrie::forEach(const Visitor &visitor) const {
+    forEachWithPrefix({}, visitor);
+}
+
+void PathTrie::apply(const FileChange &change) {
+    apply(ChangeRow::of(change));
+}
+
+void PathTrie::apply(const ChangeRow &change) {
+    switch (change.type) {
+        case ChangeType::ADDED:
+            assign(change.path, FileEntry{change.metadata, change.digest});
+            break;
+
+        case ChangeType::MODIFIED: {
+            const auto *existing = find(change.path);
+            auto entry = existing ? *existing : FileEntry{change.metadata, {}};
+            entry.digest = change.digest;
+            entry.metadata.size = change.metadata.size;
+            assign(change.path, entry);
+            break;
+        }
+
+        case ChangeType::REMOVED:
+            erase(change.path);
+            break;
+
+        case ChangeType::PERMISSION_CHANGED:
+            if (const auto *existing = find(change.path)) {
+                auto entry = *existing;
+                entry.metadata.mode = change.metadata.mode;
+                entry.metadata.uid = change.metadata.uid;
+                entry.metadata.gid = change.metadata.gid;
+                assign(change.path, entry);
+            }
+            break;
+
+        case ChangeType::DIRECTORY_REMOVED:
+            eraseSubtree(change.path);
+            break;
+
+        case ChangeType::DIRECTORY_MOVED:
+            moveSubtree(change.path, change.target_path);
+            break;
+    }
+}
+
+bool PathTrie::operator==(const PathTrie &other) const {
+    if (m_root == other.m_root) {
+        return true;
+    }
+    if (size() != other.size()) {
+        return false;
+    }
+    std::vector<std::pair<std::string, FileEntry> > entries;
+    entries.reserve(size());
+    forEach([&](const std::string &path, const FileEntry &entry) { entries.emplace_back(path, entry); });
+
+    auto it = entries.begin();
+    bool equal = true;
+    other.forEach([&](const std::string &path, const FileEntry &entry) {
+        equal = equal && it->first == path && it->second == entry;
+        ++it;
+    });
+    return equal;
+}
+
+PathTrie::NodePtr PathTrie::makeNode(std::string label, std::optional<FileEntry> value, std::vector<NodePtr> children) {
+    auto node = std::make_shared<Node>();
+    node->count = value ? 1 : 0;
+    for (const auto &child: children) {
+        node->count += child->count;
+    }
+    node->label = std::move(label);
+    node->value = std::move(value);
+    node->children = std::move(children);
+    return node;
+}
+
+PathTrie::NodePtr PathTrie::insert(const NodePtr &node, std::string_view key, const FileEntry &entry) {
+    if (key.empty()) {
+        return makeNode(node->label, entry, node->children);
+    }
+    auto children = node->children;
+    const auto it = findChild(children, firstByte(key));
+    if (it == children.end() || firstByte((*it)->label) != firstByte(key)) {
+        children.insert(it, makeNode(std::string(key), entry, {}));
+        return makeNode(node->label, node->value, std::move(children));
+    }
+
+    const auto child = *it;
+    const auto common = commonPrefixLength(child->label, key);
+    if (common == child->label.size()) {
+        *it = insert(child, key.substr(common), entry);
+    } else {
+        // Split the child's edge at the divergence point.
+        std::vector<NodePtr> split_children{makeNode(child->label.substr(common), child->value, child->children)};
+        std::optional<FileEntry> split_value;
+        if (common == key.size()) {
+            split_value = entry;
+        } else {
+            auto leaf = makeNode(std::string(key.substr(common)), entry, {});
+            const auto position = findChild(split_children, firstByte(leaf->label));
+            split_children.insert(position, std::move(leaf));
+        }
+        *it = makeNode(child->label.substr(0, common), std::move(split_value), std::move(split_children));
+    }
+    return makeNode(node->label, node->value, std::move(children));
+}
+
+PathTrie::NodePtr PathTrie::remove(const NodePtr &node, std::string_view key, bool &removed) {
+    if (key.empty()) {
+        if (!node->value) {
+            return node;
+        }
+        removed = true;
+        return compact(makeNode(node->label, std::nullopt, node->children));
+    }
+    const auto it = findChild(node->children, firstByte(key));
+    if (it == node->children.end() || firstByte((*it)->label) != firstByte(key) || !key.starts_with((*it)->label)) {
+        return node;
+    }
+    const auto updated = remove(*it, key.substr((*it)->label.size()), removed);
+    if (updated == *it) {
+        return node;
+    }
+    auto children = node->children;
+    const auto position = children.begin() + (it - node->children.begin());
+    if (updated) {
+        *position = updated;
+    } else {
+        children.erase(position);
+    }
+    return compact(makeNode(node->label, node->value, std::move(children)));
+}
+
+PathTrie::NodePtr PathTrie::removePrefix(const NodePtr &node, std::string_view prefix, std::size_t &removed) {
+    if (prefix.empty()) {
+        removed += node->count;
+        return nullptr;
+    }
+    const auto it = findChild(node->children, firstByte(prefix));
+    if (it == node->children.end() || firstByte((*it)->label) != firstByte(prefix)) {
+        return node;
+    }
+    const auto common = commonPrefixLength((*it)->label, prefix);
+    NodePtr updated;
+    if (common == prefix.size()) {
+        // The prefix ends inside this edge: the whole child subtree matches.
+        removed += (*it)->count;
+    } else if (common == (*it)->label.size()) {
+        updated = removePrefix(*it, prefix.substr(common), removed);
+        if (updated == *it) {
+            return node;
+        }
+    } else {
+        return node;
+    }
+    auto children = node->children;
+    const auto position = children.begin() + (it - node->children.begin());
+    if (updated) {
+        *position = updated;
+    } else {
+        children.erase(position);
+    }
+    return compact(makeNode(node->label, node->value, std::move(children)));
+}
+
+PathTrie::NodePtr PathTrie::compact(NodePtr node) {
+    if (node->value) {
+        return node;
+    }
+    if (node->children.empty()) {
+        return nullptr;
+    }
+    if (node->children.size() == 1) {
+        const auto &child = node->children.front();
+        return makeNode(node->label + child->label, child->value, child->children);
+    }
+    return node;
+}
+
+void PathTrie::visit(const Node &node, std::string &path, const Visitor &visitor) {
+    if (node.value) {
+        visitor(path, *node.value);
+    }
+    for (const auto &child: node.children) {
+        path.append(child->label);
+        visit(*child, path, visitor);
+        path.resize(path.size() - child->label.size());
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ColumnarLayer.h"
+#include "FileEntry.h"
+#include "Layer.h"
+
+namespace Dualys {
+    /**
+     * @class PathTrie
+     * @brief Persistent compressed radix trie mapping paths to file entries.
+     *
+     * Paths sharing a prefix share the nodes holding that prefix, so deep trees with long common
+     * prefixes (e.g. "/usr/lib/python3.12/site-packages/...") are stored and compared once.
+     *
+     * Nodes are immutable and reference-counted. Copying a trie is O(1), and every mutation copies
+     * only the nodes on the path from the root to the modified key; the copy and the original then
+     * share all untouched subtrees. This is what lets a plan's state share structure with the state
+     * of its base.
+     *
+     * Iteration visits paths in the same lexicographic order as FileSystemState.
+     */
+    class PathTrie {
+    public:
+        using Visitor = std::function<void(const std::string &path, const FileEntry &entry)>;
+
+        PathTrie() = default;
+
+        /**
+         * @brief Returns the number of paths stored in the trie. O(1).
+         */
+        std::size_t size() const;
+
+        bool empty() const;
+
+        /**
+         * @brief Returns the entry stored at `path`, or nullptr. O(depth).
+         */
+        const FileEntry *find(std::string_view path) const;
+
+        /**
+         * @brief Stores `entry` at `path`, replacing any previous entry. O(depth).
+         */
+        void assign(std::string_view path, const FileEntry &entry);
+
+        /**
+         * @brief Removes the entry stored at `path`. O(depth).
+         * @return false if there was no entry at `path`.
+         */
+        bool erase(std::string_view path);
+
+        /**
+         * @brief Removes `directory` and all of its descendants.
+         *
+         * The descendants are dropped by unlinking the node holding their common prefix, so the
+         * cost is O(depth) regardless of the subtree size.
+         *
+         * @return The number of removed entries.
+         */
+        std::size_t eraseSubtree(std::string_view directory);
+
+        /**
+         * @brief Moves `from` and its descendants under `to`, replacing the previous content of `to`.
+         *
+         * Moving a directory into its own subtree is ignored.
+         */
+        void moveSubtree(std::string_view from, std::string_view to);
+
+        /**
+         * @brief Returns the number of paths starting with `prefix`. O(depth).
+         */
+        std::size_t countWithPrefix(std::string_view prefix) const;
+
+        /**
+         * @brief Visits, in order, the paths starting with `prefix`. O(depth + output).
+         */
+        void forEachWithPrefix(std::string_view prefix, const Visitor &visitor) const;
+
+        /**
+         * @brief Visits every path, in order.
+         */
+        void forEach(const Visitor &visitor) const;
+
+        /**
+         * @brief Applies a single change, with the same semantics as Plan::applyChange().
+         */
+        void apply(const FileChange &change);
+
+        /**
+         * @brief Applies a single change given as a row.
+         */
+        void apply(const ChangeRow &change);
+
+        bool operator==(const PathTrie &other) const;
+
+    private:
+        struct Node;
+        using NodePtr = std::shared_ptr<const Node>;
+
+        struct Node {
+            /**
+             * @brief The bytes on the edge leading to this node (empty for the root).
+             */
+            std::string label;
+
+            std::optional<FileEntry> value;
+
+            /**
+             * @brief Children, sorted by the first byte of their label (compared as unsigned char).
+             */
+            std::vector<NodePtr> children;
+
+            /**
+             * @brief Number of values stored in this node and its descendants.
+             */
+            std::size_t count = 0;
+        };
+
+        static NodePtr makeNode(std::string label, std::optional<FileEntry> value, std::vector<NodePtr> children);
+
+        static NodePtr insert(const NodePtr &node, std::string_view key, const FileEntry &entry);
+
+        static NodePtr remove(const NodePtr &node, std::string_view key, bool &removed);
+
+        static NodePtr removePrefix(const NodePtr &node, std::string_view prefix, std::size_t &removed);
+
+        static NodePtr compact(NodePtr node);
+
+        static void visit(const Node &node, std::string &path, const Visitor &visitor);
+
+        NodePtr m_root;
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace Dualys {
+    /**
+     * @brief Returns the prefix shared by every descendant of `directory`.
+     *
+     * "/usr/lib" yields "/usr/lib/"; the root "/" yields itself.
+     */
+    inline std::string subtreePrefix(std::string_view directory) {
+        std::string prefix(directory);
+        if (prefix.empty() || prefix.back() != '/') {
+            prefix.push_back('/');
+        }
+        return prefix;
+    }
+
+    /**
+     * @brief Returns the smallest string greater than every string starting with `prefix`.
+     *
+     * `prefix` must end with '/', so that the bound is obtained by bumping that last character.
+     * Together with `prefix`, it delimits the half-open range of a subtree in a sorted container.
+     */
+    inline std::string subtreeUpperBound(std::string_view prefix) {
+        std::string bound(prefix);
+        bound.back() = static_cast<char>('/' + 1);
+        return bound;
+    }
+
+    /**
+     * @brief Tells whether `path` is `directory` itself or one of its descendants.
+     */
+    inline bool isInSubtree(std::string_view path, std::string_view directory) {
+        if (path == directory) {
+            return true;
+        }
+        const auto prefix = subtreePrefix(directory);
+        return path.starts_with(prefix);
+    }
+
+    /**
+     * @brief Returns the canonical form of `path`.
+     *
+     * The result is absolute, has no empty, "." or ".." segment and no trailing '/', except for
+     * the root "/" itself. ".." never climbs above the root.
+     */
+    inline std::string normalizePath(std::string_view path) {
+        std::string result;
+        result.reserve(path.size() + 1);
+        while (!path.empty()) {
+            const auto slash = path.find('/');
+            const auto segment = path.substr(0, slash);
+            path.remove_prefix(slash == std::string_view::npos ? path.size() : slash + 1);
+            if (segment.empty() || segment == ".") {
+                continue;
+            }
+            if (segment == "..") {
+                result.resize(result.empty() ? 0 : result.rfind('/'));
+                continue;
+            }
+            result.push_back('/');
+            result.append(segment);
+        }
+        return result.empty() ? std::string("/") : result;
+    }
+
+    /**
+     * @brief Re-roots `path`, which lies in the subtree of `from`, under `to`.
+     */
+    inline std::string reparentPath(std::string_view path, std::string_view from, std::string_view to) {
+        if (path == from) {
+            return std::string(to);
+        }
+        auto result = subtreePrefix(to);
+        result.append(path.substr(subtreePrefix(from).size()));
+        return result;
+    }
+}
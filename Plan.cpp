@@ -1,57 +1,1403 @@
 #include "Plan.h"
+#include "BinaryIO.h"
+#include "CompressedLayer.h"
+#include "IoBackend.h"
+#include "PathUtils.h"
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <spanstream>
+#include <stdexcept>
+#include <unordered_set>
 #include <utility>
 
 using namespace Dualys;
 
 
+namespace {
+    constexpr std::uint32_t kPlanFileMagic = 0x4e414c50; // "PLAN"
+    // Version 2 adds the state digest and the table of layer sizes, for Plan::loadLazily();
+    // version 3 stores the layers as CompressedLayer instead of ColumnarLayer; version 4 adds the
+    // path filter after the table of layer sizes; version 5 stores digests that tell the encodings
+    // of content hashes apart, which the earlier ones do not.
+    constexpr std::uint32_t kPlanFileVersion = 5;
+    constexpr std::uint32_t kPlanFileVersionWithFilter = 4;
+    constexpr std::uint32_t kPlanFileVersionCompressed = 3;
+    constexpr std::uint32_t kPlanFileVersionWithoutDigest = 1;
+
+    /**
+     * Reads the header of a plan file of any supported version.
+     */
+    bool readHeader(std::istream &in, PlanFileHeader &header, std::uint32_t &version) {
+        std::uint32_t magic = 0;
+        std::uint8_t has_base = 0;
+        std::string base_id;
+        if (!in || !readValue(in, magic) || magic != kPlanFileMagic || !readValue(in, version) ||
+            version < kPlanFileVersionWithoutDigest || version > kPlanFileVersion ||
+            !readString(in, header.id) || !readValue(in, has_base) || !readString(in, base_id)) {
+            return false;
+        }
+        if (has_base != 0) {
+            header.base_id = std::move(base_id);
+        }
+        return true;
+    }
+
+    /**
+     * Reads what follows the header up to the layers: the digests (version 2) and the layer count,
+     * the layer sizes (version 2) and the path filter (version 4).
+     */
+    bool readLayerTable(std::istream &in, const std::uint32_t version, StateDigest &base_digest,
+                        StateDigest &local_digest, std::uint32_t &layer_count, std::vector<std::uint64_t> &sizes,
+                        std::optional<PathFilter> &path_filter) {
+        if (version == kPlanFileVersionWithoutDigest) {
+            return readValue(in, layer_count);
+        }
+        if (!readValue(in, base_digest) || !readValue(in, local_digest) || !readValue(in, layer_count) ||
+            !readColumn(in, sizes, layer_count)) {
+            return false;
+        }
+        if (version >= kPlanFileVersionWithFilter) {
+            path_filter = PathFilter::readFrom(in);
+            return path_filter.has_value();
+        }
+        return true;
+    }
+
+    /**
+     * Reads a layer in the encoding of the file `version`.
+     */
+    std::optional<Layer> readLayer(std::istream &in, const std::uint32_t version) {
+        if (version >= kPlanFileVersionCompressed) {
+            const auto layer = CompressedLayer::readFrom(in);
+            return layer ? layer->toLayer() : std::nullopt;
+        }
+        const auto layer = ColumnarLayer::readFrom(in);
+        return layer ? std::optional(layer->toLayer()) : std::nullopt;
+    }
+
+    /**
+     * Approximate memory held by a decoded layer and its entries in a path index.
+     */
+    std::size_t residentSize(const Layer &layer) {
+        std::size_t bytes = sizeof(Layer) + layer.id.size();
+        for (const auto &change: layer.changes) {
+            bytes += sizeof(FileChange) + change.path.size() + change.new_content_hash.size() +
+                    change.target_path.size() + 4 * sizeof(void *) + sizeof(ChangeRef);
+        }
+        return bytes;
+    }
+
+    /**
+     * Returns the half-open range holding the strict descendants of `directory` in a sorted state.
+     */
+    std::pair<FileSystemState::iterator, FileSystemState::iterator> descendantRange(FileSystemState &state,
+                                                                                    const std::string &directory) {
+        const auto prefix = subtreePrefix(directory);
+        return {state.lower_bound(prefix), state.lower_bound(subtreeUpperBound(prefix))};
+    }
+
+    /**
+     * Erases `directory` and its descendants in O(log n + k).
+     */
+    void eraseSubtree(FileSystemState &state, const std::string &directory) {
+        state.erase(directory);
+        const auto [first, last] = descendantRange(state, directory);
+        state.erase(first, last);
+    }
+
+    /**
+     * Re-keys `from` and its descendants under `to`, replacing the previous content of `to`.
+     *
+     * Nodes are extracted and re-inserted rather than copied, so entries are never reallocated;
+     * the moved keys stay sorted, which makes each hinted insertion amortized O(1).
+     */
+    void moveSubtree(FileSystemState &state, const std::string &from, const std::string &to) {
+        if (from == to || isInSubtree(to, from)) {
+            return;
+        }
+        std::vector<FileSystemState::node_type> nodes;
+        if (auto node = state.extract(from)) {
+            nodes.push_back(std::move(node));
+        }
+        for (auto [it, last] = descendantRange(state, from); it != last;) {
+            nodes.push_back(state.extract(it++));
+        }
+        eraseSubtree(state, to);
+
+        auto hint = state.lower_bound(to);
+        for (auto &node: nodes) {
+            node.key() = reparentPath(node.key(), from, to);
+            hint = std::next(state.insert(hint, std::move(node)));
+        }
+    }
+
+    /**
+     * Checks the precondition of `change` given the entry currently at its path.
+     * `target` resolves the entry currently at the target of a move.
+     */
+    template<typename ResolveTarget>
+    std::optional<LayerViolation::Reason> checkChange(const FileChange &change, const std::optional<FileEntry> &entry,
+                                                      const ResolveTarget &target) {
+        using Reason = LayerViolation::Reason;
+        switch (change.type) {
+            case ChangeType::ADDED:
+                return entry ? std::optional(Reason::PATH_EXISTS) : std::nullopt;
+
+            case ChangeType::MODIFIED:
+            case ChangeType::REMOVED:
+            case ChangeType::PERMISSION_CHANGED:
+                return entry ? std::nullopt : std::optional(Reason::PATH_MISSING);
+
+            case ChangeType::DIRECTORY_REMOVED:
+            case ChangeType::DIRECTORY_MOVED:
+                break;
+        }
+        if (!entry || entry->metadata.type != FileType::DIRECTORY) {
+            return Reason::NOT_A_DIRECTORY;
+        }
+        if (change.type == ChangeType::DIRECTORY_MOVED) {
+            if (isInSubtree(change.target_path, change.path)) {
+                return Reason::MOVE_INTO_ITSELF;
+            }
+            if (target(change.target_path)) {
+                return Reason::TARGET_EXISTS;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * Bumped each time a layer is applied to any plan: a digest computed since is still current.
+     */
+    std::atomic<std::uint64_t> &layerEpoch() {
+        static std::atomic<std::uint64_t> epoch{1};
+        return epoch;
+    }
+
+    /**
+     * Number of subtree changes in a plan's layers above which getStateDigest() digests its state
+     * rather than folding subtree changes in from the path indexes.
+     */
+    constexpr std::size_t kMaxFoldedSubtreeChanges = 32;
+
+    /**
+     * Position after every change of a plan.
+     */
+    constexpr ChangeRef kEndOfLayers{std::numeric_limits<std::uint32_t>::max(), 0};
+
+    /**
+     * Tells whether the subtree of `directory` is within one of `directories`.
+     */
+    bool isCovered(const std::vector<std::string> &directories, const std::string_view directory) {
+        return std::ranges::any_of(directories, [directory](const std::string &covering) {
+            return isInSubtree(directory, covering);
+        });
+    }
+
+    /**
+     * Calls `visit` with each path of `paths` in the subtree of `directory`, the directory included.
+     */
+    template<typename Visit>
+    void forEachInSubtree(const std::set<std::string, std::less<> > &paths, const std::string_view directory,
+                          const Visit &visit) {
+        const auto prefix = subtreePrefix(directory);
+        if (prefix != directory && paths.contains(directory)) {
+            visit(*paths.find(directory));
+        }
+        const auto end = paths.lower_bound(subtreeUpperBound(prefix));
+        for (auto path = paths.lower_bound(prefix); path != end; ++path) {
+            visit(*path);
+        }
+    }
+}
+
+
+/**
+ * The encoded layers of a lazily loaded plan, and whether the plan currently holds them decoded.
+ */
+struct Plan::LazyLayers final : LayerResidency::Resident {
+    const Plan &plan;
+    LayerResidency &residency;
+    std::shared_ptr<const MappedFile> file;
+    std::uint32_t version;
+    std::vector<std::span<const char> > layers;
+
+    std::mutex mutex;
+    bool resident = false;
+    std::size_t pins = 0;
+
+    // Compressed layers opened in place for lookups that leave the plan cold, on the first one.
+    bool opened = false;
+    bool cold_lookups = false;
+    std::vector<CompressedLayer> compressed;
+
+    LazyLayers(const Plan &plan, LayerResidency &residency, std::shared_ptr<const MappedFile> file,
+               const std::uint32_t version, std::vector<std::span<const char> > layers)
+        : plan(plan), residency(residency), file(std::move(file)), version(version), layers(std::move(layers)) {
+    }
+
+    ~LazyLayers() override {
+        residency.forget(*this);
+    }
+
+    /**
+     * Decodes the layers and indexes them; `mutex` must be held.
+     */
+    void fault() {
+        std::size_t bytes = 0;
+        plan.m_layers.reserve(layers.size());
+        for (const auto &encoded: layers) {
+            std::ispanstream in(encoded);
+            auto layer = readLayer(in, version);
+            if (!layer) {
+                drop();
+                throw std::runtime_error("Plan '" + plan.m_id + "': a layer of its file no longer decodes");
+            }
+            auto decoded = std::make_shared<const Layer>(std::move(*layer));
+            plan.m_path_index.add(*decoded, static_cast<std::uint32_t>(plan.m_layers.size()));
+            bytes += residentSize(*decoded);
+            plan.m_layers.push_back(std::move(decoded));
+        }
+        resident = true;
+        residency.admit(*this, bytes);
+    }
+
+    void drop() {
+        // The index refers to the layers: it goes first.
+        plan.m_path_index = PathIndex();
+        std::vector<std::shared_ptr<const Layer> >().swap(plan.m_layers);
+        resident = false;
+    }
+
+    /**
+     * Resolves `path` from the compressed layers, decompressing one block of each, without faulting
+     * them in. Returns std::nullopt when the plan cannot be read this way: its layers are resident
+     * (the index is faster), are not compressed, or hold subtree changes.
+     */
+    std::optional<std::optional<FileEntry> > lookupCold(const std::string_view path) {
+        {
+            std::lock_guard lock(mutex);
+            if (resident || version < kPlanFileVersionCompressed) {
+                return std::nullopt;
+            }
+            if (!opened) {
+                opened = true;
+                cold_lookups = true;
+                for (const auto &encoded: layers) {
+                    auto layer = CompressedLayer::open(encoded, file);
+                    if (!layer || layer->hasDirectoryChanges()) {
+                        cold_lookups = false;
+                        compressed.clear();
+                        break;
+                    }
+                    compressed.push_back(std::move(*layer));
+                }
+            }
+            if (!cold_lookups) {
+                return std::nullopt;
+            }
+        }
+
+        std::vector<FileChange> changes;
+        for (const auto &layer: compressed) {
+            auto found = layer.find(path);
+            if (!found) {
+                return std::nullopt;
+            }
+            for (auto &[index, change]: *found) {
+                changes.push_back(std::move(change));
+            }
+        }
+        // As PathIndex::resolve() without subtree changes: the last ADDED or REMOVED determines the
+        // entry, or the base does; the updates after it apply on top.
+        const auto determining = std::ranges::find_if(changes.rbegin(), changes.rend(), [](const FileChange &change) {
+            return change.type == ChangeType::ADDED || change.type == ChangeType::REMOVED;
+        });
+        std::optional<FileEntry> entry;
+        auto first = changes.begin();
+        if (determining == changes.rend()) {
+            entry = plan.m_base_plan ? plan.m_base_plan->lookup(path) : std::nullopt;
+        } else {
+            first = std::prev(determining.base());
+        }
+        for (; first != changes.end(); ++first) {
+            PathIndex::updateEntry(entry, *first);
+        }
+        return entry;
+    }
+
+    bool tryEvict() override {
+        std::unique_lock lock(mutex, std::try_to_lock);
+        if (!lock || pins > 0) {
+            return false;
+        }
+        drop();
+        return true;
+    }
+};
+
+/**
+ * Materialized state of a plan, and views derived from it, maintained layer by layer.
+ */
+struct Plan::Materialized {
+    PathTrie state;
+
+    // What the state was built from: it is stale once the plan's layer count differs, or a layer
+    // was applied to a plan of the base chain since.
+    bool built = false;
+    std::size_t layer_count = 0;
+
+    // Attached to the feed of every plan of the base chain: holds at most one event, and counts
+    // the others as dropped, so that checking for a change costs two atomic loads.
+    std::shared_ptr<Subscription> base_changes;
+    std::uint64_t base_changes_dropped = 0;
+
+    std::vector<std::shared_ptr<StateView> > views;
+
+    ~Materialized() {
+        if (base_changes) {
+            base_changes->cancel();
+        }
+    }
+
+    bool isCurrent(const std::size_t plan_layer_count) const {
+        return built && layer_count == plan_layer_count && !hasBaseChanged();
+    }
+
+    bool hasBaseChanged() const {
+        return base_changes && (base_changes->pending() > 0 || base_changes->dropped() != base_changes_dropped);
+    }
+
+    /**
+     * Forgets the changes of the base seen so far, once the state is read again from the chain.
+     */
+    void acknowledgeBaseChanges() {
+        if (base_changes) {
+            base_changes->poll();
+            base_changes_dropped = base_changes->dropped();
+        }
+    }
+
+    void rebuild(PathTrie new_state, const std::size_t new_layer_count) {
+        state = std::move(new_state);
+        built = true;
+        layer_count = new_layer_count;
+        for (const auto &view: views) {
+            view->reset(state);
+        }
+    }
+
+    void apply(const Layer &layer) {
+        for (const auto &change: layer.changes) {
+            apply(change);
+        }
+        ++layer_count;
+    }
+
+    void apply(const FileChange &change) {
+        if (!isDirectoryChange(change.type)) {
+            const auto *existing = state.find(change.path);
+            const auto before = existing ? std::optional(*existing) : std::nullopt;
+            auto after = before;
+            PathIndex::updateEntry(after, change);
+            if (after == before) {
+                return;
+            }
+            if (after) {
+                state.assign(change.path, *after);
+            } else {
+                state.erase(change.path);
+            }
+            notify(change.path, before ? &*before : nullptr, after ? &*after : nullptr);
+            return;
+        }
+
+        // The trie is persistent: keeping the previous state costs O(1), and the affected subtrees
+        // are compared before and after the change.
+        const auto previous = state;
+        state.apply(change);
+        if (views.empty()) {
+            return;
+        }
+        if (change.type == ChangeType::DIRECTORY_REMOVED || isInSubtree(change.target_path, change.path)) {
+            notifySubtree(previous, change.path);
+        } else if (isInSubtree(change.path, change.target_path)) {
+            notifySubtree(previous, change.target_path);
+        } else {
+            notifySubtree(previous, change.path);
+            notifySubtree(previous, change.target_path);
+        }
+    }
+
+    /**
+     * Reports the entries of the subtree of `directory` that differ between `previous` and the state.
+     */
+    void notifySubtree(const PathTrie &previous, const std::string &directory) {
+        const auto before = subtreeEntries(previous, directory);
+        const auto after = subtreeEntries(state, directory);
+        auto lhs = before.begin();
+        auto rhs = after.begin();
+        while (lhs != before.end() || rhs != after.end()) {
+            if (rhs == after.end() || (lhs != before.end() && lhs->first < rhs->first)) {
+                notify(lhs->first, &lhs->second, nullptr);
+                ++lhs;
+            } else if (lhs == before.end() || rhs->first < lhs->first) {
+                notify(rhs->first, nullptr, &rhs->second);
+                ++rhs;
+            } else {
+                if (lhs->second != rhs->second) {
+                    notify(lhs->first, &lhs->second, &rhs->second);
+                }
+                ++lhs;
+                ++rhs;
+            }
+        }
+    }
+
+    static FileSystemState subtreeEntries(const PathTrie &trie, const std::string &directory) {
+        FileSystemState entries;
+        if (const auto *entry = trie.find(directory)) {
+            entries.emplace(directory, *entry);
+        }
+        trie.forEachWithPrefix(subtreePrefix(directory), [&entries](const std::string &path, const FileEntry &entry) {
+            entries.emplace_hint(entries.end(), path, entry);
+        });
+        return entries;
+    }
+
+    void notify(const std::string_view path, const FileEntry *before, const FileEntry *after) const {
+        for (const auto &view: views) {
+            view->update(path, before, after);
+        }
+    }
+};
+
+Plan::ResidentPin::ResidentPin(LazyLayers *lazy) : m_lazy(lazy) {
+}
+
+Plan::ResidentPin::~ResidentPin() {
+    if (!m_lazy) {
+        return;
+    }
+    bool released = false;
+    {
+        std::lock_guard lock(m_lazy->mutex);
+        released = --m_lazy->pins == 0;
+    }
+    // A walk down the base chain pins every plan on the way: the budget is enforced afterwards.
+    if (released) {
+        m_lazy->residency.trim();
+    }
+}
+
+Plan::ResidentPin Plan::pin() const {
+    if (!m_lazy) {
+        return ResidentPin(nullptr);
+    }
+    std::lock_guard lock(m_lazy->mutex);
+    if (!m_lazy->resident) {
+        m_lazy->fault();
+    } else {
+        m_lazy->residency.touch(*m_lazy);
+    }
+    ++m_lazy->pins;
+    return ResidentPin(m_lazy.get());
+}
+
+void Plan::detachLazyLayers() {
+    if (!m_lazy) {
+        return;
+    }
+    {
+        std::lock_guard lock(m_lazy->mutex);
+        if (!m_lazy->resident) {
+            m_lazy->fault();
+        }
+        // No longer listed, the layers cannot be evicted any more.
+        m_lazy->residency.forget(*m_lazy);
+    }
+    m_lazy.reset();
+}
+
 Plan::Plan(std::string id, std::shared_ptr<const Plan> base)
     : m_id(std::move(id)), m_base_plan(std::move(base)) {
+    if (m_base_plan) {
+        m_base_digest = m_base_plan->getStateDigest();
+    }
 }
 
+Plan::~Plan() = default;
+
 const std::string &Plan::getId() const {
     return m_id;
 }
 
-void Plan::applyLayer(const Layer &new_layer) {
-    m_layers.push_back(new_layer);
+const std::shared_ptr<const Plan> &Plan::getBasePlan() const {
+    return m_base_plan;
+}
+
+std::vector<std::shared_ptr<const Layer> > Plan::getLayers() const {
+    // Copied while pinned: releasing the pin may evict the plan's layers.
+    const auto pinned = pin();
+    return m_layers;
+}
+
+bool Plan::applyLayer(const Layer &new_layer) {
+    return applyLayer(std::make_shared<const Layer>(new_layer));
+}
+
+bool Plan::applyLayer(std::shared_ptr<const Layer> new_layer) {
+    if (m_strict_validation && !validateLayer(*new_layer).empty()) {
+        return false;
+    }
+    try {
+        appendLayer(std::move(new_layer));
+    } catch (...) {
+        // The layer may be applied already, if publishing it failed.
+        m_version.store(m_layers.size(), std::memory_order_release);
+        publishSnapshot();
+        throw;
+    }
+    m_version.store(m_layers.size(), std::memory_order_release);
+    publishSnapshot();
+    return true;
+}
+
+struct Plan::WriteRequest {
+    std::shared_ptr<const Layer> layer;
+    std::optional<std::uint64_t> expected_version;
+    ApplyResult result;
+    std::exception_ptr error;
+    WriteRequest *next = nullptr;
+    std::atomic<bool> done{false};
+};
+
+std::uint64_t Plan::version() const {
+    return m_version.load(std::memory_order_acquire);
+}
+
+ApplyResult Plan::tryApplyLayer(const std::uint64_t expected_version, std::shared_ptr<const Layer> new_layer) {
+    WriteRequest request;
+    request.layer = std::move(new_layer);
+    request.expected_version = expected_version;
+    return submitWrite(request);
+}
+
+ApplyResult Plan::applyLayerConcurrently(std::shared_ptr<const Layer> new_layer) {
+    WriteRequest request;
+    request.layer = std::move(new_layer);
+    return submitWrite(request);
+}
+
+ApplyResult Plan::submitWrite(WriteRequest &request) {
+    request.next = m_pending_writes.load(std::memory_order_relaxed);
+    while (!m_pending_writes.compare_exchange_weak(request.next, &request)) {
+    }
+    while (!request.done.load(std::memory_order_acquire)) {
+        if (!m_combining.exchange(true)) {
+            // A request pushed after the last batch was taken, by a writer that saw the flag set,
+            // is found by the check that follows its release: some writer combines it.
+            do {
+                combineWrites();
+                m_combining.store(false);
+            } while (m_pending_writes.load() && !m_combining.exchange(true));
+            continue;
+        }
+        const auto batches = m_combined_batches.load(std::memory_order_acquire);
+        if (request.done.load(std::memory_order_acquire)) {
+            break;
+        }
+        m_combined_batches.wait(batches, std::memory_order_acquire);
+    }
+    if (request.error) {
+        std::rethrow_exception(request.error);
+    }
+    return request.result;
+}
+
+void Plan::combineWrites() {
+    while (auto *pending = m_pending_writes.exchange(nullptr)) {
+        // Taken most recent first: reversed, so that layers are applied in arrival order.
+        WriteRequest *batch = nullptr;
+        while (pending) {
+            auto *next = pending->next;
+            pending->next = batch;
+            batch = pending;
+            pending = next;
+        }
+        auto version = m_version.load(std::memory_order_relaxed);
+        for (auto *request = batch; request; request = request->next) {
+            try {
+                if (request->expected_version && *request->expected_version != version) {
+                    request->result = {ApplyResult::Status::CONFLICT, version};
+                } else if (m_strict_validation && !validateLayer(*request->layer).empty()) {
+                    request->result = {ApplyResult::Status::REJECTED, version};
+                } else {
+                    appendLayer(std::move(request->layer));
+                    request->result = {ApplyResult::Status::APPLIED, ++version};
+                }
+            } catch (...) {
+                // The layer may be applied already, if publishing it failed.
+                version = m_layers.size();
+                request->error = std::current_exception();
+            }
+        }
+        // One publication for the whole batch, before its writers return.
+        m_version.store(version, std::memory_order_release);
+        publishSnapshot();
+        while (batch) {
+            // The writer may return as soon as its request is done: it is not touched afterwards.
+            auto *next = batch->next;
+            batch->done.store(true, std::memory_order_release);
+            batch = next;
+        }
+        m_combined_batches.fetch_add(1, std::memory_order_release);
+        m_combined_batches.notify_all();
+    }
+}
+
+void Plan::appendLayer(std::shared_ptr<const Layer> new_layer) {
+    detachLazyLayers();
+    const auto layer_index = static_cast<std::uint32_t>(m_layers.size());
+    // The layers and the index change together: a failure leaves both as they were.
+    try {
+        m_path_index.add(*new_layer, layer_index);
+        m_layers.push_back(new_layer);
+    } catch (...) {
+        m_path_index.remove(*new_layer, layer_index);
+        throw;
+    }
+    layerEpoch().fetch_add(1, std::memory_order_release);
+
+    // From here on the layer is applied. A derived structure that fails is dropped rather than
+    // left half updated, to be built again by the next layer or enableMaterializedView(); the
+    // layer is still published, then the first failure is rethrown.
+    std::exception_ptr error;
+    try {
+        // Grown by rebuilding at twice the distinct paths, so its false positive rate stays bounded.
+        const auto paths = m_path_index.size() + 2 * m_path_index.directoryEvents().size();
+        if (!m_path_filter || m_path_filter->capacity() < paths) {
+            m_path_filter.emplace(2 * paths);
+            for (const auto &layer: m_layers) {
+                m_path_filter->add(*layer);
+            }
+        } else {
+            m_path_filter->add(*m_layers.back());
+        }
+    } catch (...) {
+        m_path_filter.reset();
+        error = std::current_exception();
+    }
+    if (m_materialized) {
+        try {
+            updateMaterialized(*m_layers.back());
+        } catch (...) {
+            m_materialized->built = false;
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    if (m_change_feed && !m_change_feed->empty()) {
+        m_change_feed->publish({m_id, layer_index, m_layers.back(), getStateDigest()});
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+ChangeFeed &Plan::changeFeed() const {
+    if (!m_change_feed) {
+        m_change_feed = std::make_unique<ChangeFeed>();
+    }
+    return *m_change_feed;
+}
+
+std::shared_ptr<Subscription> Plan::subscribe(const SubscriptionOptions options) {
+    return changeFeed().subscribe(options);
+}
+
+void Plan::subscribe(const std::shared_ptr<Subscription> &subscription) {
+    changeFeed().attach(subscription);
+}
+
+void Plan::unsubscribe(const Subscription &subscription) {
+    if (m_change_feed) {
+        m_change_feed->detach(subscription);
+    }
+}
+
+void Plan::updateMaterialized(const Layer &layer) {
+    if (m_materialized->built && !m_materialized->hasBaseChanged()
+        && m_materialized->layer_count + 1 == m_layers.size()) {
+        m_materialized->apply(layer);
+        return;
+    }
+    // Stale, the base changed: getFileSystemTrie() ignores the view and replays the chain.
+    rebuildMaterialized();
+}
+
+const PathTrie *Plan::materializedState() const {
+    return isMaterializedViewCurrent() ? &m_materialized->state : nullptr;
+}
+
+bool Plan::isMaterializedViewCurrent() const {
+    return m_materialized && m_materialized->isCurrent(m_layers.size());
+}
+
+void Plan::enableMaterializedView() {
+    detachLazyLayers();
+    if (isMaterializedViewCurrent()) {
+        return;
+    }
+    if (!m_materialized) {
+        m_materialized = std::make_unique<Materialized>();
+        if (m_base_plan) {
+            SubscriptionOptions options;
+            options.capacity = 1;
+            options.backpressure = Backpressure::RESYNC;
+            m_materialized->base_changes = std::make_shared<Subscription>(options);
+            for (const auto *plan = m_base_plan.get(); plan; plan = plan->m_base_plan.get()) {
+                plan->changeFeed().attach(m_materialized->base_changes);
+            }
+        }
+    }
+    rebuildMaterialized();
+    publishSnapshot();
+}
+
+void Plan::rebuildMaterialized() {
+    // Read while the view is still seen as stale, so that getFileSystemTrie() replays the chain.
+    auto state = getFileSystemTrie();
+    m_materialized->acknowledgeBaseChanges();
+    m_materialized->rebuild(std::move(state), m_layers.size());
+}
+
+void Plan::disableMaterializedView() {
+    m_materialized.reset();
+    m_snapshot.store(nullptr, std::memory_order_release);
+}
+
+std::shared_ptr<const PlanSnapshot> Plan::snapshot() const {
+    return m_snapshot.load(std::memory_order_acquire);
+}
+
+void Plan::publishSnapshot() {
+    if (!isMaterializedViewCurrent()) {
+        m_snapshot.store(nullptr, std::memory_order_release);
+        return;
+    }
+    // The trie is persistent: the copy is O(1) and later layers do not modify it.
+    m_snapshot.store(std::make_shared<const PlanSnapshot>(m_layers.size(), m_materialized->state),
+                     std::memory_order_release);
+}
+
+bool Plan::hasMaterializedView() const {
+    return m_materialized != nullptr;
+}
+
+void Plan::attachView(std::shared_ptr<StateView> view) {
+    enableMaterializedView();
+    view->reset(m_materialized->state);
+    m_materialized->views.push_back(std::move(view));
+}
+
+void Plan::detachView(const StateView &view) {
+    if (m_materialized) {
+        std::erase_if(m_materialized->views, [&view](const std::shared_ptr<StateView> &attached) {
+            return attached.get() == &view;
+        });
+    }
+}
+
+void Plan::updateDigest(const Layer &layer, const std::uint32_t layer_index) const {
+    PathSet paths;
+    for (std::uint32_t i = 0; i < layer.changes.size(); ++i) {
+        const auto &change = layer.changes[i];
+        const ChangeRef position{layer_index, i};
+        if (!isDirectoryChange(change.type)) {
+            const auto before = lookupBefore(change.path, position);
+            auto after = before;
+            PathIndex::updateEntry(after, change);
+            if (before) {
+                m_local_digest -= StateDigest::of(change.path, *before);
+            }
+            if (after) {
+                m_local_digest += StateDigest::of(change.path, *after);
+            }
+            continue;
+        }
+        paths.clear();
+        collectChangedPaths(change, position, paths);
+        for (const auto &path: paths) {
+            const auto before = lookupBefore(path, position);
+            const auto after = lookupBefore(path, {layer_index, i + 1});
+            if (before == after) {
+                continue;
+            }
+            if (before) {
+                m_local_digest -= StateDigest::of(path, *before);
+            }
+            if (after) {
+                m_local_digest += StateDigest::of(path, *after);
+            }
+        }
+    }
+}
+
+void Plan::rebaseDigest(const StateDigest &base_digest) const {
+    // The state differs from the base only at the paths the layers write and in the subtrees of
+    // their subtree changes.
+    PathSet paths;
+    m_path_index.forEachPath([&paths](const std::string_view path) {
+        paths.emplace(path);
+    });
+    for (const auto ref: m_path_index.directoryEvents()) {
+        collectChangedPaths(m_layers[ref.layer]->changes[ref.change], ref, paths);
+    }
+    m_base_digest = base_digest;
+    m_local_digest = StateDigest();
+    for (const auto &path: paths) {
+        const auto before = m_base_plan ? m_base_plan->lookup(path) : std::nullopt;
+        const auto after = lookupBefore(path, kEndOfLayers);
+        if (before == after) {
+            continue;
+        }
+        if (before) {
+            m_local_digest -= StateDigest::of(path, *before);
+        }
+        if (after) {
+            m_local_digest += StateDigest::of(path, *after);
+        }
+    }
+    m_digested_layers = m_layers.size();
+}
+
+void Plan::collectChangedPaths(const FileChange &change, const ChangeRef position, PathSet &paths) const {
+    switch (change.type) {
+        case ChangeType::DIRECTORY_REMOVED:
+            collectSubtreePaths({change.path}, position, paths);
+            return;
+        case ChangeType::DIRECTORY_MOVED: {
+            if (change.path == change.target_path || isInSubtree(change.target_path, change.path)) {
+                return;
+            }
+            PathSet moved;
+            collectSubtreePaths({change.path, change.target_path}, position, moved);
+            for (const auto &path: moved) {
+                if (isInSubtree(path, change.path)) {
+                    paths.insert(reparentPath(path, change.path, change.target_path));
+                }
+            }
+            paths.merge(moved);
+            return;
+        }
+        default:
+            paths.insert(change.path);
+    }
+}
+
+void Plan::collectSubtreePaths(const std::vector<std::string> &directories, const ChangeRef before,
+                               PathSet &paths) const {
+    const auto pinned = pin();
+    const auto events = m_path_index.directoryEvents();
+    const auto end = std::ranges::lower_bound(events, before);
+
+    // Walking the subtree changes backwards, the directories whose content may end up in
+    // `directories`: the sources of the moves into them, recursively.
+    auto involved = directories;
+    const auto overlaps = [&involved](const std::string_view path) {
+        return std::ranges::any_of(involved, [path](const std::string &directory) {
+            return isInSubtree(path, directory) || isInSubtree(directory, path);
+        });
+    };
+    std::vector<ChangeRef> relevant;
+    for (auto event = end; event != events.begin();) {
+        --event;
+        const auto &change = m_layers[event->layer]->changes[event->change];
+        if (change.type == ChangeType::DIRECTORY_MOVED &&
+            (change.path == change.target_path || isInSubtree(change.target_path, change.path))) {
+            continue;
+        }
+        const bool into = change.type == ChangeType::DIRECTORY_MOVED && overlaps(change.target_path);
+        if (!into && !overlaps(change.path)) {
+            continue;
+        }
+        relevant.push_back(*event);
+        if (into) {
+            for (std::size_t i = 0, count = involved.size(); i < count; ++i) {
+                auto source = isInSubtree(involved[i], change.target_path)
+                                  ? reparentPath(involved[i], change.target_path, change.path)
+                                  : change.path;
+                if ((isInSubtree(involved[i], change.target_path) || isInSubtree(change.target_path, involved[i])) &&
+                    !isCovered(involved, source)) {
+                    involved.push_back(std::move(source));
+                }
+            }
+        }
+    }
+
+    // The paths holding an entry before the layers, and those the layers write.
+    PathSet listed;
+    if (m_base_plan) {
+        m_base_plan->collectSubtreePaths(involved, kEndOfLayers, listed);
+    }
+    for (const auto &directory: involved) {
+        m_path_index.forEachPathInSubtree(directory, [&listed](const std::string_view path) {
+            listed.emplace(path);
+        });
+    }
+
+    // Then the subtree changes replayed forward. A path they empty is kept if a later change writes it.
+    const auto erase_subtree = [&](const std::string &directory, const ChangeRef position) {
+        std::vector<std::string> erased;
+        forEachInSubtree(listed, directory, [&](const std::string &path) {
+            const auto write = m_path_index.lastWrite(path, before);
+            if (!write || *write < position) {
+                erased.push_back(path);
+            }
+        });
+        for (const auto &path: erased) {
+            listed.erase(path);
+        }
+    };
+    std::vector<std::string> moved;
+    for (auto ref = relevant.rbegin(); ref != relevant.rend(); ++ref) {
+        const auto &change = m_layers[ref->layer]->changes[ref->change];
+        if (change.type == ChangeType::DIRECTORY_REMOVED) {
+            erase_subtree(change.path, *ref);
+            continue;
+        }
+        moved.clear();
+        forEachInSubtree(listed, change.path, [&](const std::string &path) {
+            moved.push_back(reparentPath(path, change.path, change.target_path));
+        });
+        erase_subtree(change.target_path, *ref);
+        erase_subtree(change.path, *ref);
+        listed.insert(moved.begin(), moved.end());
+    }
+    for (const auto &directory: directories) {
+        forEachInSubtree(listed, directory, [&paths](const std::string &path) {
+            paths.insert(path);
+        });
+    }
+}
+
+void Plan::setStrictValidation(const bool strict) {
+    m_strict_validation = strict;
+}
+
+bool Plan::isStrictValidation() const {
+    return m_strict_validation;
+}
+
+std::vector<LayerViolation> Plan::validateLayer(const Layer &layer) const {
+    // The layer is indexed on its own so that each change sees the preceding ones, then the plan.
+    PathIndex pending;
+    pending.add(layer, 0);
+    const auto change_at = [&layer](const ChangeRef ref) -> const FileChange & {
+        return layer.changes[ref.change];
+    };
+    const auto current = [this](const std::string &path) {
+        return lookup(path);
+    };
+
+    std::vector<LayerViolation> violations;
+    for (std::uint32_t i = 0; i < layer.changes.size(); ++i) {
+        const auto &change = layer.changes[i];
+        const ChangeRef position{0, i};
+        const auto entry = pending.resolve(change.path, position, change_at, current);
+        const auto target = [&](const std::string &path) {
+            return pending.resolve(path, position, change_at, current).has_value();
+        };
+        if (const auto reason = checkChange(change, entry, target)) {
+            violations.push_back({i, change.path, change.type, *reason});
+        }
+    }
+    return violations;
+}
+
+std::optional<FileEntry> Plan::lookup(const std::string_view path) const {
+    const auto hash = PathFilter::hash(path);
+    const Plan *plan = this;
+    while (plan && !plan->mayChange(path, hash)) {
+        plan = plan->m_base_plan.get();
+    }
+    return plan ? plan->lookupFrom(path) : std::nullopt;
+}
+
+bool Plan::mayChange(const std::string_view path, const std::uint64_t hash) const {
+    return !m_path_filter || m_path_filter->mayAffect(path, hash);
+}
+
+std::optional<FileEntry> Plan::lookupFrom(const std::string_view path) const {
+    if (m_lazy) {
+        if (auto entry = m_lazy->lookupCold(path)) {
+            return *entry;
+        }
+    }
+    const auto pinned = pin();
+    return lookupBefore(path, ChangeRef{static_cast<std::uint32_t>(m_layers.size()), 0});
+}
+
+std::optional<FileEntry> Plan::lookupBefore(const std::string_view path, const ChangeRef before) const {
+    return m_path_index.resolve(
+        std::string(path), before,
+        [this](const ChangeRef ref) -> const FileChange & {
+            return m_layers[ref.layer]->changes[ref.change];
+        },
+        [this](const std::string &source) {
+            return m_base_plan ? m_base_plan->lookup(source) : std::optional<FileEntry>();
+        });
+}
+
+StateDigest Plan::getStateDigest() const {
+    std::lock_guard lock(m_digest_mutex);
+    const auto epoch = layerEpoch().load(std::memory_order_acquire);
+    if (m_digest_epoch == epoch) {
+        return m_base_digest + m_local_digest;
+    }
+    const auto base_digest = m_base_plan ? m_base_plan->getStateDigest() : StateDigest();
+    // The layers of a lazily loaded plan are all folded in its stored digest.
+    if (base_digest != m_base_digest || (!m_lazy && m_digested_layers < m_layers.size())) {
+        const auto pinned = pin();
+        // Listing a subtree replays the earlier subtree changes: past a few dozen, digesting the
+        // whole state once costs less than folding them in.
+        const auto events = m_path_index.directoryEvents();
+        if (events.size() > kMaxFoldedSubtreeChanges &&
+            (base_digest != m_base_digest || events.back().layer >= m_digested_layers)) {
+            m_base_digest = base_digest;
+            m_local_digest = StateDigest::of(getFileSystemState()) - base_digest;
+            m_digested_layers = m_layers.size();
+        }
+        if (base_digest != m_base_digest) {
+            rebaseDigest(base_digest);
+        }
+        for (; m_digested_layers < m_layers.size(); ++m_digested_layers) {
+            updateDigest(*m_layers[m_digested_layers], static_cast<std::uint32_t>(m_digested_layers));
+        }
+    }
+    m_digest_epoch = epoch;
+    return m_base_digest + m_local_digest;
+}
+
+bool Plan::hasSameState(const Plan &other) const {
+    return getStateDigest() == other.getStateDigest();
 }
 
 std::unique_ptr<Plan> Plan::clone(const std::string &new_id) const {
     const auto self_ptr = shared_from_this();
     auto cloned_plan = std::make_unique<Plan>(new_id, std::const_pointer_cast<const Plan>(self_ptr));
+    cloned_plan->m_strict_validation = m_strict_validation;
     return cloned_plan;
 }
 
-std::map<std::string, std::string> Plan::getFileSystemState() const {
-    std::map<std::string, std::string> currentState;
+FileSystemState Plan::getFileSystemState() const {
+    FileSystemState currentState;
+    if (const auto *materialized = materializedState()) {
+        materialized->forEach([&currentState](const std::string &path, const FileEntry &entry) {
+            currentState.emplace_hint(currentState.end(), path, entry);
+        });
+        return currentState;
+    }
 
     if (m_base_plan) {
         currentState = m_base_plan->getFileSystemState();
     }
 
-    for (const auto &[changes, id]: m_layers) {
-        for (const auto &[path, type, new_content_hash]: changes) {
-            switch (type) {
-                case ChangeType::ADDED:
-                case ChangeType::MODIFIED:
-                    if (new_content_hash.data()) {
-                        currentState[path] = *new_content_hash.data();
-                    }
-                    break;
+    const auto pinned = pin();
+    for (const auto &layer: m_layers) {
+        for (const auto &change: layer->changes) {
+            applyChange(currentState, change);
+        }
+    }
+    return currentState;
+}
 
-                case ChangeType::REMOVED:
-                    currentState.erase(path);
-                    break;
-                case ChangeType::PERMISSION_CHANGED:
-                    break;
-            }
+PathTrie Plan::getFileSystemTrie() const {
+    if (const auto *materialized = materializedState()) {
+        return *materialized;
+    }
+    PathTrie currentState;
+
+    if (m_base_plan) {
+        currentState = m_base_plan->getFileSystemTrie();
+    }
+
+    const auto pinned = pin();
+    for (const auto &layer: m_layers) {
+        for (const auto &change: layer->changes) {
+            currentState.apply(change);
         }
     }
     return currentState;
 }
 
-void Plan::loadFromFile(const char *file_path) {
+void Plan::applyChange(FileSystemState &state, const FileChange &change) {
+    applyChange(state, ChangeRow::of(change));
+}
+
+void Plan::applyChange(FileSystemState &state, const ChangeRow &change) {
+    switch (change.type) {
+        case ChangeType::ADDED:
+            state.insert_or_assign(std::string(change.path), FileEntry{change.metadata, change.digest});
+            break;
+
+        case ChangeType::MODIFIED: {
+            auto [it, inserted] = state.try_emplace(std::string(change.path), FileEntry{change.metadata, {}});
+            it->second.digest = change.digest;
+            it->second.metadata.size = change.metadata.size;
+            break;
+        }
+
+        case ChangeType::REMOVED:
+            state.erase(std::string(change.path));
+            break;
+
+        case ChangeType::PERMISSION_CHANGED:
+            if (const auto it = state.find(std::string(change.path)); it != state.end()) {
+                it->second.metadata.mode = change.metadata.mode;
+                it->second.metadata.uid = change.metadata.uid;
+                it->second.metadata.gid = change.metadata.gid;
+            }
+            break;
+
+        case ChangeType::DIRECTORY_REMOVED:
+            eraseSubtree(state, std::string(change.path));
+            break;
 
+        case ChangeType::DIRECTORY_MOVED:
+            moveSubtree(state, std::string(change.path), std::string(change.target_path));
+            break;
+    }
+}
+
+void Plan::applyChanges(FileSystemState &state, const ColumnarLayerView &layer) {
+    for (std::size_t i = 0; i < layer.size(); ++i) {
+        applyChange(state, layer[i]);
+    }
+}
+
+Layer Plan::diff(const std::string &layer_id, const Plan &from, const Plan &to) {
+    const auto source = from.getFileSystemState();
+    const auto target = to.getFileSystemState();
+
+    Layer layer(layer_id);
+    // Descendant ranges [prefix, upper) already covered by an emitted DIRECTORY_REMOVED.
+    std::vector<std::pair<std::string, std::string> > removed_subtrees;
+    auto lhs = source.begin();
+    auto rhs = target.begin();
+    while (lhs != source.end() || rhs != target.end()) {
+        if (rhs == target.end() || (lhs != source.end() && lhs->first < rhs->first)) {
+            const auto &[path, entry] = *lhs;
+            std::erase_if(removed_subtrees, [&](const auto &range) { return range.second <= path; });
+            if (std::ranges::any_of(removed_subtrees, [&](const auto &range) { return range.first <= path; })) {
+                ++lhs;
+                continue;
+            }
+            // A directory that lost all of its content collapses into a single recursive removal.
+            if (entry.metadata.type == FileType::DIRECTORY) {
+                auto prefix = subtreePrefix(path);
+                auto upper = subtreeUpperBound(prefix);
+                const auto target_descendant = target.lower_bound(prefix);
+                if (target_descendant == target.end() || target_descendant->first >= upper) {
+                    layer.changes.push_back({path, ChangeType::DIRECTORY_REMOVED, {}});
+                    removed_subtrees.emplace_back(std::move(prefix), std::move(upper));
+                    ++lhs;
+                    continue;
+                }
+            }
+            layer.changes.push_back({path, ChangeType::REMOVED, {}});
+            ++lhs;
+        } else if (lhs == source.end() || rhs->first < lhs->first) {
+            layer.changes.push_back({rhs->first, ChangeType::ADDED, rhs->second.digest.str(), rhs->second.metadata});
+            ++rhs;
+        } else {
+            const auto &[path, before] = *lhs;
+            const auto &after = rhs->second;
+            if (before.metadata.type != after.metadata.type) {
+                // A type change replaces the entry; removing it first keeps the layer valid in strict mode.
+                layer.changes.push_back({path, ChangeType::REMOVED, {}});
+                layer.changes.push_back({path, ChangeType::ADDED, after.digest.str(), after.metadata});
+            } else {
+                if (before.digest != after.digest || before.metadata.size != after.metadata.size) {
+                    layer.changes.push_back({path, ChangeType::MODIFIED, after.digest.str(), after.metadata});
+                }
+                if (before.metadata.mode != after.metadata.mode || before.metadata.uid != after.metadata.uid ||
+                    before.metadata.gid != after.metadata.gid) {
+                    layer.changes.push_back({path, ChangeType::PERMISSION_CHANGED, {}, after.metadata});
+                }
+            }
+            ++lhs;
+            ++rhs;
+        }
+    }
+    return layer;
+}
+
+std::shared_ptr<Plan> Plan::loadFromFile(const char *file_path, std::shared_ptr<const Plan> base) {
+    std::ifstream in(file_path, std::ios::binary);
+    return loadFromStream(in, std::move(base));
+}
+
+std::optional<PlanFileHeader> Plan::readFileHeader(std::istream &in) {
+    PlanFileHeader header;
+    std::uint32_t version = 0;
+    if (!readHeader(in, header, version)) {
+        return std::nullopt;
+    }
+    return header;
+}
+
+std::shared_ptr<Plan> Plan::loadFromStream(std::istream &in, std::shared_ptr<const Plan> base) {
+    PlanFileHeader header;
+    std::uint32_t version = 0;
+    StateDigest base_digest;
+    StateDigest local_digest;
+    std::uint32_t layer_count = 0;
+    std::vector<std::uint64_t> sizes;
+    std::optional<PathFilter> path_filter;
+    if (!readHeader(in, header, version) ||
+        !readLayerTable(in, version, base_digest, local_digest, layer_count, sizes, path_filter)) {
+        return nullptr;
+    }
+    if (header.base_id.has_value() != (base != nullptr) || (base && base->getId() != *header.base_id)) {
+        return nullptr;
+    }
+
+    // The stored digest and filter are not trusted here: applyLayer() computes them again. Nor is the
+    // layer count, so nothing is reserved from it.
+    auto plan = std::make_shared<Plan>(std::move(header.id), std::move(base));
+    for (std::uint32_t i = 0; i < layer_count; ++i) {
+        auto layer = readLayer(in, version);
+        if (!layer) {
+            return nullptr;
+        }
+        plan->applyLayer(std::make_shared<const Layer>(std::move(*layer)));
+    }
+    return plan;
+}
+
+std::shared_ptr<Plan> Plan::loadLazily(const char *file_path, std::shared_ptr<const Plan> base,
+                                       LayerResidency &residency) {
+    auto file = MappedFile::open(file_path);
+    if (!file) {
+        return nullptr;
+    }
+    const auto bytes = file->bytes();
+    std::ispanstream in(bytes);
+    PlanFileHeader header;
+    std::uint32_t version = 0;
+    if (!readHeader(in, header, version)) {
+        return nullptr;
+    }
+    // Without a digest, or with one computed the way earlier versions did, the layers are decoded
+    // so that getStateDigest() computes it.
+    if (version < kPlanFileVersion) {
+        std::ispanstream eager(bytes);
+        return loadFromStream(eager, std::move(base));
+    }
+    StateDigest base_digest;
+    StateDigest local_digest;
+    std::uint32_t layer_count = 0;
+    std::vector<std::uint64_t> sizes;
+    std::optional<PathFilter> path_filter;
+    if (!readLayerTable(in, version, base_digest, local_digest, layer_count, sizes, path_filter)) {
+        return nullptr;
+    }
+    if (header.base_id.has_value() != (base != nullptr) || (base && base->getId() != *header.base_id)) {
+        return nullptr;
+    }
+
+    std::vector<std::span<const char> > layers;
+    layers.reserve(sizes.size());
+    auto offset = static_cast<std::uint64_t>(in.tellg());
+    for (const auto size: sizes) {
+        if (size > bytes.size() - offset) {
+            return nullptr;
+        }
+        layers.push_back(bytes.subspan(offset, size));
+        offset += size;
+    }
+
+    auto plan = std::make_shared<Plan>(std::move(header.id), std::move(base));
+    // The stored digests stand for the layers until they are decoded. If the base's state is no
+    // longer the one the plan was saved on, getStateDigest() recomputes the digest as usual.
+    plan->m_base_digest = base_digest;
+    plan->m_local_digest = local_digest;
+    plan->m_digested_layers = sizes.size();
+    plan->m_path_filter = std::move(path_filter);
+    plan->m_version.store(sizes.size(), std::memory_order_relaxed);
+    plan->m_lazy = std::make_unique<LazyLayers>(*plan, residency, std::move(file), version, std::move(layers));
+    return plan;
+}
+
+bool Plan::saveToFile(const char *file_path) const {
+    // Compressed layers of a lazily loaded plan are copied from its file as they are.
+    std::vector<CompressedLayer> encoded;
+    std::vector<std::span<const char> > layers;
+    // A lazily loaded plan whose file predates the path filter builds it from its layers.
+    std::optional<PathFilter> built_filter;
+    if (m_lazy && m_lazy->version >= kPlanFileVersionCompressed && m_path_filter) {
+        layers = m_lazy->layers;
+    } else {
+        const auto pinned = pin();
+        if (!m_path_filter) {
+            built_filter.emplace(2 * (m_path_index.size() + 2 * m_path_index.directoryEvents().size()));
+        }
+        encoded.reserve(m_layers.size());
+        for (const auto &layer: m_layers) {
+            if (built_filter) {
+                built_filter->add(*layer);
+            }
+            layers.push_back(encoded.emplace_back(CompressedLayer::fromLayer(*layer)).bytes());
+        }
+    }
+    const auto &path_filter = m_path_filter ? *m_path_filter : *built_filter;
+    std::vector<std::uint64_t> sizes;
+    sizes.reserve(layers.size());
+    for (const auto &layer: layers) {
+        sizes.push_back(layer.size());
+    }
+
+    // Written aside then renamed: plans loaded lazily from the previous file keep their mapping.
+    const std::string temporary = std::string(file_path) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        writeValue(out, kPlanFileMagic);
+        writeValue(out, kPlanFileVersion);
+        writeString(out, m_id);
+        writeValue(out, static_cast<std::uint8_t>(m_base_plan != nullptr));
+        writeString(out, m_base_plan ? m_base_plan->getId() : std::string());
+        // Brings the digest up to date, then stores it split as it is cached.
+        const auto state_digest = getStateDigest();
+        writeValue(out, m_base_digest);
+        writeValue(out, state_digest - m_base_digest);
+        writeValue(out, static_cast<std::uint32_t>(layers.size()));
+        writeColumn(out, sizes);
+        path_filter.writeTo(out);
+        for (const auto &layer: layers) {
+            out.write(layer.data(), static_cast<std::streamsize>(layer.size()));
+        }
+        if (!out.flush()) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), file_path) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
 }
 
 
@@ -60,6 +1406,8 @@ std::unique_ptr<Plan> Plan::merge(const std::string &new_id, const Plan &planA,
         return nullptr;
     }
     auto merged_plan = std::make_unique<Plan>(new_id, planA.m_base_plan);
+    const auto pinned_a = planA.pin();
+    const auto pinned_b = planB.pin();
 
     for (const auto &layer: planA.m_layers) {
         merged_plan->applyLayer(layer);
@@ -71,3 +1419,71 @@ std::unique_ptr<Plan> Plan::merge(const std::string &new_id, const Plan &planA,
 
     return merged_plan;
 }
+
+RebaseResult Plan::rebase(const std::string &new_id, std::shared_ptr<const Plan> new_base) const {
+    const auto pinned = pin();
+    RebaseResult result;
+    auto &rebased = result.plan;
+    rebased = std::make_unique<Plan>(new_id, new_base);
+    rebased->m_strict_validation = m_strict_validation;
+    // The index and the filter refer to the layers only, which are shared as they are.
+    rebased->m_layers = m_layers;
+    rebased->m_path_index = m_path_index;
+    rebased->m_path_filter = m_path_filter;
+    rebased->m_version.store(m_layers.size(), std::memory_order_relaxed);
+
+    // Only the plans above the common ancestor of both bases can make them differ.
+    std::unordered_set<const Plan *> old_chain;
+    for (const auto *plan = m_base_plan.get(); plan; plan = plan->m_base_plan.get()) {
+        old_chain.insert(plan);
+    }
+    std::vector<const Plan *> upstream;
+    const Plan *ancestor = new_base.get();
+    for (; ancestor && !old_chain.contains(ancestor); ancestor = ancestor->m_base_plan.get()) {
+        upstream.push_back(ancestor);
+    }
+    for (const auto *plan = m_base_plan.get(); plan != ancestor; plan = plan->m_base_plan.get()) {
+        upstream.push_back(plan);
+    }
+
+    // Candidate paths, mapped to whether they conflict whatever the lookups say.
+    std::map<std::string, bool, std::less<> > candidates;
+    m_path_index.forEachPath([&](const std::string_view path) {
+        const auto hash = PathFilter::hash(path);
+        if (std::ranges::any_of(upstream, [&](const Plan *plan) { return plan->mayChange(path, hash); })) {
+            candidates.try_emplace(std::string(path), false);
+        }
+    });
+    // A subtree change of the layers conflicts with any change of the other side inside it.
+    for (const auto ref: m_path_index.directoryEvents()) {
+        const auto &change = m_layers[ref.layer]->changes[ref.change];
+        for (const auto directory: {std::string_view(change.path), std::string_view(change.target_path)}) {
+            if (directory.empty()) {
+                continue;
+            }
+            for (const auto *plan: upstream) {
+                const auto pinned_upstream = plan->pin();
+                plan->m_path_index.forEachPathInSubtree(directory, [&](const std::string_view path) {
+                    candidates.try_emplace(std::string(path), false);
+                });
+                for (const auto event_ref: plan->m_path_index.directoryEvents()) {
+                    const auto &event = plan->m_layers[event_ref.layer]->changes[event_ref.change];
+                    for (const auto &other: {event.path, event.target_path}) {
+                        if (!other.empty() && (isInSubtree(other, directory) || isInSubtree(directory, other))) {
+                            candidates.insert_or_assign(other, true);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (const auto &[path, overlapping]: candidates) {
+        auto base_entry = m_base_plan ? m_base_plan->lookup(path) : std::nullopt;
+        auto new_base_entry = new_base ? new_base->lookup(path) : std::nullopt;
+        if (overlapping || base_entry != new_base_entry) {
+            result.conflicts.push_back({path, std::move(base_entry), std::move(new_base_entry), rebased->lookup(path)});
+        }
+    }
+    return result;
+}
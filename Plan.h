@@ -1,12 +1,124 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string_view>
+#include "ChangeFeed.h"
+#include "ColumnarLayer.h"
+#include "FileEntry.h"
 #include "Layer.h"
+#include "LayerResidency.h"
+#include "PathFilter.h"
+#include "PathIndex.h"
+#include "PathTrie.h"
+#include "StateDigest.h"
+#include "StateView.h"
 
 namespace Dualys {
+    /**
+     * @brief A materialized filesystem state: each path is mapped to its content digest and metadata.
+     */
+    using FileSystemState = std::map<std::string, FileEntry>;
+
+    /**
+     * @struct PlanFileHeader
+     * @brief Identity of a plan stored by Plan::saveToFile(), readable before its layers.
+     */
+    struct PlanFileHeader {
+        std::string id;
+
+        /**
+         * @brief Identifier of the base plan, or std::nullopt for an initial state.
+         */
+        std::optional<std::string> base_id;
+    };
+
+    /**
+     * @struct LayerViolation
+     * @brief A change of a layer whose precondition does not hold in the state it applies to.
+     */
+    struct LayerViolation {
+        enum class Reason {
+            PATH_EXISTS,        ///< ADDED on a path that already has an entry.
+            PATH_MISSING,       ///< MODIFIED, REMOVED or PERMISSION_CHANGED on a path without entry.
+            NOT_A_DIRECTORY,    ///< DIRECTORY_REMOVED or DIRECTORY_MOVED on a missing or non-directory entry.
+            MOVE_INTO_ITSELF,   ///< DIRECTORY_MOVED into its own subtree.
+            TARGET_EXISTS,      ///< DIRECTORY_MOVED onto a path that already has an entry.
+        };
+
+        std::size_t change_index;
+        std::string path;
+        ChangeType type;
+        Reason reason;
+    };
+
+    /**
+     * @struct ApplyResult
+     * @brief Outcome of an append through the plan's write combiner (see Plan::tryApplyLayer()).
+     */
+    struct ApplyResult {
+        enum class Status {
+            APPLIED,  ///< The layer is the plan's last one.
+            CONFLICT, ///< The plan's version was not the expected one: nothing was applied.
+            REJECTED  ///< Strict validation rejected the layer: nothing was applied.
+        };
+
+        Status status = Status::APPLIED;
+
+        /**
+         * @brief The plan's version once the layer is applied, or when it was refused: the one to
+         *        expect when retrying.
+         */
+        std::uint64_t version = 0;
+    };
+
+    /**
+     * @struct PlanSnapshot
+     * @brief Immutable state of a plan at a version, for readers running alongside concurrent
+     *        appends (see Plan::snapshot()).
+     */
+    struct PlanSnapshot {
+        /**
+         * @brief The plan's version when the state was published: the one to expect when applying
+         *        a layer computed from it.
+         */
+        std::uint64_t version = 0;
+
+        PathTrie state;
+    };
+
+    /**
+     * @struct RebaseConflict
+     * @brief A path changed both by the layers of a rebased plan and between its base and the new one.
+     */
+    struct RebaseConflict {
+        std::string path;
+
+        /**
+         * @brief Entry at `path` in the base the layers were applied to.
+         */
+        std::optional<FileEntry> base_entry;
+
+        /**
+         * @brief Entry at `path` in the new base.
+         */
+        std::optional<FileEntry> new_base_entry;
+
+        /**
+         * @brief Entry at `path` once the layers are applied to the new base.
+         */
+        std::optional<FileEntry> rebased_entry;
+    };
+
+    struct RebaseResult;
+
     class Plan : public std::enable_shared_from_this<Plan> {
         /**
          * @brief Represents the unique identifier of the plan.
@@ -34,8 +146,206 @@ namespace Dualys {
          * Maintains a sequential list of `Layer` objects that represent the modifications
          * or changes applied to the current plan. These layers are applied in order
          * during operations like computing the filesystem state or merging plans.
+         * Layers are immutable once applied and shared, so merging or loading plans never
+         * copies their changes.
+         *
+         * Mutable for a lazily loaded plan only, whose layers are faulted in and evicted behind
+         * its const interface (see `m_lazy`).
+         */
+        mutable std::vector<std::shared_ptr<const Layer> > m_layers;
+
+        /**
+         * @brief Index of the changes of `m_layers` by path, maintained by applyLayer().
+         *
+         * Lets lookup() resolve a path by walking the base chain instead of materializing it.
+         */
+        mutable PathIndex m_path_index;
+
+        /**
+         * @brief When set, applyLayer() rejects layers that fail validateLayer().
+         */
+        bool m_strict_validation = false;
+
+        /**
+         * @brief Digest of the base state that `m_local_digest` was computed against.
+         */
+        mutable StateDigest m_base_digest;
+
+        /**
+         * @brief Contribution of the first `m_digested_layers` layers: the digest of the state they
+         *        lead to minus `m_base_digest`.
+         */
+        mutable StateDigest m_local_digest;
+
+        /**
+         * @brief Number of layers folded into `m_local_digest`; getStateDigest() folds in the others.
+         */
+        mutable std::size_t m_digested_layers = 0;
+
+        /**
+         * @brief Value of the process-wide layer epoch when the digest was last brought up to date:
+         *        while no layer is applied anywhere, getStateDigest() returns it as it is.
+         */
+        mutable std::uint64_t m_digest_epoch = 0;
+
+        mutable std::mutex m_digest_mutex;
+
+        /**
+         * @brief Paths changed by `m_layers`, so that lookups skip the plans that leave theirs untouched.
+         *
+         * Maintained by appendLayer(), or read from the file of a lazily loaded plan. Unknown (and
+         * the plan never skipped) for a lazily loaded plan whose file predates it.
+         */
+        std::optional<PathFilter> m_path_filter = PathFilter();
+
+        /**
+         * @brief Subscriptions to the layers applied to the plan; null until the first one.
+         */
+        mutable std::unique_ptr<ChangeFeed> m_change_feed;
+
+        struct Materialized;
+
+        /**
+         * @brief Materialized state and derived views kept up to date by appendLayer(); null unless
+         *        enabled (see enableMaterializedView()).
+         */
+        std::unique_ptr<Materialized> m_materialized;
+
+        /**
+         * @brief Number of layers applied to the plan; see version().
+         */
+        std::atomic<std::uint64_t> m_version{0};
+
+        /**
+         * @brief State published after each append while the materialized view is enabled; see snapshot().
          */
-        std::vector<Layer> m_layers;
+        std::atomic<std::shared_ptr<const PlanSnapshot> > m_snapshot;
+
+        struct WriteRequest;
+
+        // Write combiner: concurrent appends are pushed on a lock-free stack, most recent first,
+        // and applied in batches by whichever writer holds `m_combining`. Writers whose append was
+        // applied by another wait on `m_combined_batches`, bumped after each batch.
+        alignas(64) std::atomic<WriteRequest *> m_pending_writes{nullptr};
+        std::atomic<bool> m_combining{false};
+        std::atomic<std::uint64_t> m_combined_batches{0};
+
+        struct LazyLayers;
+
+        /**
+         * @brief Source of the layers of a plan created by loadLazily(), until a layer is applied to it.
+         *
+         * Declared last: it evicts the layers and index above, so it is destroyed before them.
+         */
+        std::unique_ptr<LazyLayers> m_lazy;
+
+        /**
+         * @brief Keeps the layers of a lazily loaded plan resident while alive; a no-op for other plans.
+         */
+        class ResidentPin {
+        public:
+            explicit ResidentPin(LazyLayers *lazy);
+
+            ~ResidentPin();
+
+            ResidentPin(const ResidentPin &) = delete;
+
+            ResidentPin &operator=(const ResidentPin &) = delete;
+
+        private:
+            LazyLayers *m_lazy;
+        };
+
+        /**
+         * @brief Faults the layers in if needed, and keeps them resident while the pin is alive.
+         */
+        ResidentPin pin() const;
+
+        /**
+         * @brief Faults the layers in for good and makes the plan a regular one, before it is modified.
+         */
+        void detachLazyLayers();
+
+        void appendLayer(std::shared_ptr<const Layer> new_layer);
+
+        /**
+         * @brief Queues `request` for the write combiner and returns once it is applied or refused,
+         *        applying the pending requests of other writers too if no one else does.
+         */
+        ApplyResult submitWrite(WriteRequest &request);
+
+        /**
+         * @brief Applies the pending requests in batches until none is left; `m_combining` is held.
+         */
+        void combineWrites();
+
+        /**
+         * @brief Returns the feed, created on first use; const since the plans built on this one
+         *        subscribe to it to know when their materialized view goes stale.
+         */
+        ChangeFeed &changeFeed() const;
+
+        /**
+         * @brief Applies `layer`, just appended, to the materialized state and views, or builds them
+         *        again if the base changed since they were.
+         */
+        void updateMaterialized(const Layer &layer);
+
+        /**
+         * @brief Returns the materialized state if it is enabled and up to date, or nullptr.
+         */
+        const PathTrie *materializedState() const;
+
+        /**
+         * @brief Builds the materialized state and resets the attached views from the whole chain.
+         */
+        void rebuildMaterialized();
+
+        /**
+         * @brief Publishes the materialized state at the current version, or clears the snapshot if
+         *        the view is disabled or stale.
+         */
+        void publishSnapshot();
+
+        /**
+         * @brief Folds `layer`, at `layer_index`, into `m_local_digest`; the layers are resident.
+         */
+        void updateDigest(const Layer &layer, std::uint32_t layer_index) const;
+
+        /**
+         * @brief Computes `m_local_digest` again, from all the layers, against a base whose digest
+         *        is now `base_digest`; the layers are resident.
+         */
+        void rebaseDigest(const StateDigest &base_digest) const;
+
+        using PathSet = std::set<std::string, std::less<> >;
+
+        /**
+         * @brief Adds to `paths` the paths whose entry `change`, at `position`, may change. Those of a
+         *        subtree change are listed from the path indexes, without materializing the state.
+         */
+        void collectChangedPaths(const FileChange &change, ChangeRef position, PathSet &paths) const;
+
+        /**
+         * @brief Adds to `paths` a superset of the paths of the subtrees of `directories` that hold
+         *        an entry just before the change `before`: the paths written there by the plan and
+         *        its bases, and those of the subtrees moved there.
+         */
+        void collectSubtreePaths(const std::vector<std::string> &directories, ChangeRef before, PathSet &paths) const;
+
+        std::optional<FileEntry> lookupBefore(std::string_view path, ChangeRef before) const;
+
+        /**
+         * @brief Resolves `path` from the plan's own layers down, as lookup() once the plans that do
+         *        not change it are skipped.
+         */
+        std::optional<FileEntry> lookupFrom(std::string_view path) const;
+
+        /**
+         * @brief Tells whether the plan's own layers may change the entry at `path`, whose hash is
+         *        `hash` (see PathFilter::hash()).
+         */
+        bool mayChange(std::string_view path, std::uint64_t hash) const;
 
     public:
         /**
@@ -43,6 +353,8 @@ namespace Dualys {
          */
         Plan(std::string id, std::shared_ptr<const Plan> base);
 
+        ~Plan();
+
         /**
          * @brief Retrieves the identifier of the entity.
          *
@@ -52,6 +364,25 @@ namespace Dualys {
          */
         const std::string &getId() const;
 
+        /**
+         * @brief Retrieves the base plan this plan is built upon.
+         *
+         * @return A shared pointer to the base plan, or nullptr if this plan is an initial state.
+         */
+        const std::shared_ptr<const Plan> &getBasePlan() const;
+
+        /**
+         * @brief Retrieves the layers applied locally to this plan, in application order.
+         *
+         * Layers inherited from the base plan are not included.
+         *
+         * The layers of a lazily loaded plan are faulted in. The returned vector shares them, so they
+         * stay alive as long as the caller keeps it, even if the plan's copy is evicted meanwhile.
+         *
+         * @return The plan's own layers; copying the vector costs one reference count per layer.
+         */
+        std::vector<std::shared_ptr<const Layer> > getLayers() const;
+
         /**
          *
          * @brief Applies a new layer to the current plan.
@@ -59,10 +390,198 @@ namespace Dualys {
          * This method adds the provided layer to the list of layers in the current plan,
          * allowing further modifications to the plan's state.
          *
+         * In strict validation mode, the layer is first checked with validateLayer() and
+         * rejected, leaving the plan unchanged, if any of its changes is invalid.
+         *
          * @param new_layer The new layer to be added.
          *
+         * @return false if the layer was rejected by strict validation.
+         */
+        bool applyLayer(const Layer &new_layer);
+
+        /**
+         * @brief Applies an immutable, shared layer to the current plan without copying it.
+         *
+         * @param new_layer The new layer to be added (e.g. the result of LayerBuilder::finish()).
+         *
+         * @return false if the layer was rejected by strict validation.
+         */
+        bool applyLayer(std::shared_ptr<const Layer> new_layer);
+
+        /**
+         * @brief Returns the number of layers applied to the plan, which tryApplyLayer() compares.
+         *
+         * Thread-safe: it may be read while other threads append through tryApplyLayer() or
+         * applyLayerConcurrently().
+         */
+        std::uint64_t version() const;
+
+        /**
+         * @brief Applies `new_layer` only if the plan is still at `expected_version`: optimistic
+         *        concurrency for writers that computed the layer from that version.
+         *
+         * Thread-safe with respect to the other calls of this method and applyLayerConcurrently()
+         * on the same plan, without an external lock: concurrent appends are combined, one of the
+         * writers applying the pending layers in arrival order and publishing the new version
+         * once for the whole batch. Plans have their own combiner, so writers on different plans
+         * never contend.
+         *
+         * Concurrent readers go through snapshot(), which needs the materialized view: the other
+         * reads and mutations of the plan must not overlap with the appends. A layer whose
+         * indexing fails is not applied. Once indexed, it stays applied and counted by version()
+         * even if updating the path filter, the materialized view or the subscriptions fails; the
+         * failed structure is built again later and the exception propagates.
+         *
+         * @return CONFLICT with the current version, to read it again and retry, if another layer
+         *         was applied since `expected_version`; REJECTED under strict validation.
+         */
+        ApplyResult tryApplyLayer(std::uint64_t expected_version, std::shared_ptr<const Layer> new_layer);
+
+        /**
+         * @brief Applies `new_layer` after the layers other threads are applying, through the same
+         *        combiner as tryApplyLayer(), for writers whose layer does not depend on the state.
+         *
+         * @return APPLIED with the version the layer made, or REJECTED under strict validation.
+         */
+        ApplyResult applyLayerConcurrently(std::shared_ptr<const Layer> new_layer);
+
+        /**
+         * @brief Returns the state published after the last append, with the version it matches,
+         *        or nullptr unless the materialized view is enabled.
+         *
+         * Thread-safe, also while other threads append through tryApplyLayer(): a writer reads the
+         * snapshot, computes its layer from the state, then applies it with tryApplyLayer() at the
+         * snapshot's version. The snapshot is immutable and O(1) to publish, the materialized
+         * state being a persistent trie. It reflects the base plans as of the last append or
+         * enableMaterializedView(), even if one changed since (see isMaterializedViewCurrent()).
+         */
+        std::shared_ptr<const PlanSnapshot> snapshot() const;
+
+        /**
+         * @brief Subscribes to the layers applied to the plan from now on.
+         *
+         * Each applied layer is published to the subscription as a LayerEvent, without copying the
+         * layer; consumers poll the events in batches, or coalesce them into one delta per plan,
+         * instead of materializing the state again. See Subscription for the queue bound and the
+         * backpressure policies.
+         */
+        std::shared_ptr<Subscription> subscribe(SubscriptionOptions options = {});
+
+        /**
+         * @brief Delivers the layers applied to the plan from now on to `subscription` too, e.g. to
+         *        watch several plans through a single queue.
+         */
+        void subscribe(const std::shared_ptr<Subscription> &subscription);
+
+        void unsubscribe(const Subscription &subscription);
+
+        /**
+         * @brief Materializes the state once, then keeps it up to date on each applyLayer() by
+         *        applying the layer's delta.
+         *
+         * Opt-in, for hot plans read after every small layer: getFileSystemTrie() then costs O(1)
+         * and getFileSystemState() O(n), without replaying the base chain, while applyLayer() costs
+         * O(k log n) more for k changes, plus the size of the subtrees of directory changes.
+         *
+         * The plan subscribes to every plan of its base chain: a layer applied to one of them makes
+         * the view stale (see isMaterializedViewCurrent()), and applying a layer to a base plan
+         * then also computes its state digest. A stale view is built again, and its attached views
+         * reset, on the next applyLayer() or call to this method; until then, reads fall back to
+         * the regular materialization.
+         *
+         * A lazily loaded plan faults its layers in for good.
+         */
+        void enableMaterializedView();
+
+        /**
+         * @brief Tells whether the materialized view is enabled and matches the state, in O(1).
+         *
+         * False once a layer is applied to a plan of the base chain, until enableMaterializedView()
+         * or applyLayer() builds the view again: the attached views are then stale too.
          */
-        void applyLayer(const Layer &new_layer);
+        bool isMaterializedViewCurrent() const;
+
+        /**
+         * @brief Drops the materialized state and the attached views.
+         */
+        void disableMaterializedView();
+
+        bool hasMaterializedView() const;
+
+        /**
+         * @brief Keeps `view` up to date with the state of the plan, entry by entry.
+         *
+         * Enables the materialized view, resets `view` with the current state, then reports to it
+         * the entries changed by each applied layer (see StateView).
+         */
+        void attachView(std::shared_ptr<StateView> view);
+
+        void detachView(const StateView &view);
+
+        /**
+         * @brief Enables or disables strict validation of the layers applied to this plan.
+         *
+         * Disabled by default. Clones inherit the setting of their base.
+         */
+        void setStrictValidation(bool strict);
+
+        /**
+         * @brief Tells whether applyLayer() validates layers before applying them.
+         */
+        bool isStrictValidation() const;
+
+        /**
+         * @brief Checks every change of `layer` against the state it would apply to.
+         *
+         * Each change is checked against the current state of the plan updated by the preceding
+         * changes of the layer: ADDED requires a missing path; MODIFIED, REMOVED and
+         * PERMISSION_CHANGED require an existing one; DIRECTORY_REMOVED and DIRECTORY_MOVED require
+         * an existing DIRECTORY entry, and a move additionally requires a missing target outside of
+         * the moved subtree.
+         *
+         * Every check is a point lookup: the plan is never materialized, and the cost is
+         * O(k log n) for a layer of k changes (plus the directory events met on the way).
+         *
+         * @return The violations, in change order; empty if the layer is valid.
+         */
+        std::vector<LayerViolation> validateLayer(const Layer &layer) const;
+
+        /**
+         * @brief Returns the entry at `path` in the final state of the plan, without materializing it.
+         *
+         * The path index of each plan of the base chain is queried from this plan down to the
+         * initial state, stopping at the first change that determines the entry. Each plan costs
+         * O(log n), plus one step per subtree change of that plan applied after the last write to
+         * the path. Plans whose path filter rules the path out are skipped in a single probe, so a
+         * missing path fails fast however deep the chain.
+         *
+         * @return The entry, or std::nullopt if the path has none.
+         */
+        std::optional<FileEntry> lookup(std::string_view path) const;
+
+        /**
+         * @brief Returns the digest of the final state of the plan.
+         *
+         * The digest is computed lazily and cached. The layers applied since the last call are folded
+         * in incrementally: each change adjusts it with the entries its path held before and after
+         * it, found by point lookups, so that folding k changes costs O(k log n). A subtree change
+         * adjusts it for the paths of the subtree, listed from the path indexes of the plan and its
+         * bases rather than by materializing the state.
+         *
+         * While no layer is applied to any plan, reading the digest costs O(1). Otherwise it costs
+         * O(1) per plan of the base chain that did not change. If a base plan received layers, the
+         * plan's own contribution is recomputed once against the new base, in time proportional to
+         * the paths its layers touch, then cached again.
+         *
+         * @return A digest equal for two plans if and only if (up to hash collisions) their final
+         *         states are equal; usable as a cache key for anything derived from the state.
+         */
+        StateDigest getStateDigest() const;
+
+        /**
+         * @brief Tells whether this plan and `other` have the same final state, by comparing their digests.
+         */
+        bool hasSameState(const Plan &other) const;
 
         /**
          * @brief Creates a clone of the current plan with a new identifier.
@@ -84,12 +603,67 @@ namespace Dualys {
          * This method calculates the resulting state of the filesystem by starting from the state of its base plan
          * (if any) and applying all the modifications described by its own layers, in order. If the current plan
          * has no base (i.e., initial state), the computation starts from an empty state. Modifications can include
-         * added, modified, or removed entries. The changes are applied recursively for all base plans.
+         * added, modified, or removed entries, and permission changes on existing entries. The changes are applied
+         * recursively for all base plans.
          *
          * @return A map representing the final virtual filesystem state, where the keys are paths (strings) and
-         *         the values are content hashes or other related string information.
+         *         the values are the entries' content digests and metadata.
+         */
+        FileSystemState getFileSystemState() const;
+
+        /**
+         * @brief Computes the final state of the virtual filesystem as a path trie.
+         *
+         * Same semantics as getFileSystemState(), but the result is a persistent radix trie: paths share
+         * their common prefixes, and the trie returned for this plan shares every subtree its layers do
+         * not touch with the trie computed for its base. Prefix listing and subtree removal on the result
+         * cost O(depth).
+         *
+         * @return A trie representing the final virtual filesystem state.
+         */
+        PathTrie getFileSystemTrie() const;
+
+        /**
+         * @brief Applies a single change to a materialized state.
+         *
+         * ADDED stores the change's digest and metadata. MODIFIED replaces the digest and size and keeps the
+         * other metadata of an existing entry. REMOVED erases the entry. PERMISSION_CHANGED updates the mode,
+         * uid and gid of an existing entry and is ignored for a missing one.
+         *
+         * DIRECTORY_REMOVED and DIRECTORY_MOVED operate on the contiguous range of the subtree in the sorted
+         * state, in O(log n + k) for a subtree of k entries. A move into its own subtree is ignored.
+         *
+         * @param state The state to update.
+         * @param change The change to apply.
+         */
+        static void applyChange(FileSystemState &state, const FileChange &change);
+
+        /**
+         * @brief Applies a single change given as a row, with the same semantics.
+         */
+        static void applyChange(FileSystemState &state, const ChangeRow &change);
+
+        /**
+         * @brief Applies every change of a columnar layer, in order.
+         */
+        static void applyChanges(FileSystemState &state, const ColumnarLayerView &layer);
+
+        /**
+         * @brief Computes the layer that turns the state of `from` into the state of `to`.
+         *
+         * Both plans are materialized and compared in a single ordered walk. A directory entry of `from`
+         * whose whole subtree is absent from `to` is emitted as one DIRECTORY_REMOVED change instead of
+         * one REMOVED change per descendant. An entry whose file type changes is removed, then added again.
+         * Moves are not detected: they appear as removals and additions. The result passes validateLayer()
+         * on `from`.
+         *
+         * @param layer_id The identifier of the resulting layer.
+         * @param from The plan describing the initial state.
+         * @param to The plan describing the desired state.
+         *
+         * @return A layer such that applying it to the state of `from` yields the state of `to`.
          */
-        std::map<std::string, std::string> getFileSystemState() const;
+        static Layer diff(const std::string &layer_id, const Plan &from, const Plan &to);
 
         /**
          * @brief Loads a plan configuration from a specified file.
@@ -98,10 +672,74 @@ namespace Dualys {
          * to initialize or populate plan-related data. It is typically used to restore
          * a saved plan configuration or to import a predefined plan.
          *
+         * The file holds the plan identifier, the identifier of its base plan and its own layers in
+         * columnar form (see saveToFile()). Layers of the base plan are not stored in the file: the
+         * caller provides the base, which must carry the recorded identifier.
+         *
          * @param file_path The path to the file containing the plan configuration.
          *        It must be a valid path readable by the application.
+         * @param base The base plan of the stored plan, or nullptr if it was an initial state.
+         *
+         * @return The loaded plan, or nullptr if the file cannot be read, is malformed, or was saved
+         *         on top of a base with a different identifier.
+         */
+        static std::shared_ptr<Plan> loadFromFile(const char *file_path, std::shared_ptr<const Plan> base = nullptr);
+
+        /**
+         * @brief Loads a plan from a stream holding the content of a file written by saveToFile().
+         *
+         * Lets callers perform the I/O themselves (e.g. asynchronously, or batched) and only parse here.
+         *
+         * @return The loaded plan, or nullptr under the same conditions as loadFromFile().
+         */
+        static std::shared_ptr<Plan> loadFromStream(std::istream &in, std::shared_ptr<const Plan> base = nullptr);
+
+        /**
+         * @brief Reads the identity of the plan stored in `in`, e.g. to find the base to load it on.
+         *
+         * The stream is left after the header: rewind it before loadFromStream().
+         *
+         * @return The header, or std::nullopt if `in` does not start with a plan file header.
+         */
+        static std::optional<PlanFileHeader> readFileHeader(std::istream &in);
+
+        /**
+         * @brief Loads a plan shell from a file written by saveToFile(), deferring its layers.
+         *
+         * The file is mapped, and only its header, the digest of the stored state and the table of
+         * layer sizes are read: loading costs O(number of layers), whatever their size. The layers
+         * are decoded from the mapping on the first access needing them (lookup, materialization,
+         * getLayers(), ...), then registered in `residency`, which evicts the layers of the least
+         * recently used lazy plans beyond its budget; they are faulted in again when needed.
+         * getStateDigest() and clone() do not fault the layers in, so a chain of lazily loaded
+         * bases only costs memory for the plans actually read.
+         *
+         * Applying a layer faults the layers in for good: the plan then behaves as a loaded one.
+         * The file must stay in place, untruncated, while the plan lives; saveToFile() replaces
+         * files by renaming, which keeps mapped plans valid.
+         *
+         * Files written before the state digest was stored are loaded eagerly, as loadFromFile().
+         *
+         * @return The plan, or nullptr under the same conditions as loadFromFile().
+         * @throws std::runtime_error on access to a layer that no longer decodes (the file was
+         *         overwritten in place).
          */
-        static void loadFromFile(const char *file_path);
+        static std::shared_ptr<Plan> loadLazily(const char *file_path, std::shared_ptr<const Plan> base = nullptr,
+                                                LayerResidency &residency = layerResidency());
+
+        /**
+         * @brief Saves the plan's identifier, its base identifier and its own layers to a file.
+         *
+         * Layers are written with the columnar encoding of ColumnarLayer, after the table of their
+         * sizes and the digest of the state, so that loadLazily() can load the plan without
+         * decoding them. The base plan must be saved separately. The file is written next to
+         * `file_path`, then renamed over it.
+         *
+         * @param file_path The path of the file to create or overwrite.
+         *
+         * @return false if the file cannot be written.
+         */
+        bool saveToFile(const char *file_path) const;
 
         /**
          *
@@ -119,5 +757,35 @@ namespace Dualys {
          *         `planA` and `planB` are incompatible.
          */
         static std::unique_ptr<Plan> merge(const std::string &new_id, const Plan &planA, const Plan &planB);
+
+        /**
+         * @brief Creates a plan with the same layers on top of `new_base`, like a git rebase.
+         *
+         * The layers are shared, and their path index and filter reused: only the digest is
+         * computed again, materializing the state at most once if the layers change subtrees.
+         *
+         * Conflicts are found without materializing either base: the plans between the common
+         * ancestor of both bases and each of them are the only ones that can make the bases differ,
+         * so only the paths of the layers that one of these plans may change (see lookup()) are
+         * candidates, and a candidate conflicts if point lookups in both bases disagree. Directory
+         * changes on both sides whose subtrees overlap always conflict. The layers apply as they
+         * are regardless: the conflicts tell where their effect may not be the intended one.
+         *
+         * @param new_id The identifier for the rebased plan.
+         * @param new_base The base of the rebased plan, or nullptr for an empty state.
+         *
+         * @return The rebased plan, with the strict validation setting of this one, and the
+         *         conflicts sorted by path.
+         */
+        RebaseResult rebase(const std::string &new_id, std::shared_ptr<const Plan> new_base) const;
+    };
+
+    /**
+     * @struct RebaseResult
+     * @brief A plan rebased onto a new base, and the conflicts found (see Plan::rebase()).
+     */
+    struct RebaseResult {
+        std::unique_ptr<Plan> plan;
+        std::vector<RebaseConflict> conflicts;
     };
 }
@@ -1,3 +1,261 @@
 #include "PlanManager.h"
+#include <algorithm>
+#include <set>
+#include <span>
+#include <spanstream>
+#include <utility>
 
-using namespace Dualys;
\ No newline at end of file
+using namespace Dualys;
+
+
+PlanManager::PlanManager(std::shared_ptr<const Plan> initial_state)
+    : initial_state_template(std::move(initial_state)) {
+}
+
+std::shared_ptr<Plan> PlanManager::createPlan(const std::string &id) {
+    if (active_plans.contains(id)) {
+        return nullptr;
+    }
+    auto plan = std::make_shared<Plan>(id, initial_state_template);
+    activate(plan);
+    return plan;
+}
+
+std::shared_ptr<Plan> PlanManager::branchPlan(const std::string &new_id, const std::string &source_id) {
+    const auto source = active_plans.find(source_id);
+    if (source == active_plans.end() || active_plans.contains(new_id)) {
+        return nullptr;
+    }
+    std::shared_ptr<Plan> plan = source->second->clone(new_id);
+    activate(plan);
+    return plan;
+}
+
+std::vector<std::shared_ptr<Plan> > PlanManager::loadPlans(const std::vector<std::string> &file_paths, IoBackend &io) {
+    const std::vector<std::filesystem::path> paths(file_paths.begin(), file_paths.end());
+    std::map<std::string, std::optional<std::string> > base_ids;
+    std::map<std::string, std::string> contents;
+    for (auto &content: io.readFiles(paths)) {
+        if (!content) {
+            continue;
+        }
+        std::ispanstream in(std::span(content->data(), content->size()));
+        if (auto header = Plan::readFileHeader(in); header && !base_ids.contains(header->id)) {
+            base_ids.emplace(header->id, std::move(header->base_id));
+            contents.emplace(std::move(header->id), std::move(*content));
+        }
+    }
+    return loadInBaseOrder(base_ids, [&](const std::string &id, std::shared_ptr<const Plan> base) {
+        auto &content = contents.at(id);
+        std::ispanstream in(std::span(content.data(), content.size()));
+        auto plan = Plan::loadFromStream(in, std::move(base));
+        content = std::string();
+        return plan;
+    });
+}
+
+bool PlanManager::saveSnapshot(SnapshotStore &store) const {
+    std::vector<std::shared_ptr<const Plan> > plans;
+    std::set<const Plan *> seen;
+    for (const auto &[id, active]: active_plans) {
+        // The bases of the active plans are saved too, up to the initial state template.
+        for (std::shared_ptr<const Plan> plan = active;
+             plan && plan != initial_state_template && seen.insert(plan.get()).second;
+             plan = plan->getBasePlan()) {
+            plans.push_back(plan);
+        }
+    }
+    return store.save(plans);
+}
+
+std::vector<std::shared_ptr<Plan> > PlanManager::loadSnapshot(SnapshotStore &store) {
+    auto stored = store.load();
+    if (!stored) {
+        return {};
+    }
+    std::map<std::string, std::optional<std::string> > base_ids;
+    for (const auto &[id, plan]: *stored) {
+        base_ids.emplace(id, plan.base_id);
+    }
+    auto loaded = loadInBaseOrder(base_ids, [&](const std::string &id, std::shared_ptr<const Plan> base) {
+        auto plan = std::make_shared<Plan>(id, std::move(base));
+        for (auto &layer: stored->at(id).layers) {
+            plan->applyLayer(std::move(layer));
+        }
+        return plan;
+    });
+    for (const auto &plan: loaded) {
+        store.adopt(plan);
+    }
+    return loaded;
+}
+
+std::vector<std::shared_ptr<Plan> > PlanManager::loadInBaseOrder(
+    const std::map<std::string, std::optional<std::string> > &base_ids,
+    const std::function<std::shared_ptr<Plan>(const std::string &, std::shared_ptr<const Plan>)> &load) {
+    enum class State { PENDING, VISITING, DONE, FAILED };
+    std::map<std::string, State> states;
+    for (const auto &[id, base_id]: base_ids) {
+        states.emplace(id, State::PENDING);
+    }
+
+    std::vector<std::shared_ptr<Plan> > loaded;
+    // Depth-first on the base links, with an explicit stack: chains of bases may be long.
+    for (const auto &[root_id, root_base_id]: base_ids) {
+        std::vector<std::string> stack{root_id};
+        while (!stack.empty()) {
+            const auto id = stack.back();
+            auto &state = states.at(id);
+            if (state == State::DONE || state == State::FAILED) {
+                stack.pop_back();
+                continue;
+            }
+            std::shared_ptr<const Plan> base;
+            if (const auto &base_id = base_ids.at(id)) {
+                // A base of the batch is the one the plan was saved on: an active plan that merely
+                // shares its identifier is not, so the plans based on a skipped one are skipped too.
+                if (const auto listed = states.find(*base_id); listed != states.end()) {
+                    if (listed->second == State::PENDING) {
+                        state = State::VISITING;
+                        stack.push_back(*base_id);
+                        continue;
+                    }
+                    if (listed->second != State::DONE) {
+                        // Failed, or a cycle through plans still being visited.
+                        state = State::FAILED;
+                        continue;
+                    }
+                    base = active_plans.at(*base_id);
+                } else if (const auto active = active_plans.find(*base_id); active != active_plans.end()) {
+                    base = active->second;
+                } else if (initial_state_template && initial_state_template->getId() == *base_id) {
+                    base = initial_state_template;
+                } else {
+                    state = State::FAILED;
+                    continue;
+                }
+            }
+            auto plan = active_plans.contains(id) ? nullptr : load(id, std::move(base));
+            if (!plan) {
+                state = State::FAILED;
+                continue;
+            }
+            state = State::DONE;
+            activate(plan);
+            loaded.push_back(std::move(plan));
+        }
+    }
+    return loaded;
+}
+
+std::shared_ptr<Plan> PlanManager::getPlan(const std::string &id) const {
+    const auto it = active_plans.find(id);
+    return it != active_plans.end() ? it->second : nullptr;
+}
+
+bool PlanManager::removePlan(const std::string &id) {
+    const auto it = active_plans.find(id);
+    if (it == active_plans.end()) {
+        return false;
+    }
+    for (const auto &subscription: subscriptions) {
+        if (const auto live = subscription.lock()) {
+            it->second->unsubscribe(*live);
+        }
+    }
+    active_plans.erase(it);
+    // The records of a plan still alive (a base of another plan, or held by the caller) are needed
+    // to resolve the plans built on it: they are reclaimed once it is destroyed.
+    if (content_index) {
+        content_index->collectGarbage();
+    }
+    return true;
+}
+
+bool PlanManager::applyLayer(const std::string &plan_id, const Layer &layer) {
+    return applyLayer(plan_id, std::make_shared<const Layer>(layer));
+}
+
+bool PlanManager::applyLayer(const std::string &plan_id, std::shared_ptr<const Layer> layer) {
+    const auto it = active_plans.find(plan_id);
+    if (it == active_plans.end()) {
+        return false;
+    }
+    const auto &plan = it->second;
+    if (!plan->applyLayer(layer)) {
+        return false;
+    }
+    if (content_index) {
+        content_index->indexLayer(*plan, *layer);
+    }
+    return true;
+}
+
+std::shared_ptr<Subscription> PlanManager::subscribe(const SubscriptionOptions options) {
+    auto subscription = std::make_shared<Subscription>(options);
+    for (const auto &[id, plan]: active_plans) {
+        plan->subscribe(subscription);
+    }
+    std::erase_if(subscriptions, [](const std::weak_ptr<Subscription> &attached) {
+        return attached.expired();
+    });
+    subscriptions.push_back(subscription);
+    return subscription;
+}
+
+void PlanManager::enableContentIndex() {
+    if (content_index) {
+        return;
+    }
+    content_index = std::make_unique<ContentIndex>();
+    if (initial_state_template) {
+        content_index->indexPlan(*initial_state_template);
+    }
+    for (const auto &[id, plan]: active_plans) {
+        content_index->indexPlan(*plan);
+    }
+}
+
+bool PlanManager::hasContentIndex() const {
+    return content_index != nullptr;
+}
+
+std::vector<std::string> PlanManager::findPathsByHash(const std::string &hash) const {
+    if (!content_index) {
+        return {};
+    }
+    return content_index->findPaths(hash, activePlanPointers());
+}
+
+std::vector<std::string> PlanManager::findPlansByHash(const std::string &hash) const {
+    if (!content_index) {
+        return {};
+    }
+    std::vector<std::string> ids;
+    for (const Plan *plan: content_index->findPlans(hash, activePlanPointers())) {
+        ids.push_back(plan->getId());
+    }
+    std::ranges::sort(ids);
+    return ids;
+}
+
+void PlanManager::activate(const std::shared_ptr<Plan> &plan) {
+    if (content_index) {
+        content_index->indexPlan(*plan);
+    }
+    for (const auto &subscription: subscriptions) {
+        if (const auto live = subscription.lock()) {
+            plan->subscribe(live);
+        }
+    }
+    active_plans.emplace(plan->getId(), plan);
+}
+
+std::vector<const Plan *> PlanManager::activePlanPointers() const {
+    std::vector<const Plan *> plans;
+    plans.reserve(active_plans.size());
+    for (const auto &[id, plan]: active_plans) {
+        plans.push_back(plan.get());
+    }
+    return plans;
+}
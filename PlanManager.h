@@ -1,7 +1,15 @@
 #pragma once
 
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "ContentIndex.h"
+#include "IoBackend.h"
 #include "Plan.h"
+#include "SnapshotStore.h"
 
 
 namespace Dualys {
@@ -36,7 +44,151 @@ namespace Dualys {
          * across the system.
          */
         std::shared_ptr<const Plan> initial_state_template;
-    };
-}
 
+        /**
+         * @brief Optional reverse index from content hash to paths and plans.
+         *
+         * Null until enableContentIndex() is called. Once enabled, it is kept up to date
+         * by every layer applied through the manager.
+         */
+        std::unique_ptr<ContentIndex> content_index;
+
+        /**
+         * @brief Subscriptions to every active plan, attached to the plans activated later too.
+         */
+        std::vector<std::weak_ptr<Subscription> > subscriptions;
+
+        std::vector<const Plan *> activePlanPointers() const;
+
+        /**
+         * @brief Makes `plan` active: indexes it and attaches the manager's subscriptions to it.
+         */
+        void activate(const std::shared_ptr<Plan> &plan);
+
+        /**
+         * @brief Registers the plans of `base_ids` (identifier -> base identifier), each after its base.
+         *
+         * `load` builds a plan on its base: another plan of `base_ids`, registered first, if the base
+         * is listed there; otherwise an active plan or the initial state template. Plans already
+         * active, failing to build, or whose base is missing or skipped, are skipped.
+         */
+        std::vector<std::shared_ptr<Plan> > loadInBaseOrder(
+            const std::map<std::string, std::optional<std::string> > &base_ids,
+            const std::function<std::shared_ptr<Plan>(const std::string &, std::shared_ptr<const Plan>)> &load);
+
+    public:
+        PlanManager() = default;
+
+        /**
+         * @brief Creates a manager whose new plans start from `initial_state`.
+         */
+        explicit PlanManager(std::shared_ptr<const Plan> initial_state);
+
+        /**
+         * @brief Creates a new active plan based on the initial state template.
+         *
+         * @return The new plan, or nullptr if a plan with the same identifier is already active.
+         */
+        std::shared_ptr<Plan> createPlan(const std::string &id);
+
+        /**
+         * @brief Creates a new active plan by cloning the active plan `source_id`.
+         *
+         * @return The new plan, or nullptr if `source_id` is unknown or `new_id` is already active.
+         */
+        std::shared_ptr<Plan> branchPlan(const std::string &new_id, const std::string &source_id);
+
+        /**
+         * @brief Loads a saved plan graph: every file of `file_paths`, written by Plan::saveToFile().
+         *
+         * The files are read in one batch through `io`, then each plan is loaded on its base:
+         * another plan of the batch (loaded first) if the batch holds it, otherwise an active plan
+         * or the initial state template.
+         * Plans whose identifier is already active, whose base is missing or whose file is
+         * unreadable or malformed are skipped, as are the plans based on them.
+         *
+         * @return The loaded plans, now active, each after its base.
+         */
+        std::vector<std::shared_ptr<Plan> > loadPlans(const std::vector<std::string> &file_paths, IoBackend &io);
+
+        /**
+         * @brief Saves the active plans and their bases (up to the initial state template) to `store`.
+         *
+         * Only what changed since the previous save to `store` is written (see SnapshotStore).
+         *
+         * @return false if the snapshot could not be written.
+         */
+        bool saveSnapshot(SnapshotStore &store) const;
+
+        /**
+         * @brief Loads the plans saved in `store`, like loadPlans(), and makes them active.
+         *
+         * The loaded plans are adopted by `store`: saving again only writes later changes.
+         *
+         * @return The loaded plans, each after its base; empty if the snapshot is unreadable.
+         */
+        std::vector<std::shared_ptr<Plan> > loadSnapshot(SnapshotStore &store);
+
+        /**
+         * @brief Returns the active plan identified by `id`, or nullptr.
+         */
+        std::shared_ptr<Plan> getPlan(const std::string &id) const;
+
+        /**
+         * @brief Stops tracking the active plan identified by `id`.
+         *
+         * @return false if no such plan is active.
+         */
+        bool removePlan(const std::string &id);
+
+        /**
+         * @brief Applies a layer to an active plan, keeping the manager's indexes up to date.
+         *
+         * @return false if no such plan is active or the layer was rejected by strict validation
+         *         (see Plan::setStrictValidation()).
+         */
+        bool applyLayer(const std::string &plan_id, const Layer &layer);
 
+        /**
+         * @brief Applies an immutable, shared layer to an active plan without copying it.
+         *
+         * @return false if no such plan is active or the layer was rejected by strict validation.
+         */
+        bool applyLayer(const std::string &plan_id, std::shared_ptr<const Layer> layer);
+
+        /**
+         * @brief Subscribes to the layers applied to the active plans from now on, whether through
+         *        the manager or directly on a plan (see Plan::subscribe()).
+         *
+         * Plans activated later are watched too; a removed plan is no longer watched.
+         */
+        std::shared_ptr<Subscription> subscribe(SubscriptionOptions options = {});
+
+        /**
+         * @brief Enables the content hash reverse index.
+         *
+         * The layers already applied to the template and to the active plans are indexed
+         * once; afterwards, the index is maintained incrementally by applyLayer().
+         */
+        void enableContentIndex();
+
+        /**
+         * @brief Tells whether the content hash reverse index is enabled.
+         */
+        bool hasContentIndex() const;
+
+        /**
+         * @brief Lists the paths holding `hash` in at least one active plan.
+         *
+         * Requires the content index; returns an empty list when it is disabled.
+         */
+        std::vector<std::string> findPathsByHash(const std::string &hash) const;
+
+        /**
+         * @brief Lists the identifiers of the active plans holding `hash` at some path.
+         *
+         * Requires the content index; returns an empty list when it is disabled.
+         */
+        std::vector<std::string> findPlansByHash(const std::string &hash) const;
+    };
+}
@@ -0,0 +1,187 @@
+#include "ResultCache.h"
+#include "BinaryIO.h"
+#include "ColumnarLayer.h"
+#include <cstdio>
+#include <fstream>
+#include <system_error>
+#include <utility>
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr std::uint32_t kSpillFileMagic = 0x43524c50; // "PLRC"
+    constexpr std::uint32_t kSpillFileVersion = 2;
+
+    /**
+     * FNV-1a: a stable hash, so that spill file names survive restarts.
+     */
+    std::uint64_t stableHash(std::string_view value) {
+        std::uint64_t hash = 0xcbf29ce484222325ULL;
+        for (const char c: value) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+}
+
+ResultCache::ResultCache(ResultCacheOptions options)
+    : m_options(std::move(options)) {
+    if (!m_options.spill_directory.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(m_options.spill_directory, error);
+    }
+}
+
+std::optional<ExecutionResult> ResultCache::find(const std::string &key) {
+    std::lock_guard lock(m_mutex);
+    const auto now = Clock::now();
+    if (const auto it = m_entries.find(key); it != m_entries.end()) {
+        if (it->second.expires_at <= now) {
+            erase(it);
+        } else {
+            m_recency.splice(m_recency.begin(), m_recency, it->second.recency);
+            ++m_hits;
+            return it->second.result;
+        }
+    } else if (auto spilled = unspill(key)) {
+        std::error_code error;
+        std::filesystem::remove(spillPath(key), error);
+        auto &[result, expires_at] = *spilled;
+        if (expires_at > now) {
+            ++m_hits;
+            insert(key, result, expires_at);
+            evict();
+            return result;
+        }
+    }
+    ++m_misses;
+    return std::nullopt;
+}
+
+void ResultCache::store(const std::string &key, ExecutionResult result) {
+    std::lock_guard lock(m_mutex);
+    if (const auto it = m_entries.find(key); it != m_entries.end()) {
+        erase(it);
+    }
+    const auto expires_at = m_options.ttl.count() > 0 ? Clock::now() + m_options.ttl : Clock::time_point::max();
+    insert(key, std::move(result), expires_at);
+    evict();
+}
+
+void ResultCache::clear() {
+    std::lock_guard lock(m_mutex);
+    m_entries.clear();
+    m_recency.clear();
+    m_bytes = 0;
+}
+
+std::size_t ResultCache::size() const {
+    std::lock_guard lock(m_mutex);
+    return m_entries.size();
+}
+
+std::size_t ResultCache::bytes() const {
+    std::lock_guard lock(m_mutex);
+    return m_bytes;
+}
+
+std::uint64_t ResultCache::hits() const {
+    std::lock_guard lock(m_mutex);
+    return m_hits;
+}
+
+std::uint64_t ResultCache::misses() const {
+    std::lock_guard lock(m_mutex);
+    return m_misses;
+}
+
+const ResultCacheOptions &ResultCache::options() const {
+    return m_options;
+}
+
+void ResultCache::insert(const std::string &key, ExecutionResult result, const Clock::time_point expires_at) {
+    // The key is stored twice: in the map and in the recency list.
+    auto bytes = 2 * key.size() + result.output.size() + sizeof(Entry);
+    if (result.layer) {
+        bytes += sizeof(Layer) + result.layer->id.size();
+        for (const auto &change: result.layer->changes) {
+            bytes += sizeof(FileChange) + change.path.size() + change.new_content_hash.size() + change.target_path.size();
+        }
+    }
+    if (bytes > m_options.max_bytes) {
+        spill(key, result, expires_at);
+        return;
+    }
+    m_recency.push_front(key);
+    m_entries.emplace(key, Entry{std::move(result), expires_at, bytes, m_recency.begin()});
+    m_bytes += bytes;
+}
+
+void ResultCache::erase(const std::unordered_map<std::string, Entry>::iterator it) {
+    m_bytes -= it->second.bytes;
+    m_recency.erase(it->second.recency);
+    m_entries.erase(it);
+}
+
+void ResultCache::evict() {
+    while (m_bytes > m_options.max_bytes && !m_recency.empty()) {
+        const auto it = m_entries.find(m_recency.back());
+        spill(it->first, it->second.result, it->second.expires_at);
+        erase(it);
+    }
+}
+
+std::filesystem::path ResultCache::spillPath(const std::string &key) const {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(stableHash(key)));
+    return m_options.spill_directory / (std::string(name) + ".result");
+}
+
+void ResultCache::spill(const std::string &key, const ExecutionResult &result, const Clock::time_point expires_at) const {
+    if (m_options.spill_directory.empty()) {
+        return;
+    }
+    std::ofstream out(spillPath(key), std::ios::binary | std::ios::trunc);
+    writeValue(out, kSpillFileMagic);
+    writeValue(out, kSpillFileVersion);
+    writeString(out, key);
+    writeValue(out, static_cast<std::int64_t>(expires_at.time_since_epoch().count()));
+    writeValue(out, static_cast<std::int32_t>(result.exit_code));
+    writeString(out, result.output);
+    writeValue(out, static_cast<std::uint8_t>(result.layer != nullptr));
+    if (result.layer) {
+        ColumnarLayer::fromLayer(*result.layer).writeTo(out);
+    }
+}
+
+std::optional<std::pair<ExecutionResult, ResultCache::Clock::time_point> > ResultCache::unspill(
+    const std::string &key) const {
+    if (m_options.spill_directory.empty()) {
+        return std::nullopt;
+    }
+    std::ifstream in(spillPath(key), std::ios::binary);
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    std::string stored_key;
+    std::int64_t expires_at = 0;
+    std::int32_t exit_code = 0;
+    std::uint8_t has_layer = 0;
+    ExecutionResult result;
+    // Distinct keys may share a file name: the stored key tells them apart.
+    if (!in || !readValue(in, magic) || magic != kSpillFileMagic || !readValue(in, version) ||
+        version != kSpillFileVersion || !readString(in, stored_key) || stored_key != key ||
+        !readValue(in, expires_at) || !readValue(in, exit_code) || !readString(in, result.output) || !readValue(in, has_layer)) {
+        return std::nullopt;
+    }
+    if (has_layer) {
+        auto layer = ColumnarLayer::readFrom(in);
+        if (!layer) {
+            return std::nullopt;
+        }
+        result.layer = std::make_shared<const Layer>(layer->toLayer());
+    }
+    result.exit_code = exit_code;
+    return std::pair{std::move(result), Clock::time_point(Clock::duration(expires_at))};
+}
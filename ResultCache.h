@@ -0,0 +1,114 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include "ExecutionResult.h"
+
+namespace Dualys {
+    /**
+     * @struct ResultCacheOptions
+     * @brief Limits of a ResultCache.
+     */
+    struct ResultCacheOptions {
+        /**
+         * @brief Memory budget for the cached results (keys and outputs included).
+         */
+        std::size_t max_bytes = 64 << 20;
+
+        /**
+         * @brief Lifetime of a cached result; zero keeps results until they are evicted.
+         */
+        std::chrono::seconds ttl{0};
+
+        /**
+         * @brief Directory receiving the results evicted from memory; empty disables the spill.
+         */
+        std::filesystem::path spill_directory;
+    };
+
+    /**
+     * @class ResultCache
+     * @brief Bounded, thread-safe memoization of execution results by key.
+     *
+     * Results are kept in memory in least-recently-used order within a byte budget. When the
+     * budget is exceeded, the least recently used results are evicted, and written to the spill
+     * directory if one is configured; a later lookup reloads them from disk. Results older than
+     * the TTL are never returned, from memory or from disk.
+     *
+     * Keys must identify everything the result depends on, e.g. the strategy identifier and the
+     * state digest of the plan (see IExecutionStrategy::cacheKey()).
+     */
+    class ResultCache {
+    public:
+        using Clock = std::chrono::system_clock;
+
+        explicit ResultCache(ResultCacheOptions options = {});
+
+        /**
+         * @brief Returns the result stored under `key`, from memory or from the spill directory.
+         */
+        std::optional<ExecutionResult> find(const std::string &key);
+
+        /**
+         * @brief Stores `result` under `key`, replacing any previous result, then enforces the budget.
+         */
+        void store(const std::string &key, ExecutionResult result);
+
+        /**
+         * @brief Drops every result held in memory. Spilled results are kept.
+         */
+        void clear();
+
+        /**
+         * @brief Returns the number of results held in memory.
+         */
+        std::size_t size() const;
+
+        /**
+         * @brief Returns the number of bytes accounted for the results held in memory.
+         */
+        std::size_t bytes() const;
+
+        std::uint64_t hits() const;
+
+        std::uint64_t misses() const;
+
+        const ResultCacheOptions &options() const;
+
+    private:
+        struct Entry {
+            ExecutionResult result;
+            Clock::time_point expires_at;
+            std::size_t bytes;
+            std::list<std::string>::iterator recency;
+        };
+
+        ResultCacheOptions m_options;
+        mutable std::mutex m_mutex;
+        std::unordered_map<std::string, Entry> m_entries;
+        // Keys from the most to the least recently used.
+        std::list<std::string> m_recency;
+        std::size_t m_bytes = 0;
+        std::uint64_t m_hits = 0;
+        std::uint64_t m_misses = 0;
+
+        void insert(const std::string &key, ExecutionResult result, Clock::time_point expires_at);
+
+        void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+        void evict();
+
+        std::filesystem::path spillPath(const std::string &key) const;
+
+        void spill(const std::string &key, const ExecutionResult &result, Clock::time_point expires_at) const;
+
+        std::optional<std::pair<ExecutionResult, Clock::time_point> > unspill(const std::string &key) const;
+    };
+}
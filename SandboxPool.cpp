@@ -0,0 +1,171 @@
+#include "SandboxPool.h"
+#include <algorithm>
+#include <utility>
+
+using namespace Dualys;
+
+
+Sandbox::Sandbox(ContentDigest module, const std::size_t module_size)
+    : m_module(std::move(module)), m_memory(module_size) {
+}
+
+const ContentDigest &Sandbox::module() const {
+    return m_module;
+}
+
+std::vector<std::byte> &Sandbox::memory() {
+    return m_memory;
+}
+
+void Sandbox::touch(const std::size_t bytes) {
+    m_dirty = std::max(m_dirty, std::min(bytes, m_memory.size()));
+}
+
+void Sandbox::reset() {
+    // Only the dirtied prefix is cleared: the allocation and the compiled code are kept.
+    std::fill_n(m_memory.begin(), m_dirty, std::byte{0});
+    m_dirty = 0;
+    ++m_runs;
+}
+
+std::uint64_t Sandbox::runs() const {
+    return m_runs;
+}
+
+SandboxPool::Lease::Lease(SandboxPool *pool, std::unique_ptr<Sandbox> sandbox, const bool warm)
+    : m_pool(pool), m_sandbox(std::move(sandbox)), m_warm(warm) {
+}
+
+SandboxPool::Lease::Lease(Lease &&other) noexcept
+    : m_pool(other.m_pool), m_sandbox(std::move(other.m_sandbox)), m_warm(other.m_warm) {
+}
+
+SandboxPool::Lease &SandboxPool::Lease::operator=(Lease &&other) noexcept {
+    if (this != &other) {
+        if (m_sandbox) {
+            m_pool->release(std::move(m_sandbox));
+        }
+        m_pool = other.m_pool;
+        m_sandbox = std::move(other.m_sandbox);
+        m_warm = other.m_warm;
+    }
+    return *this;
+}
+
+SandboxPool::Lease::~Lease() {
+    if (m_sandbox) {
+        m_pool->release(std::move(m_sandbox));
+    }
+}
+
+Sandbox &SandboxPool::Lease::operator*() const {
+    return *m_sandbox;
+}
+
+Sandbox *SandboxPool::Lease::operator->() const {
+    return m_sandbox.get();
+}
+
+bool SandboxPool::Lease::warm() const {
+    return m_warm;
+}
+
+SandboxPool::SandboxPool(SandboxPoolOptions options) : m_options(std::move(options)) {
+}
+
+SandboxPool::Lease SandboxPool::acquire(const ContentDigest &module, const std::size_t module_size) {
+    {
+        std::lock_guard lock(m_mutex);
+        if (const auto it = m_idle.find(module); it != m_idle.end()) {
+            auto sandbox = std::move(it->second.back());
+            it->second.pop_back();
+            if (it->second.empty()) {
+                m_idle.erase(it);
+            }
+            --m_idle_count;
+            ++m_warm_starts;
+            return Lease(this, std::move(sandbox), true);
+        }
+        ++m_cold_starts;
+    }
+    // Instantiation is the slow path: it runs outside the lock.
+    return Lease(this, std::make_unique<Sandbox>(module, module_size), false);
+}
+
+std::size_t SandboxPool::prewarm(const ContentDigest &module, const std::size_t module_size, const std::size_t count) {
+    std::size_t created = 0;
+    while (true) {
+        {
+            std::lock_guard lock(m_mutex);
+            const auto it = m_idle.find(module);
+            const std::size_t idle = it == m_idle.end() ? 0 : it->second.size();
+            if (idle >= std::min(count, m_options.max_idle_per_module) || m_idle_count >= m_options.max_idle) {
+                return created;
+            }
+        }
+        auto sandbox = std::make_unique<Sandbox>(module, module_size);
+        std::lock_guard lock(m_mutex);
+        auto &idle = m_idle[module];
+        if (idle.size() >= std::min(count, m_options.max_idle_per_module) || m_idle_count >= m_options.max_idle) {
+            // Filled concurrently by released instances.
+            if (idle.empty()) {
+                m_idle.erase(module);
+            }
+            return created;
+        }
+        idle.push_back(std::move(sandbox));
+        ++m_idle_count;
+        ++created;
+    }
+}
+
+std::size_t SandboxPool::idle() const {
+    std::lock_guard lock(m_mutex);
+    return m_idle_count;
+}
+
+std::size_t SandboxPool::idle(const ContentDigest &module) const {
+    std::lock_guard lock(m_mutex);
+    const auto it = m_idle.find(module);
+    return it == m_idle.end() ? 0 : it->second.size();
+}
+
+std::uint64_t SandboxPool::warmStarts() const {
+    std::lock_guard lock(m_mutex);
+    return m_warm_starts;
+}
+
+std::uint64_t SandboxPool::coldStarts() const {
+    std::lock_guard lock(m_mutex);
+    return m_cold_starts;
+}
+
+void SandboxPool::clear() {
+    std::map<ContentDigest, std::deque<std::unique_ptr<Sandbox> > > idle;
+    {
+        std::lock_guard lock(m_mutex);
+        idle.swap(m_idle);
+        m_idle_count = 0;
+    }
+}
+
+const SandboxPoolOptions &SandboxPool::options() const {
+    return m_options;
+}
+
+void SandboxPool::release(std::unique_ptr<Sandbox> sandbox) {
+    sandbox->reset();
+    std::lock_guard lock(m_mutex);
+    if (m_idle_count >= m_options.max_idle) {
+        return;
+    }
+    auto &idle = m_idle[sandbox->module()];
+    if (idle.size() >= m_options.max_idle_per_module) {
+        if (idle.empty()) {
+            m_idle.erase(sandbox->module());
+        }
+        return;
+    }
+    idle.push_back(std::move(sandbox));
+    ++m_idle_count;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "FileEntry.h"
+
+namespace Dualys {
+    /**
+     * @class Sandbox
+     * @brief An instantiated module: its compiled code and its linear memory.
+     *
+     * Instantiation (compiling the module and allocating its memory) is the expensive part of a
+     * cold start. reset() brings an instance back to its freshly instantiated state at the cost of
+     * clearing the memory it dirtied, so that an instance can serve many runs of the same module.
+     */
+    class Sandbox {
+    public:
+        /**
+         * @brief Instantiates the module of content `module`, whose image is `module_size` bytes.
+         */
+        Sandbox(ContentDigest module, std::size_t module_size);
+
+        const ContentDigest &module() const;
+
+        /**
+         * @brief Returns the linear memory of the instance.
+         */
+        std::vector<std::byte> &memory();
+
+        /**
+         * @brief Marks the first `bytes` of the linear memory as written by the current run.
+         */
+        void touch(std::size_t bytes);
+
+        /**
+         * @brief Clears the memory written since the last reset.
+         */
+        void reset();
+
+        /**
+         * @brief Returns the number of runs served, i.e. of resets plus the current run.
+         */
+        std::uint64_t runs() const;
+
+    private:
+        ContentDigest m_module;
+        std::vector<std::byte> m_memory;
+        std::size_t m_dirty = 0;
+        std::uint64_t m_runs = 1;
+    };
+
+    /**
+     * @struct SandboxPoolOptions
+     * @brief Bounds on the idle instances kept by a SandboxPool.
+     */
+    struct SandboxPoolOptions {
+        /**
+         * @brief Idle instances kept per module; further released instances are destroyed.
+         */
+        std::size_t max_idle_per_module = 4;
+
+        /**
+         * @brief Idle instances kept, all modules included.
+         */
+        std::size_t max_idle = 64;
+    };
+
+    /**
+     * @class SandboxPool
+     * @brief Thread-safe pool of idle sandboxes, keyed by module content.
+     *
+     * acquire() hands out an idle instance of the module when there is one (a warm start) and
+     * instantiates a new one otherwise (a cold start). The lease resets the instance and returns
+     * it to the pool when it goes out of scope. prewarm() instantiates hot modules ahead of the
+     * first run.
+     *
+     * The pool must outlive its leases.
+     */
+    class SandboxPool {
+    public:
+        /**
+         * @class Lease
+         * @brief Exclusive use of a sandbox for one run.
+         */
+        class Lease {
+        public:
+            Lease(Lease &&other) noexcept;
+
+            Lease &operator=(Lease &&other) noexcept;
+
+            ~Lease();
+
+            Sandbox &operator*() const;
+
+            Sandbox *operator->() const;
+
+            /**
+             * @brief Tells whether the sandbox was taken from the pool rather than instantiated.
+             */
+            bool warm() const;
+
+        private:
+            friend class SandboxPool;
+
+            Lease(SandboxPool *pool, std::unique_ptr<Sandbox> sandbox, bool warm);
+
+            SandboxPool *m_pool;
+            std::unique_ptr<Sandbox> m_sandbox;
+            bool m_warm;
+        };
+
+        explicit SandboxPool(SandboxPoolOptions options = {});
+
+        SandboxPool(const SandboxPool &) = delete;
+
+        SandboxPool &operator=(const SandboxPool &) = delete;
+
+        /**
+         * @brief Leases an instance of the module `module`, instantiating it if none is idle.
+         */
+        Lease acquire(const ContentDigest &module, std::size_t module_size);
+
+        /**
+         * @brief Instantiates idle instances of `module` until `count` are idle, within the bounds.
+         * @return The number of instances created.
+         */
+        std::size_t prewarm(const ContentDigest &module, std::size_t module_size, std::size_t count);
+
+        /**
+         * @brief Returns the number of idle instances, all modules included.
+         */
+        std::size_t idle() const;
+
+        /**
+         * @brief Returns the number of idle instances of `module`.
+         */
+        std::size_t idle(const ContentDigest &module) const;
+
+        /**
+         * @brief Returns the number of acquisitions served by an idle instance.
+         */
+        std::uint64_t warmStarts() const;
+
+        /**
+         * @brief Returns the number of acquisitions that had to instantiate the module.
+         */
+        std::uint64_t coldStarts() const;
+
+        /**
+         * @brief Destroys the idle instances.
+         */
+        void clear();
+
+        const SandboxPoolOptions &options() const;
+
+    private:
+        SandboxPoolOptions m_options;
+        mutable std::mutex m_mutex;
+        std::map<ContentDigest, std::deque<std::unique_ptr<Sandbox> > > m_idle;
+        std::size_t m_idle_count = 0;
+        std::uint64_t m_warm_starts = 0;
+        std::uint64_t m_cold_starts = 0;
+
+        void release(std::unique_ptr<Sandbox> sandbox);
+    };
+}
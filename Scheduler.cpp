@@ -0,0 +1,198 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <utility>
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr auto kInteractive = static_cast<std::size_t>(Priority::INTERACTIVE);
+}
+
+void Scheduler::WaitHistogram::record(const std::chrono::microseconds wait) {
+    const auto micros = static_cast<std::uint64_t>(std::max<std::int64_t>(wait.count(), 0));
+    // Bucket b holds the waits in [2^(b-1), 2^b) microseconds; bucket 0 holds the zero waits.
+    const auto bucket = std::min<std::size_t>(std::bit_width(micros), buckets.size() - 1);
+    ++buckets[bucket];
+    ++count;
+    total += wait;
+    max = std::max(max, wait);
+}
+
+std::chrono::microseconds Scheduler::WaitHistogram::percentile(const double fraction) const {
+    if (count == 0) {
+        return std::chrono::microseconds{0};
+    }
+    const auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count - 1)) + 1;
+    std::uint64_t seen = 0;
+    for (std::size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            const auto upper = bucket == 0 ? 0 : (std::uint64_t{1} << bucket) - 1;
+            return std::min(std::chrono::microseconds(upper), max);
+        }
+    }
+    return max;
+}
+
+Scheduler::Scheduler(SchedulerOptions options) : m_options(std::move(options)) {
+    m_options.workers = std::max<std::size_t>(m_options.workers, 1);
+    m_options.reserved_interactive_workers = std::min(m_options.reserved_interactive_workers,
+                                                      m_options.workers - 1);
+    m_workers.reserve(m_options.workers);
+    for (std::size_t i = 0; i < m_options.workers; ++i) {
+        m_workers.emplace_back([this](const std::stop_token stop_token) { work(stop_token); });
+    }
+}
+
+Scheduler::~Scheduler() {
+    for (auto &worker: m_workers) {
+        worker.request_stop();
+    }
+    m_workers.clear();
+}
+
+void Scheduler::setTenantWeight(const std::string &tenant, const double weight) {
+    std::lock_guard lock(m_mutex);
+    m_weights[tenant] = weight > 0 ? weight : 1.0;
+}
+
+bool Scheduler::schedule(const ScheduleOptions &options, Job job) {
+    const auto priority = static_cast<std::size_t>(options.priority);
+    {
+        std::lock_guard lock(m_mutex);
+        auto &queue_class = m_classes[priority];
+        auto &tenant_queued = m_queued_by_tenant[options.tenant];
+        if (m_queued >= m_options.max_queued || tenant_queued >= m_options.max_queued_per_tenant) {
+            if (tenant_queued == 0) {
+                m_queued_by_tenant.erase(options.tenant);
+            }
+            ++queue_class.rejected;
+            return false;
+        }
+        auto &tenant = queue_class.tenants[options.tenant];
+        const double start = std::max(queue_class.virtual_time, tenant.last_finish_tag);
+        tenant.last_finish_tag = start + std::max(options.cost, 0.0) / weightOf(options.tenant);
+        tenant.jobs.push_back(Pending{std::move(job), tenant.last_finish_tag, Clock::now()});
+        ++tenant_queued;
+        ++queue_class.queued;
+        ++queue_class.admitted;
+        ++m_queued;
+    }
+    // Not every worker may take every class: wake them all and let canStart() decide.
+    m_ready.notify_all();
+    return true;
+}
+
+SchedulerMetrics Scheduler::metrics() const {
+    std::lock_guard lock(m_mutex);
+    SchedulerMetrics metrics;
+    for (std::size_t priority = 0; priority < kPriorityCount; ++priority) {
+        const auto &queue_class = m_classes[priority];
+        auto &out = metrics.classes[priority];
+        out.admitted = queue_class.admitted;
+        out.rejected = queue_class.rejected;
+        out.completed = queue_class.completed;
+        out.queued = queue_class.queued;
+        out.running = queue_class.running;
+        if (queue_class.waits.count > 0) {
+            out.wait_mean = queue_class.waits.total / static_cast<std::int64_t>(queue_class.waits.count);
+        }
+        out.wait_p50 = queue_class.waits.percentile(0.50);
+        out.wait_p99 = queue_class.waits.percentile(0.99);
+        out.wait_max = queue_class.waits.max;
+    }
+    return metrics;
+}
+
+const SchedulerOptions &Scheduler::options() const {
+    return m_options;
+}
+
+double Scheduler::weightOf(const std::string &tenant) const {
+    const auto it = m_weights.find(tenant);
+    return it == m_weights.end() ? 1.0 : it->second;
+}
+
+bool Scheduler::canStart(const std::size_t priority) const {
+    if (m_classes[priority].queued == 0) {
+        return false;
+    }
+    if (priority == kInteractive) {
+        return true;
+    }
+    std::size_t running = 0;
+    for (std::size_t other = kInteractive + 1; other < kPriorityCount; ++other) {
+        running += m_classes[other].running;
+    }
+    return running < m_options.workers - m_options.reserved_interactive_workers;
+}
+
+void Scheduler::work(const std::stop_token stop_token) {
+    while (true) {
+        Job job;
+        std::size_t priority = 0;
+        {
+            std::unique_lock lock(m_mutex);
+            const auto next = [this] {
+                for (std::size_t candidate = 0; candidate < kPriorityCount; ++candidate) {
+                    if (m_classes[candidate].queued > 0) {
+                        // Strict priority: a lower class never overtakes a waiting higher one.
+                        return canStart(candidate) ? candidate : kPriorityCount;
+                    }
+                }
+                return kPriorityCount;
+            };
+            // Once stop is requested, the remaining jobs are drained before leaving.
+            m_ready.wait(lock, stop_token, [&] { return next() != kPriorityCount; });
+            priority = next();
+            if (priority == kPriorityCount) {
+                if (m_queued == 0) {
+                    return;
+                }
+                // Stopping with jobs that this worker may not start: wait for a running one to end.
+                m_ready.wait(lock, [&] { return next() != kPriorityCount || m_queued == 0; });
+                priority = next();
+                if (priority == kPriorityCount) {
+                    return;
+                }
+            }
+
+            // Weighted fair queuing: the head with the smallest virtual finish tag goes first.
+            auto &queue_class = m_classes[priority];
+            auto best = queue_class.tenants.end();
+            double best_tag = std::numeric_limits<double>::infinity();
+            for (auto it = queue_class.tenants.begin(); it != queue_class.tenants.end(); ++it) {
+                if (!it->second.jobs.empty() && it->second.jobs.front().finish_tag < best_tag) {
+                    best = it;
+                    best_tag = it->second.jobs.front().finish_tag;
+                }
+            }
+            auto pending = std::move(best->second.jobs.front());
+            best->second.jobs.pop_front();
+            queue_class.virtual_time = std::max(queue_class.virtual_time, pending.finish_tag);
+            if (const auto tenant = m_queued_by_tenant.find(best->first); --tenant->second == 0) {
+                m_queued_by_tenant.erase(tenant);
+            }
+            if (best->second.jobs.empty()) {
+                // An idle tenant restarts from the virtual time: it cannot bank unused share.
+                queue_class.tenants.erase(best);
+            }
+            job = std::move(pending.job);
+            --queue_class.queued;
+            --m_queued;
+            ++queue_class.running;
+            queue_class.waits.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - pending.admitted_at));
+        }
+        job();
+        {
+            std::lock_guard lock(m_mutex);
+            --m_classes[priority].running;
+            ++m_classes[priority].completed;
+        }
+        m_ready.notify_all();
+    }
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Dualys {
+    /**
+     * @enum Priority
+     * @brief Priority class of a run. A class is served only when no higher class is waiting.
+     */
+    enum class Priority {
+        INTERACTIVE,
+        STANDARD,
+        BATCH
+    };
+
+    inline constexpr std::size_t kPriorityCount = 3;
+
+    /**
+     * @struct ScheduleOptions
+     * @brief Who a run is for and how urgent it is.
+     */
+    struct ScheduleOptions {
+        std::string tenant = "default";
+        Priority priority = Priority::STANDARD;
+
+        /**
+         * @brief Expected relative cost of the run, charged to the tenant's fair share.
+         */
+        double cost = 1.0;
+    };
+
+    /**
+     * @struct SchedulerOptions
+     * @brief Capacity and admission limits of a Scheduler.
+     */
+    struct SchedulerOptions {
+        /**
+         * @brief Number of worker threads (at least one).
+         */
+        std::size_t workers = 1;
+
+        /**
+         * @brief Workers kept free of STANDARD and BATCH runs, so that an interactive run never
+         *        waits behind a long batch run. Capped to workers - 1.
+         */
+        std::size_t reserved_interactive_workers = 1;
+
+        /**
+         * @brief Maximum number of queued runs, all tenants included; further runs are rejected.
+         */
+        std::size_t max_queued = 10000;
+
+        /**
+         * @brief Maximum number of queued runs of a single tenant; further runs are rejected.
+         */
+        std::size_t max_queued_per_tenant = 1000;
+    };
+
+    /**
+     * @struct PriorityMetrics
+     * @brief Counters and queue wait times of one priority class.
+     *
+     * Wait times are measured from admission to the start of the run; percentiles are estimated
+     * from power-of-two histogram buckets, so they are upper bounds within a factor of two.
+     */
+    struct PriorityMetrics {
+        std::uint64_t admitted = 0;
+        std::uint64_t rejected = 0;
+        std::uint64_t completed = 0;
+        std::size_t queued = 0;
+        std::size_t running = 0;
+        std::chrono::microseconds wait_mean{0};
+        std::chrono::microseconds wait_p50{0};
+        std::chrono::microseconds wait_p99{0};
+        std::chrono::microseconds wait_max{0};
+    };
+
+    /**
+     * @struct SchedulerMetrics
+     * @brief Snapshot of the metrics of every priority class, indexed by Priority.
+     */
+    struct SchedulerMetrics {
+        std::array<PriorityMetrics, kPriorityCount> classes;
+
+        const PriorityMetrics &operator[](Priority priority) const {
+            return classes[static_cast<std::size_t>(priority)];
+        }
+    };
+
+    /**
+     * @class Scheduler
+     * @brief Runs jobs on a fixed set of workers, by priority class and per-tenant fair share.
+     *
+     * Classes are served in strict priority order. Within a class, tenants share the workers in
+     * proportion to their weights by weighted fair queuing: each job gets a virtual finish tag
+     * (the tenant's previous tag, or the class's virtual time if later, plus cost / weight), and
+     * the job with the smallest tag runs first. A burst from one tenant thus only delays that
+     * tenant's own jobs. Admission control rejects jobs beyond the queue limits instead of letting
+     * queues, and latencies, grow without bound.
+     *
+     * Destroying the scheduler runs the admitted jobs, then joins the workers.
+     */
+    class Scheduler {
+    public:
+        using Job = std::function<void()>;
+
+        explicit Scheduler(SchedulerOptions options = {});
+
+        ~Scheduler();
+
+        Scheduler(const Scheduler &) = delete;
+
+        Scheduler &operator=(const Scheduler &) = delete;
+
+        /**
+         * @brief Sets the share of `tenant` relative to the other tenants (1 by default).
+         */
+        void setTenantWeight(const std::string &tenant, double weight);
+
+        /**
+         * @brief Queues `job` for `options.tenant` in class `options.priority`.
+         * @return false, without queuing the job, if admission control rejects it.
+         */
+        bool schedule(const ScheduleOptions &options, Job job);
+
+        /**
+         * @brief Returns a snapshot of the queue depths, counters and wait times.
+         */
+        SchedulerMetrics metrics() const;
+
+        const SchedulerOptions &options() const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Pending {
+            Job job;
+            double finish_tag;
+            Clock::time_point admitted_at;
+        };
+
+        struct TenantQueue {
+            std::deque<Pending> jobs;
+            double last_finish_tag = 0;
+        };
+
+        /**
+         * Power-of-two histogram of wait times, in microseconds.
+         */
+        struct WaitHistogram {
+            std::array<std::uint64_t, 40> buckets{};
+            std::uint64_t count = 0;
+            std::chrono::microseconds total{0};
+            std::chrono::microseconds max{0};
+
+            void record(std::chrono::microseconds wait);
+
+            std::chrono::microseconds percentile(double fraction) const;
+        };
+
+        struct PriorityClass {
+            std::map<std::string, TenantQueue> tenants;
+            double virtual_time = 0;
+            std::size_t queued = 0;
+            std::size_t running = 0;
+            std::uint64_t admitted = 0;
+            std::uint64_t rejected = 0;
+            std::uint64_t completed = 0;
+            WaitHistogram waits;
+        };
+
+        SchedulerOptions m_options;
+        mutable std::mutex m_mutex;
+        std::condition_variable_any m_ready;
+        std::array<PriorityClass, kPriorityCount> m_classes;
+        std::map<std::string, double> m_weights;
+        std::map<std::string, std::size_t> m_queued_by_tenant;
+        std::size_t m_queued = 0;
+        std::vector<std::jthread> m_workers;
+
+        double weightOf(const std::string &tenant) const;
+
+        bool canStart(std::size_t priority) const;
+
+        void work(std::stop_token stop_token);
+    };
+}
@@ -0,0 +1,447 @@
+#include "SnapshotStore.h"
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <fstream>
+#include <span>
+#include <spanstream>
+#include <sstream>
+#include <unistd.h>
+#include <utility>
+#include "BinaryIO.h"
+#include "ColumnarLayer.h"
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr std::uint32_t kSegmentMagic = 0x47534c50; // "PLSG"
+    constexpr std::uint32_t kSegmentVersion = 1;
+
+    enum class RecordKind : std::uint8_t {
+        // A plan stored in full, replacing any previous version.
+        PLAN = 1,
+        // Layers appended to a stored plan.
+        LAYERS = 2,
+        // A plan removed from the snapshot.
+        DROP = 3
+    };
+
+    /**
+     * A plan whose layers are kept encoded: compaction copies them without decoding them.
+     */
+    struct EncodedPlan {
+        std::optional<std::string> base_id;
+        std::vector<std::string> layers;
+    };
+
+    using EncodedGraph = std::map<std::string, EncodedPlan>;
+
+    std::string encodeLayer(const Layer &layer) {
+        std::ostringstream out;
+        ColumnarLayer::fromLayer(layer).writeTo(out);
+        return std::move(out).str();
+    }
+
+    void writePlanRecord(std::ostream &out, const std::string &id, const std::optional<std::string> &base_id) {
+        writeValue(out, RecordKind::PLAN);
+        writeString(out, id);
+        writeValue(out, static_cast<std::uint8_t>(base_id.has_value()));
+        writeString(out, base_id.value_or(std::string()));
+    }
+
+    /**
+     * Reads the layers of a record; without `with_layers`, only their count is kept (as empty strings).
+     */
+    bool readLayers(std::istream &in, std::vector<std::string> &layers, const bool with_layers) {
+        std::uint32_t count = 0;
+        if (!readValue(in, count)) {
+            return false;
+        }
+        std::string skipped;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            auto &layer = layers.emplace_back();
+            if (!readString(in, with_layers ? layer : skipped)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Applies the records of the segment file `path` to `graph`.
+     */
+    bool replay(const std::filesystem::path &path, EncodedGraph &graph, const bool with_layers = true) {
+        std::ifstream in(path, std::ios::binary);
+        std::uint32_t magic = 0;
+        std::uint32_t version = 0;
+        std::uint64_t first = 0;
+        std::uint64_t last = 0;
+        std::uint32_t record_count = 0;
+        if (!in || !readValue(in, magic) || magic != kSegmentMagic || !readValue(in, version) ||
+            version != kSegmentVersion || !readValue(in, first) || !readValue(in, last) ||
+            !readValue(in, record_count)) {
+            return false;
+        }
+        for (std::uint32_t i = 0; i < record_count; ++i) {
+            RecordKind kind{};
+            std::string id;
+            if (!readValue(in, kind) || !readString(in, id)) {
+                return false;
+            }
+            switch (kind) {
+                case RecordKind::PLAN: {
+                    std::uint8_t has_base = 0;
+                    std::string base_id;
+                    EncodedPlan plan;
+                    if (!readValue(in, has_base) || !readString(in, base_id) ||
+                        !readLayers(in, plan.layers, with_layers)) {
+                        return false;
+                    }
+                    if (has_base != 0) {
+                        plan.base_id = std::move(base_id);
+                    }
+                    graph.insert_or_assign(std::move(id), std::move(plan));
+                    break;
+                }
+                case RecordKind::LAYERS: {
+                    const auto plan = graph.find(id);
+                    std::uint32_t start = 0;
+                    // The layers must extend the stored plan exactly.
+                    if (plan == graph.end() || !readValue(in, start) || start != plan->second.layers.size() ||
+                        !readLayers(in, plan->second.layers, with_layers)) {
+                        return false;
+                    }
+                    break;
+                }
+                case RecordKind::DROP:
+                    graph.erase(id);
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Flushes the file or directory at `path` to stable storage.
+     */
+    bool syncPath(const std::filesystem::path &path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        const bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        return synced;
+    }
+
+    /**
+     * Writes a segment through a temporary file renamed into place, so that a segment is either
+     * complete or absent. The file is synced before the rename and the directory after it, so a
+     * crash cannot leave a renamed segment with missing content, or lose a save reported done.
+     */
+    bool writeSegment(const std::filesystem::path &path, const std::uint64_t first, const std::uint64_t last,
+                      const std::uint32_t record_count, const std::string &records, std::uint64_t &bytes) {
+        auto temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            writeValue(out, kSegmentMagic);
+            writeValue(out, kSegmentVersion);
+            writeValue(out, first);
+            writeValue(out, last);
+            writeValue(out, record_count);
+            out.write(records.data(), static_cast<std::streamsize>(records.size()));
+            if (!out.flush()) {
+                std::error_code error;
+                std::filesystem::remove(temporary, error);
+                return false;
+            }
+            bytes = static_cast<std::uint64_t>(out.tellp());
+        }
+        std::error_code error;
+        if (!syncPath(temporary)) {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        return syncPath(path.parent_path());
+    }
+
+    /**
+     * Parses "segment-<first>-<last>.snap".
+     */
+    bool parseSegmentName(const std::string &name, std::uint64_t &first, std::uint64_t &last) {
+        constexpr std::string_view prefix = "segment-";
+        constexpr std::string_view suffix = ".snap";
+        if (!name.starts_with(prefix) || !name.ends_with(suffix)) {
+            return false;
+        }
+        const char *begin = name.data() + prefix.size();
+        const char *end = name.data() + name.size() - suffix.size();
+        auto [separator, error] = std::from_chars(begin, end, first);
+        if (error != std::errc() || separator == end || *separator != '-') {
+            return false;
+        }
+        auto [rest, last_error] = std::from_chars(separator + 1, end, last);
+        return last_error == std::errc() && rest == end && first >= 1 && first <= last;
+    }
+}
+
+SnapshotStore::SnapshotStore(std::filesystem::path directory, const SnapshotOptions options)
+    : m_directory(std::move(directory)), m_options(options) {
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+
+    std::vector<std::pair<Segment, std::filesystem::path> > found;
+    for (const auto &entry: std::filesystem::directory_iterator(m_directory, error)) {
+        const auto name = entry.path().filename().string();
+        if (Segment segment; parseSegmentName(name, segment.first, segment.last)) {
+            found.emplace_back(segment, entry.path());
+        } else if (name.starts_with("segment-") && name.ends_with(".tmp")) {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+    // From save 1 on, the longest segment starting right after the previous one.
+    std::uint64_t next = 1;
+    while (true) {
+        const Segment *longest = nullptr;
+        for (const auto &[segment, path]: found) {
+            if (segment.first == next && (!longest || segment.last > longest->last)) {
+                longest = &segment;
+            }
+        }
+        if (!longest) {
+            break;
+        }
+        m_segments.push_back(*longest);
+        next = longest->last + 1;
+    }
+    for (const auto &[segment, path]: found) {
+        if (std::ranges::none_of(m_segments, [&](const Segment &kept) {
+            return kept.first == segment.first && kept.last == segment.last;
+        })) {
+            std::filesystem::remove(path, error);
+        }
+    }
+
+    // What the snapshot holds, so that the next save drops the plans it no longer lists. Plans
+    // adopted after load() are extended; the others are stored again in full.
+    EncodedGraph graph;
+    if (std::ranges::all_of(m_segments, [&](const Segment &segment) {
+        return replay(segmentPath(segment), graph, false);
+    })) {
+        for (const auto &[id, encoded]: graph) {
+            m_stored.emplace(id, Stored{{}, encoded.base_id, encoded.layers.size(), {}});
+        }
+    }
+
+    if (m_options.compact_after_segments > 0) {
+        m_compactor = std::jthread([this](const std::stop_token stop_token) { compactInBackground(stop_token); });
+    }
+}
+
+SnapshotStore::~SnapshotStore() = default;
+
+bool SnapshotStore::save(const std::vector<std::shared_ptr<const Plan> > &plans) {
+    std::lock_guard lock(m_mutex);
+    std::ostringstream records;
+    std::uint32_t record_count = 0;
+    std::map<std::string, Stored> stored;
+    for (const auto &plan: plans) {
+        if (!plan || stored.contains(plan->getId())) {
+            continue;
+        }
+        const auto &id = plan->getId();
+        const auto layers = plan->getLayers();
+        std::optional<std::string> base_id;
+        if (plan->getBasePlan()) {
+            base_id = plan->getBasePlan()->getId();
+        }
+
+        // A stored plan grows only by appending layers: the last stored layer must still be there.
+        const auto previous = m_stored.find(id);
+        const bool extends = previous != m_stored.end() && previous->second.plan.lock() == plan &&
+                             previous->second.base_id == base_id &&
+                             layers.size() >= previous->second.layer_count &&
+                             (previous->second.layer_count == 0 ||
+                              layers[previous->second.layer_count - 1] == previous->second.last_layer.lock());
+        const std::size_t start = extends ? previous->second.layer_count : 0;
+        if (!extends) {
+            writePlanRecord(records, id, base_id);
+            ++record_count;
+        } else if (start < layers.size()) {
+            writeValue(records, RecordKind::LAYERS);
+            writeString(records, id);
+            writeValue(records, static_cast<std::uint32_t>(start));
+            ++record_count;
+        }
+        if (!extends || start < layers.size()) {
+            writeValue(records, static_cast<std::uint32_t>(layers.size() - start));
+            for (std::size_t i = start; i < layers.size(); ++i) {
+                writeString(records, encodeLayer(*layers[i]));
+            }
+        }
+        stored.emplace(id, Stored{plan, std::move(base_id), layers.size(), layers.empty() ? nullptr : layers.back()});
+    }
+    for (const auto &[id, previous]: m_stored) {
+        if (!stored.contains(id)) {
+            writeValue(records, RecordKind::DROP);
+            writeString(records, id);
+            ++record_count;
+        }
+    }
+
+    if (record_count == 0) {
+        m_last_save_bytes = 0;
+        return true;
+    }
+    const std::uint64_t save = m_segments.empty() ? 1 : m_segments.back().last + 1;
+    const Segment segment{save, save};
+    std::uint64_t bytes = 0;
+    if (!writeSegment(segmentPath(segment), save, save, record_count, std::move(records).str(), bytes)) {
+        return false;
+    }
+    m_segments.push_back(segment);
+    m_stored = std::move(stored);
+    m_last_save_bytes = bytes;
+    if (m_options.compact_after_segments > 0 && m_segments.size() > m_options.compact_after_segments) {
+        m_compaction_needed.notify_one();
+    }
+    return true;
+}
+
+std::optional<std::map<std::string, SnapshotPlan> > SnapshotStore::load() {
+    std::lock_guard lock(m_mutex);
+    EncodedGraph graph;
+    for (const auto &segment: m_segments) {
+        if (!replay(segmentPath(segment), graph)) {
+            return std::nullopt;
+        }
+    }
+    std::map<std::string, SnapshotPlan> plans;
+    std::map<std::string, Stored> stored;
+    for (auto &[id, encoded]: graph) {
+        SnapshotPlan plan{encoded.base_id, {}};
+        plan.layers.reserve(encoded.layers.size());
+        for (auto &bytes: encoded.layers) {
+            std::ispanstream in(std::span(bytes.data(), bytes.size()));
+            auto layer = ColumnarLayer::readFrom(in);
+            if (!layer) {
+                return std::nullopt;
+            }
+            plan.layers.push_back(std::make_shared<const Layer>(layer->toLayer()));
+        }
+        stored.emplace(id, Stored{{}, encoded.base_id, plan.layers.size(), {}});
+        plans.emplace(id, std::move(plan));
+    }
+    m_stored = std::move(stored);
+    return plans;
+}
+
+bool SnapshotStore::adopt(const std::shared_ptr<const Plan> &plan) {
+    std::lock_guard lock(m_mutex);
+    const auto it = m_stored.find(plan->getId());
+    const auto layers = plan->getLayers();
+    if (it == m_stored.end() || it->second.layer_count != layers.size() ||
+        it->second.base_id != (plan->getBasePlan() ? std::optional(plan->getBasePlan()->getId()) : std::nullopt)) {
+        return false;
+    }
+    it->second.plan = plan;
+    it->second.last_layer = layers.empty() ? nullptr : layers.back();
+    return true;
+}
+
+bool SnapshotStore::compact() {
+    return compactSegments();
+}
+
+bool SnapshotStore::compactSegments() {
+    std::lock_guard compaction(m_compaction_mutex);
+    std::vector<Segment> merged;
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_segments.size() < 2) {
+            return true;
+        }
+        merged = m_segments;
+    }
+
+    // Saves only append segments: the ones merged stay the first ones, untouched.
+    EncodedGraph graph;
+    for (const auto &segment: merged) {
+        if (!replay(segmentPath(segment), graph)) {
+            return false;
+        }
+    }
+    std::ostringstream records;
+    for (const auto &[id, plan]: graph) {
+        writePlanRecord(records, id, plan.base_id);
+        writeValue(records, static_cast<std::uint32_t>(plan.layers.size()));
+        for (const auto &bytes: plan.layers) {
+            writeString(records, bytes);
+        }
+    }
+    const Segment compacted{merged.front().first, merged.back().last};
+    std::uint64_t bytes = 0;
+    if (!writeSegment(segmentPath(compacted), compacted.first, compacted.last,
+                      static_cast<std::uint32_t>(graph.size()), std::move(records).str(), bytes)) {
+        return false;
+    }
+    {
+        std::lock_guard lock(m_mutex);
+        m_segments.erase(m_segments.begin(), m_segments.begin() + static_cast<std::ptrdiff_t>(merged.size()));
+        m_segments.insert(m_segments.begin(), compacted);
+        ++m_compactions;
+    }
+    std::error_code error;
+    for (const auto &segment: merged) {
+        std::filesystem::remove(segmentPath(segment), error);
+    }
+    return true;
+}
+
+void SnapshotStore::compactInBackground(const std::stop_token stop_token) {
+    // After a failure, waits for more segments rather than retrying at once.
+    std::size_t failed_at = 0;
+    while (true) {
+        {
+            std::unique_lock lock(m_mutex);
+            if (!m_compaction_needed.wait(lock, stop_token, [&] {
+                return m_segments.size() > std::max(m_options.compact_after_segments, failed_at);
+            })) {
+                return;
+            }
+        }
+        failed_at = compactSegments() ? 0 : segmentCount();
+    }
+}
+
+std::size_t SnapshotStore::segmentCount() const {
+    std::lock_guard lock(m_mutex);
+    return m_segments.size();
+}
+
+std::uint64_t SnapshotStore::lastSaveBytes() const {
+    std::lock_guard lock(m_mutex);
+    return m_last_save_bytes;
+}
+
+std::uint64_t SnapshotStore::compactions() const {
+    std::lock_guard lock(m_mutex);
+    return m_compactions;
+}
+
+const std::filesystem::path &SnapshotStore::directory() const {
+    return m_directory;
+}
+
+std::filesystem::path SnapshotStore::segmentPath(const Segment &segment) const {
+    return m_directory / ("segment-" + std::to_string(segment.first) + "-" + std::to_string(segment.last) + ".snap");
+}
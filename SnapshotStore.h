@@ -0,0 +1,167 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Layer.h"
+#include "Plan.h"
+
+namespace Dualys {
+    /**
+     * @struct SnapshotOptions
+     * @brief Compaction policy of a SnapshotStore.
+     */
+    struct SnapshotOptions {
+        /**
+         * @brief The background job merges the segments once there are more than this many.
+         *
+         * Zero disables background compaction; compact() can still be called.
+         */
+        std::size_t compact_after_segments = 8;
+    };
+
+    /**
+     * @struct SnapshotPlan
+     * @brief A plan as stored in a snapshot: its base identifier and its own layers.
+     */
+    struct SnapshotPlan {
+        std::optional<std::string> base_id;
+        std::vector<std::shared_ptr<const Layer> > layers;
+    };
+
+    /**
+     * @class SnapshotStore
+     * @brief Incremental snapshots of a plan graph in a directory of segment files.
+     *
+     * Each save() writes one new segment holding only what changed since the previous save:
+     * the plans it has not stored yet, the layers appended to the plans it already stored
+     * (layers are immutable, so those are never written again), and the plans that are gone.
+     * A segment only makes sense on top of the segments before it; reading a snapshot replays
+     * them in order.
+     *
+     * Compaction merges the oldest segments into one holding their final state, written next to
+     * them and swapped in atomically, then deletes them. A background job does it once there are
+     * more than compact_after_segments segments; saves proceed meanwhile.
+     *
+     * Segments are named segment-<first>-<last>.snap after the range of saves they cover, and
+     * each one records that range: a segment refers to the segments ending at save first - 1.
+     * At opening, the chain of segments covering saves 1..n is selected and the files outside
+     * it (left over by an interrupted compaction) are deleted.
+     */
+    class SnapshotStore {
+    public:
+        /**
+         * @brief Opens the snapshot in `directory`, creating the directory if needed.
+         *
+         * The segments are replayed to learn which plans the snapshot holds, so that the first
+         * save() drops those it does not list. Until adopt() is called for a plan, that save
+         * stores it again in full.
+         */
+        explicit SnapshotStore(std::filesystem::path directory, SnapshotOptions options = {});
+
+        /**
+         * @brief Waits for a running compaction, then stops the background job.
+         */
+        ~SnapshotStore();
+
+        SnapshotStore(const SnapshotStore &) = delete;
+
+        SnapshotStore &operator=(const SnapshotStore &) = delete;
+
+        /**
+         * @brief Saves `plans`, incrementally; each plan is stored with the identifier of its base.
+         *
+         * Stored plans missing from `plans` are dropped from the snapshot. A plan is rewritten in
+         * full only if it was replaced by another plan of the same identifier.
+         *
+         * @return false if the segment could not be written; the next save retries the same delta.
+         */
+        bool save(const std::vector<std::shared_ptr<const Plan> > &plans);
+
+        /**
+         * @brief Reads the graph stored in the snapshot.
+         *
+         * The plans returned are then known to be stored: pass them to adopt() once rebuilt so
+         * that the next save() only writes what changes afterwards.
+         *
+         * @return The plans by identifier, or std::nullopt if a segment is unreadable or malformed.
+         */
+        std::optional<std::map<std::string, SnapshotPlan> > load();
+
+        /**
+         * @brief Records that `plan`, rebuilt from load(), matches its stored version.
+         *
+         * @return false if the snapshot holds no plan with this identifier or this many layers.
+         */
+        bool adopt(const std::shared_ptr<const Plan> &plan);
+
+        /**
+         * @brief Merges every segment into one, synchronously.
+         * @return false if the merged segment could not be written; the segments are then kept.
+         */
+        bool compact();
+
+        /**
+         * @brief Returns the number of segment files making up the snapshot.
+         */
+        std::size_t segmentCount() const;
+
+        /**
+         * @brief Returns the size of the segment written by the last save(), in bytes.
+         */
+        std::uint64_t lastSaveBytes() const;
+
+        /**
+         * @brief Returns the number of compactions completed.
+         */
+        std::uint64_t compactions() const;
+
+        const std::filesystem::path &directory() const;
+
+    private:
+        struct Segment {
+            std::uint64_t first = 0;
+            std::uint64_t last = 0;
+        };
+
+        /**
+         * @brief What the snapshot holds for a plan, to tell what a save must add.
+         */
+        struct Stored {
+            std::weak_ptr<const Plan> plan;
+            std::optional<std::string> base_id;
+            std::size_t layer_count = 0;
+            std::weak_ptr<const Layer> last_layer;
+        };
+
+        std::filesystem::path m_directory;
+        SnapshotOptions m_options;
+
+        mutable std::mutex m_mutex;
+        std::vector<Segment> m_segments;
+        std::map<std::string, Stored> m_stored;
+        std::uint64_t m_last_save_bytes = 0;
+        std::uint64_t m_compactions = 0;
+
+        // Serializes compactions, between the background job and compact().
+        std::mutex m_compaction_mutex;
+        std::condition_variable_any m_compaction_needed;
+
+        // Declared last: the background job uses every other member.
+        std::jthread m_compactor;
+
+        std::filesystem::path segmentPath(const Segment &segment) const;
+
+        bool compactSegments();
+
+        void compactInBackground(std::stop_token stop_token);
+    };
+}
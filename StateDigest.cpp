@@ -0,0 +1,113 @@
+#include "StateDigest.h"
+
+using namespace Dualys;
+
+
+namespace {
+    constexpr std::array<std::uint64_t, 4> kLaneSeeds{
+        0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+    };
+
+    std::uint64_t mix(std::uint64_t value) {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ULL;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebULL;
+        value ^= value >> 31;
+        return value;
+    }
+
+    /**
+     * Streaming 64-bit hash over little-endian words; the length of each field is absorbed too,
+     * so that concatenations of different fields never collide trivially.
+     */
+    class Hasher {
+    public:
+        explicit Hasher(const std::uint64_t seed)
+            : m_state(seed) {
+        }
+
+        void word(const std::uint64_t value) {
+            m_state = mix(m_state ^ mix(value + 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+        }
+
+        void bytes(const std::string_view data) {
+            word(data.size());
+            std::size_t offset = 0;
+            for (; offset + 8 <= data.size(); offset += 8) {
+                std::uint64_t value = 0;
+                for (std::size_t i = 0; i < 8; ++i) {
+                    value |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[offset + i])) << (8 * i);
+                }
+                word(value);
+            }
+            std::uint64_t tail = 0;
+            for (std::size_t i = 0; offset + i < data.size(); ++i) {
+                tail |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[offset + i])) << (8 * i);
+            }
+            word(tail);
+        }
+
+        std::uint64_t finish() const {
+            return mix(m_state);
+        }
+
+    private:
+        std::uint64_t m_state;
+    };
+}
+
+StateDigest StateDigest::of(const std::string_view path, const FileEntry &entry) {
+    StateDigest digest;
+    for (std::size_t lane = 0; lane < kLaneSeeds.size(); ++lane) {
+        Hasher hasher(kLaneSeeds[lane]);
+        hasher.bytes(path);
+        hasher.word(entry.metadata.size);
+        hasher.word(static_cast<std::uint64_t>(entry.metadata.mode) << 32 | static_cast<std::uint8_t>(entry.metadata.type));
+        hasher.word(static_cast<std::uint64_t>(entry.metadata.uid) << 32 | entry.metadata.gid);
+        // The same bytes stand for different hashes in each encoding (e.g. a raw hash and the hex
+        // digest of the same bytes).
+        hasher.word(entry.digest.isInterned() ? 2 : entry.digest.isHex() ? 1 : 0);
+        hasher.bytes(entry.digest.bytes());
+        digest.m_lanes[lane] = hasher.finish();
+    }
+    return digest;
+}
+
+StateDigest StateDigest::of(const std::map<std::string, FileEntry> &state) {
+    StateDigest digest;
+    for (const auto &[path, entry]: state) {
+        digest += of(path, entry);
+    }
+    return digest;
+}
+
+StateDigest &StateDigest::operator+=(const StateDigest &other) {
+    for (std::size_t lane = 0; lane < m_lanes.size(); ++lane) {
+        m_lanes[lane] += other.m_lanes[lane];
+    }
+    return *this;
+}
+
+StateDigest &StateDigest::operator-=(const StateDigest &other) {
+    for (std::size_t lane = 0; lane < m_lanes.size(); ++lane) {
+        m_lanes[lane] -= other.m_lanes[lane];
+    }
+    return *this;
+}
+
+std::string StateDigest::str() const {
+    constexpr char kHexDigits[] = "0123456789abcdef";
+    std::string result;
+    result.reserve(m_lanes.size() * 16);
+    for (const auto lane: m_lanes) {
+        for (int shift = 60; shift >= 0; shift -= 4) {
+            result.push_back(kHexDigits[(lane >> shift) & 0xf]);
+        }
+    }
+    return result;
+}
+
+std::size_t StateDigest::hash() const {
+    return static_cast<std::size_t>(m_lanes[0]);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include "FileEntry.h"
+
+namespace Dualys {
+    /**
+     * @class StateDigest
+     * @brief Order-independent 256-bit digest of a filesystem state.
+     *
+     * The digest of a state is the sum, lane by lane modulo 2^64, of a hash of each (path, entry)
+     * pair. Adding or removing one entry therefore updates the digest in O(1) without looking at
+     * the rest of the state, and two states with the same entries have the same digest however
+     * they were produced.
+     *
+     * The entry hash is stable across runs and platforms, so digests can be persisted and used as
+     * cache keys. It is not meant to resist deliberately crafted collisions.
+     */
+    class StateDigest {
+    public:
+        StateDigest() = default;
+
+        /**
+         * @brief Returns the contribution of a single entry.
+         */
+        static StateDigest of(std::string_view path, const FileEntry &entry);
+
+        /**
+         * @brief Returns the digest of a materialized state. O(n).
+         */
+        static StateDigest of(const std::map<std::string, FileEntry> &state);
+
+        StateDigest &operator+=(const StateDigest &other);
+
+        StateDigest &operator-=(const StateDigest &other);
+
+        friend StateDigest operator+(StateDigest lhs, const StateDigest &rhs) {
+            return lhs += rhs;
+        }
+
+        friend StateDigest operator-(StateDigest lhs, const StateDigest &rhs) {
+            return lhs -= rhs;
+        }
+
+        bool operator==(const StateDigest &) const = default;
+
+        /**
+         * @brief Returns the digest as 64 lowercase hexadecimal characters.
+         */
+        std::string str() const;
+
+        /**
+         * @brief Returns 64 bits of the digest, for use in hash tables.
+         */
+        std::size_t hash() const;
+
+    private:
+        std::array<std::uint64_t, 4> m_lanes{};
+    };
+}
+
+template<>
+struct std::hash<Dualys::StateDigest> {
+    std::size_t operator()(const Dualys::StateDigest &digest) const noexcept {
+        return digest.hash();
+    }
+};
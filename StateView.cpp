@@ -0,0 +1,93 @@
+#include "StateView.h"
+#include "PathUtils.h"
+
+using namespace Dualys;
+
+
+void StateView::reset(const PathTrie &state) {
+    clear();
+    state.forEach([this](const std::string &path, const FileEntry &entry) {
+        update(path, nullptr, &entry);
+    });
+}
+
+void FileTypeCountView::update(std::string_view, const FileEntry *before, const FileEntry *after) {
+    if (before) {
+        const auto type = static_cast<std::size_t>(before->metadata.type);
+        --m_counts[type];
+        m_bytes[type] -= before->metadata.size;
+    }
+    if (after) {
+        const auto type = static_cast<std::size_t>(after->metadata.type);
+        ++m_counts[type];
+        m_bytes[type] += after->metadata.size;
+    }
+}
+
+std::size_t FileTypeCountView::count(const FileType type) const {
+    return m_counts[static_cast<std::size_t>(type)];
+}
+
+std::uint64_t FileTypeCountView::bytes(const FileType type) const {
+    return m_bytes[static_cast<std::size_t>(type)];
+}
+
+std::size_t FileTypeCountView::size() const {
+    std::size_t total = 0;
+    for (const auto count: m_counts) {
+        total += count;
+    }
+    return total;
+}
+
+void FileTypeCountView::clear() {
+    m_counts = {};
+    m_bytes = {};
+}
+
+PrefixView::PrefixView(std::string directory)
+    : m_directory(std::move(directory)) {
+}
+
+void PrefixView::reset(const PathTrie &state) {
+    clear();
+    if (const auto *entry = state.find(m_directory)) {
+        m_entries.emplace(m_directory, *entry);
+    }
+    state.forEachWithPrefix(subtreePrefix(m_directory), [this](const std::string &path, const FileEntry &entry) {
+        m_entries.emplace_hint(m_entries.end(), path, entry);
+    });
+}
+
+void PrefixView::update(const std::string_view path, const FileEntry *, const FileEntry *after) {
+    if (!isInSubtree(path, m_directory)) {
+        return;
+    }
+    if (!after) {
+        if (const auto it = m_entries.find(path); it != m_entries.end()) {
+            m_entries.erase(it);
+        }
+        return;
+    }
+    if (const auto it = m_entries.find(path); it != m_entries.end()) {
+        it->second = *after;
+    } else {
+        m_entries.emplace(path, *after);
+    }
+}
+
+const std::string &PrefixView::directory() const {
+    return m_directory;
+}
+
+const std::map<std::string, FileEntry, std::less<> > &PrefixView::entries() const {
+    return m_entries;
+}
+
+std::size_t PrefixView::size() const {
+    return m_entries.size();
+}
+
+void PrefixView::clear() {
+    m_entries.clear();
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include "FileEntry.h"
+#include "PathTrie.h"
+
+namespace Dualys {
+    /**
+     * @brief Number of values of the FileType enum.
+     */
+    inline constexpr std::size_t kFileTypeCount = 3;
+
+    /**
+     * @class StateView
+     * @brief Data derived from a plan's state, kept up to date entry by entry (see Plan::attachView()).
+     *
+     * A view is built once from the whole state, then receives the entries each applied layer
+     * changes, so that it never scans the state again. Reads on the view are as cheap as the view
+     * makes them, typically O(1).
+     */
+    class StateView {
+    public:
+        virtual ~StateView() = default;
+
+        /**
+         * @brief Rebuilds the view from a whole state: when attached, or when the base plan changed.
+         *
+         * The default implementation clears the view and reports every entry as added.
+         */
+        virtual void reset(const PathTrie &state);
+
+        /**
+         * @brief Reports that the entry at `path` changed.
+         *
+         * @param before The entry before the change, or nullptr if the path had none.
+         * @param after The entry after the change, or nullptr if the path has none any more.
+         */
+        virtual void update(std::string_view path, const FileEntry *before, const FileEntry *after) = 0;
+
+    protected:
+        /**
+         * @brief Empties the view, before reset() reports the entries of a whole state.
+         */
+        virtual void clear() = 0;
+    };
+
+    /**
+     * @class FileTypeCountView
+     * @brief Number of entries and bytes of the state, by file type.
+     */
+    class FileTypeCountView : public StateView {
+    public:
+        void update(std::string_view path, const FileEntry *before, const FileEntry *after) override;
+
+        std::size_t count(FileType type) const;
+
+        /**
+         * @brief Returns the total size of the entries of `type`.
+         */
+        std::uint64_t bytes(FileType type) const;
+
+        /**
+         * @brief Returns the number of entries of every type.
+         */
+        std::size_t size() const;
+
+    protected:
+        void clear() override;
+
+    private:
+        std::array<std::size_t, kFileTypeCount> m_counts{};
+        std::array<std::uint64_t, kFileTypeCount> m_bytes{};
+    };
+
+    /**
+     * @class PrefixView
+     * @brief The entries of one subtree of the state, sorted by path.
+     */
+    class PrefixView : public StateView {
+    public:
+        /**
+         * @brief Lists the subtree of `directory`: the directory itself and its descendants.
+         */
+        explicit PrefixView(std::string directory);
+
+        void reset(const PathTrie &state) override;
+
+        void update(std::string_view path, const FileEntry *before, const FileEntry *after) override;
+
+        const std::string &directory() const;
+
+        const std::map<std::string, FileEntry, std::less<> > &entries() const;
+
+        std::size_t size() const;
+
+    protected:
+        void clear() override;
+
+    private:
+        std::string m_directory;
+        std::map<std::string, FileEntry, std::less<> > m_entries;
+    };
+}
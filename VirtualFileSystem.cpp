@@ -0,0 +1,126 @@
+#include "VirtualFileSystem.h"
+#include "LayerBuilder.h"
+#include "PathUtils.h"
+#include <iterator>
+#include <utility>
+#include <vector>
+
+using namespace Dualys;
+
+
+namespace {
+    bool isDirectory(const FileEntry &entry) {
+        return entry.metadata.type == FileType::DIRECTORY;
+    }
+}
+
+VirtualFileSystem::VirtualFileSystem(std::shared_ptr<const Plan> plan)
+    : m_plan(std::move(plan)) {
+}
+
+const std::shared_ptr<const Plan> &VirtualFileSystem::getPlan() const {
+    return m_plan;
+}
+
+std::optional<FileEntry> VirtualFileSystem::stat(const std::string_view path) const {
+    return resolve(normalizePath(path));
+}
+
+bool VirtualFileSystem::exists(const std::string_view path) const {
+    return stat(path).has_value();
+}
+
+void VirtualFileSystem::writeFile(const std::string_view path, const std::string_view content_hash,
+                                  const std::uint64_t size, const std::uint32_t mode) {
+    auto normalized = normalizePath(path);
+    const auto entry = resolve(normalized);
+    if (entry && entry->metadata.type == FileType::REGULAR) {
+        record({std::move(normalized), ChangeType::MODIFIED, std::string(content_hash), {.size = size}});
+        return;
+    }
+    if (entry) {
+        record({normalized, isDirectory(*entry) ? ChangeType::DIRECTORY_REMOVED : ChangeType::REMOVED, {}});
+    }
+    record({std::move(normalized), ChangeType::ADDED, std::string(content_hash), {.size = size, .mode = mode}});
+}
+
+bool VirtualFileSystem::makeDirectory(const std::string_view path, const std::uint32_t mode) {
+    auto normalized = normalizePath(path);
+    if (resolve(normalized)) {
+        return false;
+    }
+    record({std::move(normalized), ChangeType::ADDED, {}, {.mode = mode, .type = FileType::DIRECTORY}});
+    return true;
+}
+
+bool VirtualFileSystem::setPermissions(const std::string_view path, const std::uint32_t mode, const std::uint32_t uid,
+                                       const std::uint32_t gid) {
+    auto normalized = normalizePath(path);
+    if (!resolve(normalized)) {
+        return false;
+    }
+    record({std::move(normalized), ChangeType::PERMISSION_CHANGED, {}, {.mode = mode, .uid = uid, .gid = gid}});
+    return true;
+}
+
+bool VirtualFileSystem::remove(const std::string_view path) {
+    auto normalized = normalizePath(path);
+    const auto entry = resolve(normalized);
+    if (!entry) {
+        return false;
+    }
+    record({std::move(normalized), isDirectory(*entry) ? ChangeType::DIRECTORY_REMOVED : ChangeType::REMOVED, {}});
+    return true;
+}
+
+bool VirtualFileSystem::rename(const std::string_view from, const std::string_view to) {
+    auto source = normalizePath(from);
+    auto target = normalizePath(to);
+    const auto entry = resolve(source);
+    if (!entry || isInSubtree(target, source) || resolve(target)) {
+        return false;
+    }
+    if (isDirectory(*entry)) {
+        record({std::move(source), ChangeType::DIRECTORY_MOVED, {}, {}, std::move(target)});
+        return true;
+    }
+    record({std::move(source), ChangeType::REMOVED, {}});
+    record({std::move(target), ChangeType::ADDED, entry->digest.str(), entry->metadata});
+    return true;
+}
+
+std::size_t VirtualFileSystem::changeCount() const {
+    return m_changes.size();
+}
+
+bool VirtualFileSystem::isDirty() const {
+    return !m_changes.empty();
+}
+
+std::shared_ptr<const Layer> VirtualFileSystem::commit(const std::string &layer_id) {
+    LayerBuilder builder(layer_id);
+    builder.append(std::vector(std::make_move_iterator(m_changes.begin()), std::make_move_iterator(m_changes.end())));
+    discard();
+    return builder.finish();
+}
+
+void VirtualFileSystem::discard() {
+    m_index = {};
+    m_changes.clear();
+}
+
+std::optional<FileEntry> VirtualFileSystem::resolve(std::string path) const {
+    return m_index.resolve(
+        std::move(path), ChangeRef{1, 0},
+        [this](const ChangeRef ref) -> const FileChange & {
+            return m_changes[ref.change];
+        },
+        [this](const std::string &source) {
+            return m_plan->lookup(source);
+        });
+}
+
+void VirtualFileSystem::record(FileChange change) {
+    m_changes.push_back(std::move(change));
+    m_index.add(m_changes.back(), {0, static_cast<std::uint32_t>(m_changes.size() - 1)});
+}
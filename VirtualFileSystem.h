@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "FileEntry.h"
+#include "Layer.h"
+#include "PathIndex.h"
+#include "Plan.h"
+
+namespace Dualys {
+    /**
+     * @class VirtualFileSystem
+     * @brief Copy-on-write filesystem view over a plan.
+     *
+     * Reads resolve one path at a time: first through the private overlay of changes written
+     * through the view, then through the plan and its base chain (see Plan::lookup()). Writes only
+     * record changes in the overlay, so the state of the plan is never copied nor modified.
+     *
+     * The recorded changes can then be turned into a layer with commit() and applied to the plan,
+     * or to any plan with the same state. Every write checks its precondition against the current
+     * view, so the committed layer passes Plan::validateLayer().
+     *
+     * Paths are normalized (see normalizePath()). A view is not thread-safe.
+     */
+    class VirtualFileSystem {
+    public:
+        explicit VirtualFileSystem(std::shared_ptr<const Plan> plan);
+
+        /**
+         * @brief Returns the plan the view reads through.
+         */
+        const std::shared_ptr<const Plan> &getPlan() const;
+
+        /**
+         * @brief Returns the entry at `path` as seen through the view, or std::nullopt.
+         */
+        std::optional<FileEntry> stat(std::string_view path) const;
+
+        bool exists(std::string_view path) const;
+
+        /**
+         * @brief Writes a regular file.
+         *
+         * A missing file is created with `mode`; an existing regular file gets the new content and
+         * keeps its permissions; any other kind of entry is replaced.
+         */
+        void writeFile(std::string_view path, std::string_view content_hash, std::uint64_t size,
+                       std::uint32_t mode = 0644);
+
+        /**
+         * @brief Creates a directory entry.
+         * @return false if `path` already has an entry.
+         */
+        bool makeDirectory(std::string_view path, std::uint32_t mode = 0755);
+
+        /**
+         * @brief Changes the permissions and ownership of an entry.
+         * @return false if `path` has no entry.
+         */
+        bool setPermissions(std::string_view path, std::uint32_t mode, std::uint32_t uid, std::uint32_t gid);
+
+        /**
+         * @brief Removes an entry; a directory entry is removed with all of its descendants.
+         * @return false if `path` has no entry.
+         */
+        bool remove(std::string_view path);
+
+        /**
+         * @brief Renames an entry; a directory entry is moved with all of its descendants.
+         * @return false if `from` has no entry, `to` already has one, or `to` lies inside `from`.
+         */
+        bool rename(std::string_view from, std::string_view to);
+
+        /**
+         * @brief Returns the number of changes recorded in the overlay.
+         */
+        std::size_t changeCount() const;
+
+        bool isDirty() const;
+
+        /**
+         * @brief Turns the overlay into a normalized layer (see LayerBuilder) and empties it.
+         *
+         * The layer is meant to be applied to the plan of the view, e.g. with Plan::applyLayer().
+         */
+        std::shared_ptr<const Layer> commit(const std::string &layer_id);
+
+        /**
+         * @brief Drops every change recorded in the overlay.
+         */
+        void discard();
+
+    private:
+        std::shared_ptr<const Plan> m_plan;
+        // A deque keeps the recorded changes at a stable address, as the index refers to their paths.
+        std::deque<FileChange> m_changes;
+        PathIndex m_index;
+
+        std::optional<FileEntry> resolve(std::string path) const;
+
+        void record(FileChange change);
+    };
+}
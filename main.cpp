@@ -9,6 +9,13 @@ int main(const int argc, const char **argv) {
         return 1;
     }
     const auto file_path = argv[1];
-    const auto p = new Plan("0",nullptr);
+    const auto p = Plan::loadFromFile(file_path);
+    if (!p) {
+        std::cerr << "Unable to load plan from '" << file_path << "'" << std::endl;
+        return 1;
+    }
+    for (const auto &[path, entry]: p->getFileSystemState()) {
+        std::cout << path << " " << entry.digest.str() << std::endl;
+    }
     return 0;
 }